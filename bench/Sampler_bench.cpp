@@ -0,0 +1,272 @@
+// Host benchmarks for the Sampler and Configuration hot paths, run against the fake ESP.
+//
+//   pio run -e native_bench && .pio/build/native_bench/program --benchmark_format=json
+//
+// --cycle_model runs every benchmark for a fixed number of iterations and adds a target_cycles
+// counter: host time is converted to ESP8266 cycles using a reference kernel (the bitwise CRC32)
+// whose cost on the target is known, so on-target regressions can be estimated on the host. That
+// only holds for integer code like the kernel: the host FPU does in one instruction what the LX106
+// calls soft-float for, so the float benchmarks get no target_cycles and compare on the host only.
+
+#define ESP8266
+#define Arduino_h
+
+#include <benchmark/benchmark.h>
+#include <chrono>
+#include <math.h>
+#include "../test/fake/Esp.h"
+#include "../test/fake/PubSubClient.h"
+#include "../test/fake/LoopbackServer.h"
+#include "../src/Espx.cpp"
+#include "../src/Format.cpp"
+#include "../src/Payload.cpp"
+#include "../src/Configuration.cpp"
+#include "../src/Sampler.cpp"
+#include "../src/Log.cpp"
+#include "../src/Transport.cpp"
+
+// Xtensa LX106 cost of one byte of the bitwise CRC32: 8 bits at ~10 cycles each.
+#ifndef TARGET_CRC32_CYCLES_PER_BYTE
+#define TARGET_CRC32_CYCLES_PER_BYTE 80
+#endif
+#ifndef BENCH_FIXED_ITERATIONS
+#define BENCH_FIXED_ITERATIONS 10000
+#endif
+#define TRANSPORT_PAYLOAD_SIZE 200
+#define CALIBRATION_BYTES 4096
+#define CALIBRATION_REPEATS 200
+
+static double hostNsPerTargetCycle = 0;
+
+static void reportTargetCycles(benchmark::State& state, std::chrono::steady_clock::time_point start) {
+    if (hostNsPerTargetCycle > 0) {
+        double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+        state.counters["target_cycles"] = benchmark::Counter(ns / hostNsPerTargetCycle, benchmark::Counter::kAvgIterations);
+    }
+}
+
+static uint16_t takeSample() {
+    return 1;
+}
+
+static uint16_t takeMeasurement(uint16_t* samples, uint32_t n) {
+    int sum = 0;
+    for (uint32_t i=0; i < n; i++) sum += samples[i] > 0 ? 1 : -1;
+    return (sum > 0) ? 1 : 0;
+}
+
+static void transmit(uint16_t* measurements, uint32_t n) {
+    benchmark::DoNotOptimize(measurements);
+}
+
+static void BM_SamplerWake(benchmark::State& state) {
+    Configuration config;
+    Sampler sampler(config);
+    config.setParameters(180000, 5000, 5, 1);
+    sampler.onTakeSample(takeSample);
+    sampler.onTakeMeasurement(takeMeasurement);
+    sampler.onTransmit(transmit);
+    config.save();
+    auto start = std::chrono::steady_clock::now();
+    for (auto _ : state) {
+        sampler.setup();
+        sampler.loop();
+    }
+    reportTargetCycles(state, start);
+}
+
+// The same callbacks as a BasicSampler policy, called directly rather than through std::function.
+struct BenchPolicy : SamplerPolicy {
+    bool takeSample(uint16_t& sample) {
+        sample = ::takeSample();
+        return true;
+    }
+    bool takeMeasurement(uint16_t* samples, uint32_t n, uint16_t& measurement) {
+        measurement = ::takeMeasurement(samples, n);
+        return true;
+    }
+    void transmit(uint16_t* measurements, uint32_t n) {
+        ::transmit(measurements, n);
+    }
+};
+
+static void BM_BasicSamplerWake(benchmark::State& state) {
+    Configuration config;
+    BasicSampler<BenchPolicy> sampler(config);
+    config.setParameters(180000, 5000, 5, 1);
+    config.save();
+    auto start = std::chrono::steady_clock::now();
+    for (auto _ : state) {
+        sampler.setup();
+        sampler.loop();
+    }
+    reportTargetCycles(state, start);
+}
+
+static void BM_ConfigurationFromJson(benchmark::State& state) {
+    Configuration config;
+    const char* json = "{\"measurementInterval\": 3600000, \"sampleInterval\": 5000, \"nSamples\": 5, \"transmitFrequency\": 6, \"version\": 104}";
+    auto start = std::chrono::steady_clock::now();
+    for (auto _ : state) {
+        config.fromJson(json);
+    }
+    reportTargetCycles(state, start);
+}
+
+static void BM_CalculateCRC32(benchmark::State& state) {
+    RtcData data;
+    memset(&data, 0x5A, sizeof(data));
+    auto start = std::chrono::steady_clock::now();
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(Configuration::calculateCRC32((uint8_t*) &data, sizeof(data)));
+    }
+    reportTargetCycles(state, start);
+    state.SetBytesProcessed(state.iterations() * sizeof(data));
+}
+
+static void BM_ConfigurationSaveFromMemory(benchmark::State& state) {
+    Configuration config;
+    config.setParameters(180000, 5000, 5, 1);
+    auto start = std::chrono::steady_clock::now();
+    for (auto _ : state) {
+        config.save();
+        benchmark::DoNotOptimize(config.checkMemory());
+        benchmark::DoNotOptimize(config.fromMemory());
+    }
+    reportTargetCycles(state, start);
+}
+
+static void BM_ConfigurationSaveFromMemoryInPlace(benchmark::State& state) {
+    Configuration config;
+    config.setParameters(180000, 5000, 5, 1);
+    config.useRtcMemoryInPlace();
+    auto start = std::chrono::steady_clock::now();
+    for (auto _ : state) {
+        config.save();
+        benchmark::DoNotOptimize(config.checkMemory());
+        benchmark::DoNotOptimize(config.fromMemory());
+    }
+    reportTargetCycles(state, start);
+}
+
+static void BM_PopulateStatusMsg(benchmark::State& state) {
+    Configuration config;
+    char msg[250];
+    config.setParameters(180000, 5000, 5, 1);
+    auto start = std::chrono::steady_clock::now();
+    for (auto _ : state) {
+        config.populateStatusMsg(msg, sizeof(msg));
+        benchmark::DoNotOptimize(msg);
+    }
+    reportTargetCycles(state, start);
+}
+
+// Sleep-time calibration as it was done with a float factor, kept for comparison. On the
+// ESP8266 there is no FPU, so each float multiply and round is a soft-float library call, which
+// the host does not show: the pair is host-relative, and only a run on the target measures it.
+static void BM_CalibratedSleepFloat(benchmark::State& state) {
+    volatile uint32_t sleepTime = 176000;
+    volatile float calibrationFactor = 0.8991009f;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize((uint64_t) round(sleepTime * calibrationFactor) * 1000UL);
+    }
+    state.SetLabel("host-relative");
+}
+
+static void BM_CalibratedSleepFixedPoint(benchmark::State& state) {
+    volatile uint32_t sleepTime = 176000;
+    volatile int32_t driftPpm = -100899;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(Sampler::calibratedMicros(sleepTime, driftPpm));
+    }
+    state.SetLabel("host-relative");
+}
+
+// One transmit (connect, send, disconnect) of a typical payload to a loopback stand-in server.
+// Host sockets say nothing about WiFi latency; this tracks the per-transport CPU and protocol cost.
+static void sendPayload(benchmark::State& state, Transport& transport) {
+    uint8_t payload[TRANSPORT_PAYLOAD_SIZE];
+    memset(payload, '1', sizeof(payload));
+    for (auto _ : state) {
+        if (!transport.connect() || !transport.send(payload, sizeof(payload))) {
+            state.SkipWithError("transport failed");
+            break;
+        }
+        transport.disconnect();
+    }
+}
+
+static void BM_TransportUdp(benchmark::State& state) {
+    UdpLoopbackServer server;
+    WiFiUDP udp;
+    UdpTransport transport(udp, "127.0.0.1", server.getPort());
+    sendPayload(state, transport);
+}
+
+static void BM_TransportHttp(benchmark::State& state) {
+    HttpLoopbackServer server;
+    WiFiClient client;
+    HttpTransport transport(client, "127.0.0.1", server.getPort());
+    sendPayload(state, transport);
+}
+
+static void BM_TransportMqtt(benchmark::State& state) {
+    MqttLoopbackBroker broker;
+    WiFiClient client;
+    PubSubClient mqttClient(client);
+    MqttTransport transport(mqttClient, "127.0.0.1", broker.getPort(), "bench", "bench/status");
+    sendPayload(state, transport);
+}
+
+// Time the reference kernel on this host to find how long one target cycle takes here.
+static void calibrateCycleModel() {
+    static uint8_t buffer[CALIBRATION_BYTES];
+    memset(buffer, 0xA5, sizeof(buffer));
+    uint32_t crc = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (int i=0; i < CALIBRATION_REPEATS; i++) {
+        crc ^= Configuration::calculateCRC32(buffer, sizeof(buffer));
+        benchmark::DoNotOptimize(crc);
+    }
+    double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+    hostNsPerTargetCycle = ns / ((double) CALIBRATION_REPEATS * CALIBRATION_BYTES * TARGET_CRC32_CYCLES_PER_BYTE);
+}
+
+static bool takeFlag(int& argc, char** argv, const char* flag) {
+    for (int i=1; i < argc; i++) {
+        if (strcmp(argv[i], flag) == 0) {
+            for (int j=i; j < argc - 1; j++) argv[j] = argv[j + 1];
+            argc--;
+            return true;
+        }
+    }
+    return false;
+}
+
+int main(int argc, char** argv) {
+    bool cycleModel = takeFlag(argc, argv, "--cycle_model");
+    if (cycleModel) calibrateCycleModel();
+
+    benchmark::internal::Benchmark* benchmarks[] = {
+        benchmark::RegisterBenchmark("SamplerWake", BM_SamplerWake),
+        benchmark::RegisterBenchmark("BasicSamplerWake", BM_BasicSamplerWake),
+        benchmark::RegisterBenchmark("ConfigurationFromJson", BM_ConfigurationFromJson),
+        benchmark::RegisterBenchmark("CalculateCRC32", BM_CalculateCRC32),
+        benchmark::RegisterBenchmark("ConfigurationSaveFromMemory", BM_ConfigurationSaveFromMemory),
+        benchmark::RegisterBenchmark("ConfigurationSaveFromMemoryInPlace", BM_ConfigurationSaveFromMemoryInPlace),
+        benchmark::RegisterBenchmark("PopulateStatusMsg", BM_PopulateStatusMsg),
+        benchmark::RegisterBenchmark("CalibratedSleepFloat", BM_CalibratedSleepFloat),
+        benchmark::RegisterBenchmark("CalibratedSleepFixedPoint", BM_CalibratedSleepFixedPoint),
+    };
+    benchmark::RegisterBenchmark("TransportUdp", BM_TransportUdp)->UseRealTime();
+    benchmark::RegisterBenchmark("TransportHttp", BM_TransportHttp)->UseRealTime();
+    benchmark::RegisterBenchmark("TransportMqtt", BM_TransportMqtt)->UseRealTime();
+    if (cycleModel) {
+        for (auto benchmark : benchmarks) benchmark->Iterations(BENCH_FIXED_ITERATIONS);
+    }
+
+    benchmark::Initialize(&argc, argv);
+    benchmark::RunSpecifiedBenchmarks();
+    benchmark::Shutdown();
+    return 0;
+}
@@ -7,4 +7,10 @@
 #define MQTT_PORT       1883
 #define MQTT_CLIENT_ID  "The id of this particular client"
 #define MQTT_IN_TOPIC   "MQTT topic name e.g. sensor1/config"
-#define MQTT_OUT_TOPIC  "MQTT topic name e.g. sensor1/status"
\ No newline at end of file
+#define MQTT_OUT_TOPIC  "MQTT topic name e.g. sensor1/status"
+// Optional transports, used instead of MQTT when they are cheaper (see README).
+// #define HTTP_SERVER     "Your http server name/address"
+// #define HTTP_PORT       80
+// #define HTTP_PATH       "/sensor1"
+// #define UDP_SERVER      "Your udp server name/address"
+// #define UDP_PORT        5005
@@ -0,0 +1,282 @@
+// Fleet simulator: runs many Sampler + Configuration instances against the fake ESP, each with
+// its own RTC memory and clocks (EspContext), to see how a fleet on one configuration would load
+// the access point and broker and what it costs each device in energy.
+//
+//   pio run -e native_sim && .pio/build/native_sim/program --devices 500 --days 14
+//
+// Devices are independent, so they are shared out over a pool of threads with no locking while
+// they run; each thread keeps its own per-second counts, which are summed at the end. The result
+// does not depend on the number of threads.
+//
+// Options:
+//   --devices n        fleet size (500)
+//   --days n           simulated time from a fleet-wide power on (7)
+//   --threads n        worker threads (all cores)
+//   --seed n           varies each device's clock drift, boot time and connection times
+//   --config json      configuration message applied over the default parameters
+//   --no-slots         don't slot transmits by client id
+//   --no-sync          don't synchronise to (simulated) NTP on each transmit
+//   --no-early-radio   don't start WiFi associating until the transmit callback
+//   --sample-ms n      time the sensor takes for each sample (2)
+//   --timeline file    per-second connections and messages, as CSV, for every busy second
+//   --energy file      per-device wakes, transmits and mAh per day, as CSV
+
+#define ESP8266
+#define Arduino_h
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <stdlib.h>
+#include "../test/fake/Esp.h"
+#include "../src/Espx.cpp"
+#include "../src/Format.cpp"
+#include "../src/Configuration.cpp"
+#include "../src/Sampler.cpp"
+
+#define SIM_DEVICES 500
+#define SIM_DAYS 7
+#define SIM_EPOCH 1700000000ULL         // seconds since the epoch at fleet power on.
+
+#define BOOT_MS 60                      // reset to setup().
+#define SAMPLE_MS 2
+#define MEASUREMENT_MS 1
+#define POWER_ON_JITTER_MS 250          // spread of boot times after a power cut.
+#define WIFI_CONNECT_MS 1200            // association and DHCP.
+#define WIFI_JITTER_MS 800
+#define MQTT_PUBLISH_MS 150             // connect and publish once associated.
+#define MQTT_WAIT_MS 200                // waiting for the retained config.
+#define RTC_DRIFT_PPM 30000             // each device's RTC is off by up to +/- 3%.
+
+#define AWAKE_RADIO_OFF_UA 15000        // wake after RF_DISABLED.
+#define AWAKE_RADIO_ON_UA 75000
+#define RF_CAL_UA_MS (30 * 120000ULL)   // a full RF calibration: ~30 ms at ~120 mA.
+#define DEEP_SLEEP_UA 20
+#define UA_MS_PER_MAH 3600000000.0
+
+typedef struct {
+    int devices = SIM_DEVICES;
+    double days = SIM_DAYS;
+    unsigned threads = 0;
+    uint32_t seed = 1;
+    const char* config = NULL;
+    bool slots = true;
+    bool sync = true;
+    bool earlyRadio = true;
+    uint32_t sampleMs = SAMPLE_MS;
+    const char* timeline = NULL;
+    const char* energy = NULL;
+} Options;
+
+typedef struct {
+    EspContext context;
+    char clientId[24];
+    uint64_t rng;
+    int32_t rtcDriftPpm;
+    uint64_t now;                       // true ms since fleet power on.
+    uint64_t energyUaMs;
+    uint32_t wakes;
+    uint32_t transmits;
+    uint64_t transmitAwakeMs;           // awake time of the transmit wakes.
+} Device;
+
+// Per-second counts for the devices one worker has run.
+typedef struct {
+    std::vector<uint32_t> connections;
+    std::vector<uint32_t> messages;
+} Load;
+
+static uint32_t nextRandom(Device& device) {
+    device.rng ^= device.rng << 13;
+    device.rng ^= device.rng >> 7;
+    device.rng ^= device.rng << 17;
+    return (uint32_t) (device.rng >> 32);
+}
+
+static void recordSession(Load& load, uint64_t start, uint64_t published, uint64_t end) {
+    uint64_t last = load.connections.size() - 1;
+    for (uint64_t s = start / 1000; s <= (end - 1) / 1000 && s <= last; s++) load.connections[s]++;
+    if (published / 1000 <= last) load.messages[published / 1000]++;
+}
+
+// One device from power on until the end of the simulation. Every wake starts from reset, as on
+// the device: only what is in its EspContext survives.
+static void simulate(Device& device, Load& load, const Options& options, uint64_t endMs) {
+    espContext = &device.context;
+    fakeResetInfo().reason = REASON_DEFAULT_RST;
+    device.now = nextRandom(device) % POWER_ON_JITTER_MS;
+    RFMode wakeMode = RF_DEFAULT;
+
+    while (device.now < endMs) {
+        fakeTicks() = BOOT_MS;
+        Configuration config;
+        Sampler sampler(config);
+        config.setParameters(180000, 5000, 5, 1);
+        if (options.config) config.fromJson(options.config);
+        sampler.setup();
+        // Association runs in the background from WiFi.begin until associatedAt (ticks).
+        uint64_t radioStart = 0, associatedAt = 0;
+        bool transmitted = false;
+        auto startRadio = [&]() {
+            if (associatedAt) return;
+            radioStart = fakeTicks();
+            associatedAt = fakeTicks() + WIFI_CONNECT_MS + nextRandom(device) % WIFI_JITTER_MS;
+        };
+        sampler.onTakeSample([&]() -> uint16_t {
+            fakeTicks() += options.sampleMs;
+            return 1;
+        });
+        sampler.onTakeMeasurement([](uint16_t* samples, uint32_t n) -> uint16_t {
+            fakeTicks() += MEASUREMENT_MS;
+            return samples[0];
+        });
+        if (options.earlyRadio) sampler.onStartRadio(startRadio);
+        sampler.onTransmit([&](uint16_t* measurements, uint32_t n) {
+            startRadio();
+            uint64_t start = device.now + radioStart;
+            if (fakeTicks() < associatedAt) fakeTicks() = associatedAt;
+            if (options.sync) sampler.synchronise((uint32_t) (SIM_EPOCH + (device.now + fakeTicks()) / 1000));
+            fakeTicks() += MQTT_PUBLISH_MS;
+            uint64_t published = device.now + fakeTicks();
+            fakeTicks() += MQTT_WAIT_MS;
+            recordSession(load, start, published, device.now + fakeTicks());
+            device.transmits++;
+            transmitted = true;
+        });
+        if (options.slots) sampler.slotTransmits(Sampler::slotFor(device.clientId));
+        sampler.loop();
+
+        uint64_t awakeMs = fakeTicks();
+        uint64_t sleepMs = ESP.getSleepTime() * (uint64_t) (PPM + device.rtcDriftPpm) / PPM / 1000;
+        device.energyUaMs += awakeMs * (wakeMode == RF_DISABLED ? AWAKE_RADIO_OFF_UA : AWAKE_RADIO_ON_UA);
+        if (wakeMode == RF_DEFAULT || wakeMode == RF_CAL) device.energyUaMs += RF_CAL_UA_MS;
+        device.energyUaMs += sleepMs * DEEP_SLEEP_UA;
+        device.wakes++;
+        if (transmitted) device.transmitAwakeMs += awakeMs;
+
+        wakeMode = ESP.getSleepMode();
+        fakeRtcTicks() += (awakeMs + sleepMs) * 1000;
+        fakeResetInfo().reason = REASON_DEEP_SLEEP_AWAKE;
+        device.now += awakeMs + sleepMs;
+    }
+}
+
+static bool parse(int argc, char** argv, Options& options) {
+    for (int i=1; i < argc; i++) {
+        const char* arg = argv[i];
+        const char* value = (i + 1 < argc) ? argv[i + 1] : NULL;
+        if (strcmp(arg, "--no-slots") == 0) options.slots = false;
+        else if (strcmp(arg, "--no-sync") == 0) options.sync = false;
+        else if (strcmp(arg, "--no-early-radio") == 0) options.earlyRadio = false;
+        else if (value == NULL) return false;
+        else if (strcmp(arg, "--devices") == 0) options.devices = atoi(argv[++i]);
+        else if (strcmp(arg, "--days") == 0) options.days = atof(argv[++i]);
+        else if (strcmp(arg, "--threads") == 0) options.threads = atoi(argv[++i]);
+        else if (strcmp(arg, "--seed") == 0) options.seed = strtoul(argv[++i], NULL, 10);
+        else if (strcmp(arg, "--sample-ms") == 0) options.sampleMs = strtoul(argv[++i], NULL, 10);
+        else if (strcmp(arg, "--config") == 0) options.config = argv[++i];
+        else if (strcmp(arg, "--timeline") == 0) options.timeline = argv[++i];
+        else if (strcmp(arg, "--energy") == 0) options.energy = argv[++i];
+        else return false;
+    }
+    return options.devices > 0 && options.days > 0;
+}
+
+int main(int argc, char** argv) {
+    Options options;
+    if (!parse(argc, argv, options)) {
+        fprintf(stderr, "usage: %s [--devices n] [--days n] [--threads n] [--seed n] [--config json]\n"
+                        "          [--no-slots] [--no-sync] [--no-early-radio] [--sample-ms n]\n"
+                        "          [--timeline file] [--energy file]\n", argv[0]);
+        return 1;
+    }
+    if (options.threads == 0) options.threads = std::thread::hardware_concurrency();
+    if (options.threads == 0) options.threads = 1;
+    uint64_t endMs = (uint64_t) (options.days * 86400000.0);
+    size_t seconds = endMs / 1000 + 1;
+
+    std::vector<Device> devices(options.devices);
+    for (int i=0; i < options.devices; i++) {
+        Device& device = devices[i];
+        memset(&device, 0, sizeof(device));
+        snprintf(device.clientId, sizeof(device.clientId), "sensor%04d", i);
+        device.rng = ((uint64_t) options.seed << 32) ^ (0x9E3779B97F4A7C15ULL * (i + 1));
+        device.rtcDriftPpm = (int32_t) (nextRandom(device) % (2 * RTC_DRIFT_PPM + 1)) - RTC_DRIFT_PPM;
+    }
+
+    std::vector<Load> loads(options.threads);
+    std::vector<std::thread> workers;
+    std::atomic<int> next(0);
+    auto start = std::chrono::steady_clock::now();
+    for (unsigned t=0; t < options.threads; t++) {
+        loads[t].connections.assign(seconds, 0);
+        loads[t].messages.assign(seconds, 0);
+        workers.emplace_back([&, t]() {
+            int i;
+            while ((i = next++) < options.devices) simulate(devices[i], loads[t], options, endMs);
+        });
+    }
+    for (auto& worker : workers) worker.join();
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    Load total;
+    total.connections.assign(seconds, 0);
+    total.messages.assign(seconds, 0);
+    for (auto& load : loads) {
+        for (size_t s=0; s < seconds; s++) {
+            total.connections[s] += load.connections[s];
+            total.messages[s] += load.messages[s];
+        }
+    }
+
+    uint64_t wakes = 0, transmits = 0, transmitAwakeMs = 0, messages = 0, busySeconds = 0, connectionSeconds = 0;
+    size_t peakConnectionsAt = 0, peakMessagesAt = 0;
+    for (size_t s=0; s < seconds; s++) {
+        messages += total.messages[s];
+        connectionSeconds += total.connections[s];
+        if (total.connections[s] > 0) busySeconds++;
+        if (total.connections[s] > total.connections[peakConnectionsAt]) peakConnectionsAt = s;
+        if (total.messages[s] > total.messages[peakMessagesAt]) peakMessagesAt = s;
+    }
+    double minMah = 0, maxMah = 0, sumMah = 0;
+    for (int i=0; i < options.devices; i++) {
+        double mahPerDay = devices[i].energyUaMs / UA_MS_PER_MAH / options.days;
+        wakes += devices[i].wakes;
+        transmits += devices[i].transmits;
+        transmitAwakeMs += devices[i].transmitAwakeMs;
+        sumMah += mahPerDay;
+        if (i == 0 || mahPerDay < minMah) minMah = mahPerDay;
+        if (i == 0 || mahPerDay > maxMah) maxMah = mahPerDay;
+    }
+
+    printf("%d devices, %.1f days in %.1f s on %u threads (%llu wakes)\n", options.devices, options.days, elapsed,
+           options.threads, (unsigned long long) wakes);
+    printf("connections: peak %u at %zu s, mean %.2f over %llu busy seconds\n", total.connections[peakConnectionsAt],
+           peakConnectionsAt, busySeconds ? (double) connectionSeconds / busySeconds : 0.0, (unsigned long long) busySeconds);
+    printf("messages:    peak %u/s at %zu s, mean %.3f/s\n", total.messages[peakMessagesAt], peakMessagesAt,
+           (double) messages / seconds);
+    printf("awake:       mean %.0f ms per transmit wake\n", transmits ? (double) transmitAwakeMs / transmits : 0.0);
+    printf("energy:      mean %.2f mAh/day per device (min %.2f, max %.2f)\n", sumMah / options.devices, minMah, maxMah);
+
+    if (options.timeline) {
+        FILE* file = fopen(options.timeline, "w");
+        if (!file) return 1;
+        fprintf(file, "second,connections,messages\n");
+        for (size_t s=0; s < seconds; s++) {
+            if (total.connections[s] || total.messages[s]) fprintf(file, "%zu,%u,%u\n", s, total.connections[s], total.messages[s]);
+        }
+        fclose(file);
+    }
+    if (options.energy) {
+        FILE* file = fopen(options.energy, "w");
+        if (!file) return 1;
+        fprintf(file, "device,wakes,transmits,mah_per_day\n");
+        for (auto& device : devices) {
+            fprintf(file, "%s,%u,%u,%.3f\n", device.clientId, device.wakes, device.transmits,
+                    device.energyUaMs / UA_MS_PER_MAH / options.days);
+        }
+        fclose(file);
+    }
+    return 0;
+}
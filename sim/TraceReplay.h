@@ -0,0 +1,49 @@
+// Replays wakes captured in a WAKE_TRACE ring (Trace.h) through Sampler on the fake ESP, so the
+// scheduling decisions of a unit in the field can be reproduced on the host. Include after the
+// fake ESP and the Sampler, Configuration and Trace sources, with WAKE_TRACE defined.
+
+#ifndef TRACEREPLAY_H
+#define TRACEREPLAY_H
+
+#ifndef WAKE_TRACE
+#error "TraceReplay.h needs WAKE_TRACE"
+#endif
+
+// Whether the next wake calibrates depends on radio state that is not traced, and the replay has
+// no awake-time budget (an overrun wake replays as the same decision made at the same time).
+#define TRACE_REPLAY_FLAGS (0xFF & ~(TRACE_RF_CAL | TRACE_OVERRUN))
+
+// Runs the wake a record describes - same configuration, counter and clock drift, with the time
+// awake standing in for the recorded correction - and returns the record the replay wrote.
+// External and slot wakes depend on timer state outside the trace, so are not replayed; nor is
+// the offset from a transmitOffset, so leave that out of configJson.
+static bool replayWake(const char* configJson, int32_t driftPpm, const TraceRecord* recorded, TraceRecord* replayed) {
+    if (recorded->counter == 0 || (recorded->flags & (TRACE_EVENT | TRACE_SLOT))) return false;
+    memset(fakeRtc(), 0, sizeof(fakeRtc()));
+    fakeResetInfo().reason = REASON_DEEP_SLEEP_AWAKE;
+    Trace::clear();
+
+    Configuration config;
+    Sampler sampler(config);
+    config.setParameters(180000, 5000, 5, 1);
+    if (configJson) config.fromJson(configJson);
+    while (config.getCounter() != recorded->counter) config.incrementCounter();
+    config.resetSynchronisation(0, driftPpm);
+    config.save();
+
+    fakeTicks() = 0;
+    sampler.setup();
+    fakeTicks() = (unsigned long) (long) recorded->correctionTime;
+    sampler.loop();
+    return Trace::populateRecord(Trace::getCount() - 1, replayed);
+}
+
+static bool sameDecision(const TraceRecord* recorded, const TraceRecord* replayed) {
+    return recorded->counter == replayed->counter &&
+           (recorded->flags & TRACE_REPLAY_FLAGS) == (replayed->flags & TRACE_REPLAY_FLAGS) &&
+           recorded->nominalSleepTime == replayed->nominalSleepTime &&
+           recorded->correctionTime == replayed->correctionTime &&
+           recorded->sleepTime == replayed->sleepTime;
+}
+
+#endif // TRACEREPLAY_H
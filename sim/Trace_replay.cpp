@@ -0,0 +1,73 @@
+// Replays a wake trace shipped by a unit built with -D WAKE_TRACE through Sampler on the fake ESP,
+// and shows where the scheduling decisions it made differ from those the code makes now.
+//
+//   pio run -e native_replay
+//   .pio/build/native_replay/program --config "{measurementInterval: 180000, ...}" --drift -100899 <trace hex>
+//
+// The configuration is the config message the unit was running (the defaults of main.cpp for
+// anything left out) and --drift the driftPpm from its status message. Exits non-zero if any
+// replayed wake differs.
+
+#define ESP8266
+#define Arduino_h
+#define WAKE_TRACE
+
+#include <stdlib.h>
+#include "../test/fake/Esp.h"
+#include "../src/Espx.cpp"
+#include "../src/Format.cpp"
+#include "../src/Configuration.cpp"
+#include "../src/Sampler.cpp"
+#include "../src/Trace.cpp"
+#include "TraceReplay.h"
+
+#define MAX_REPLAY_RECORDS 256
+
+static void describe(const TraceRecord* record, char* flags) {
+    flags[0] = (record->flags & TRACE_SAMPLE) ? 'S' : '-';
+    flags[1] = (record->flags & TRACE_MEASUREMENT) ? 'M' : '-';
+    flags[2] = (record->flags & TRACE_TRANSMIT) ? 'T' : '-';
+    flags[3] = (record->flags & TRACE_EVENT) ? 'E' : (record->flags & TRACE_SLOT) ? 'W' : '-';
+    flags[4] = (record->flags & TRACE_RF_CAL) ? 'C' : (record->flags & TRACE_RADIO) ? 'R' : '-';
+    flags[5] = (record->flags & TRACE_OVERRUN) ? 'O' : '-';
+    flags[6] = 0;
+}
+
+static void print(const char* label, const TraceRecord* record) {
+    char flags[7];
+    describe(record, flags);
+    printf("%-9s %7u  %s %10u  %10d  %10u\n", label, record->counter, flags, record->nominalSleepTime,
+           record->correctionTime, record->sleepTime);
+}
+
+int main(int argc, char** argv) {
+    const char* configJson = NULL;
+    const char* hex = NULL;
+    int32_t driftPpm = 0;
+    for (int i=1; i < argc; i++) {
+        if (strcmp(argv[i], "--config") == 0 && i + 1 < argc) configJson = argv[++i];
+        else if (strcmp(argv[i], "--drift") == 0 && i + 1 < argc) driftPpm = atol(argv[++i]);
+        else hex = argv[i];
+    }
+    if (hex == NULL) {
+        fprintf(stderr, "usage: %s [--config json] [--drift ppm] <trace hex>\n", argv[0]);
+        return 2;
+    }
+
+    static TraceRecord records[MAX_REPLAY_RECORDS];
+    size_t n = Trace::fromMsg(hex, records, MAX_REPLAY_RECORDS);
+    int differences = 0;
+    printf("          counter  flags     nominal  correction       sleep\n");
+    for (size_t i=0; i < n; i++) {
+        TraceRecord replayed;
+        print("recorded", &records[i]);
+        if (!replayWake(configJson, driftPpm, &records[i], &replayed)) {
+            printf("          not replayed - depends on timer state outside the trace\n");
+        } else if (!sameDecision(&records[i], &replayed)) {
+            print("replayed", &replayed);
+            differences++;
+        }
+    }
+    printf("%zu wakes, %d differ\n", n, differences);
+    return differences ? 1 : 0;
+}
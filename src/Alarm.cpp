@@ -0,0 +1,140 @@
+#include <string.h>
+#include <stdlib.h>
+#include <limits.h>
+
+#include "Alarm.h"
+#include "Format.h"
+
+#ifdef ALARMS
+
+static const char ALARM_TYPES[] = "><+-!";
+
+// The number at text, up to max: just past it, or NULL if there is none.
+static const char* parseNumber(const char* text, uint32_t max, uint32_t* value) {
+  if (*text < '0' || *text > '9') return NULL;
+  if (!Format::parseUnsigned(text, value) || *value > max) return NULL;
+  while (*text >= '0' && *text <= '9') text++;
+  return text;
+}
+
+bool Alarm::parseRule(const char* text, AlarmRule* rule) {
+  AlarmRule parsed;
+  uint32_t level, hysteresis = 0, holdOff = ALARM_DEFAULT_HOLD_OFF;
+  memset(&parsed, 0, sizeof(parsed));
+  while (*text == ' ') text++;
+  if (*text) {
+    if (*text != 's' && *text != 'm') return false;
+    parsed.source = (*text++ == 's') ? ALARM_SAMPLE : ALARM_MEASUREMENT;
+    const char* type = *text ? strchr(ALARM_TYPES, *text) : NULL;
+    if (type == NULL) return false;
+    parsed.type = ALARM_ABOVE + (type - ALARM_TYPES);
+    text = parseNumber(text + 1, USHRT_MAX, &level);
+    if (text && *text == '~') text = parseNumber(text + 1, USHRT_MAX, &hysteresis);
+    if (text && *text == '/') text = parseNumber(text + 1, USHRT_MAX, &holdOff);
+    if (text == NULL) return false;
+    while (*text == ' ') text++;
+    if (*text) return false;
+    parsed.level = level;
+    parsed.hysteresis = hysteresis;
+    parsed.holdOff = holdOff;
+  }
+  *rule = parsed;
+  return true;
+}
+
+// Runs the rules on source over a new reading, at time (seconds, as Sampler::currentTime). True
+// if one of them now owes an alert.
+bool Alarm::check(Alarms* alarms, uint8_t source, uint16_t value, uint32_t time) {
+  bool alert = false;
+  for (uint8_t i=0; i < ALARM_RULES; i++) {
+    const AlarmRule* rule = &alarms->rules[i];
+    AlarmState* state = &alarms->states[i];
+    if (rule->type == ALARM_NONE || rule->source != source) continue;
+    bool primed = state->flags & ALARM_PRIMED;
+    int32_t change = primed ? (int32_t) value - state->last : 0;
+    int32_t level = rule->level;
+    int32_t hysteresis = rule->hysteresis;
+    bool fires = false;
+    bool rearms = true;
+    switch (rule->type) {
+      case ALARM_ABOVE:
+        fires = value > level;
+        rearms = value <= level - hysteresis;
+        break;
+      case ALARM_BELOW:
+        fires = value < level;
+        rearms = value >= level + hysteresis;
+        break;
+      case ALARM_RISE:
+        fires = primed && change >= level;
+        rearms = change < level - hysteresis;
+        break;
+      case ALARM_DROP:
+        fires = primed && -change >= level;
+        rearms = -change < level - hysteresis;
+        break;
+      case ALARM_CHANGE:
+        fires = primed && abs(change) >= (level > 0 ? level : 1);
+        break;
+    }
+    if (rearms) state->flags &= ~ALARM_ACTIVE;
+    if (fires && !(state->flags & ALARM_ACTIVE)) {
+      state->flags |= ALARM_ACTIVE;
+      state->value = value;
+      if (state->fired < UCHAR_MAX) state->fired++;
+      if (!(state->flags & ALARM_ALERTED) || time - state->alertedAt >= rule->holdOff) {
+        state->flags |= ALARM_ALERT_DUE;
+        alert = true;
+      }
+    }
+    state->last = value;
+    state->flags |= ALARM_PRIMED;
+  }
+  return alert;
+}
+
+bool Alarm::isAlertDue(const Alarms* alarms) {
+  for (uint8_t i=0; i < ALARM_RULES; i++) {
+    if (alarms->states[i].flags & ALARM_ALERT_DUE) return true;
+  }
+  return false;
+}
+
+// The alerts owed have been sent (or tried), so each of those rules starts its hold off.
+void Alarm::alerted(Alarms* alarms, uint32_t time) {
+  for (uint8_t i=0; i < ALARM_RULES; i++) {
+    AlarmState* state = &alarms->states[i];
+    if (!(state->flags & ALARM_ALERT_DUE)) continue;
+    state->flags = (state->flags & ~ALARM_ALERT_DUE) | ALARM_ALERTED;
+    state->alertedAt = time;
+  }
+}
+
+// Bit i for each rule i that has fired since last cleared.
+uint8_t Alarm::getFired(const Alarms* alarms) {
+  uint8_t fired = 0;
+  for (uint8_t i=0; i < ALARM_RULES; i++) {
+    if (alarms->states[i].fired > 0) fired |= 1 << i;
+  }
+  return fired;
+}
+
+// The reading a rule last fired on and how many times it has fired since last cleared.
+bool Alarm::populateFired(const Alarms* alarms, uint8_t rule, uint16_t* value, uint8_t* count) {
+  if (rule >= ALARM_RULES || alarms->states[rule].fired == 0) return false;
+  *value = alarms->states[rule].value;
+  *count = alarms->states[rule].fired;
+  return true;
+}
+
+// The rules that fired have been reported.
+void Alarm::clear(Alarms* alarms) {
+  for (uint8_t i=0; i < ALARM_RULES; i++) alarms->states[i].fired = 0;
+}
+
+// Forget the state of every rule, keeping the rules.
+void Alarm::reset(Alarms* alarms) {
+  memset(alarms->states, 0, sizeof(alarms->states));
+}
+
+#endif // ALARMS
@@ -0,0 +1,76 @@
+// MIT License
+
+// Low Power Sampler Alarm - threshold, rate of change and state change alarms on the readings.
+// Copyright (c) 2021 Simon Chinnick
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#ifndef ALARM_H
+#define ALARM_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "Configuration.h"
+
+// What a rule watches, and how. The rule classes are compiled in only with -D ALARMS, which also
+// sets aside the Alarms in RtcData.
+#define ALARM_SAMPLE 1
+#define ALARM_MEASUREMENT 2
+
+#define ALARM_NONE 0
+#define ALARM_ABOVE 1               // the reading goes above level.
+#define ALARM_BELOW 2               // the reading goes below level.
+#define ALARM_RISE 3                // the reading is level or more above the one before.
+#define ALARM_DROP 4                // the reading is level or more below the one before.
+#define ALARM_CHANGE 5              // the reading changes by level (at least 1) either way, e.g. a switch.
+
+// AlarmState flags.
+#define ALARM_PRIMED 0x01           // last holds a reading.
+#define ALARM_ACTIVE 0x02           // fired, and the readings have not come back by hysteresis since.
+#define ALARM_ALERT_DUE 0x04        // fired outside its hold off, so an alert is to be sent now.
+#define ALARM_ALERTED 0x08          // alertedAt is set.
+
+#define ALARM_DEFAULT_HOLD_OFF 3600 // seconds, when a rule does not give one.
+
+#ifdef ALARMS
+
+// A rule is written "<source><type><level>[~<hysteresis>][/<hold off>]": the source 's' (samples)
+// or 'm' (measurements), the type '>', '<', '+', '-' or '!' as ALARM_ABOVE to ALARM_CHANGE, and
+// the hold off in seconds, e.g. "m<300~20/3600" fires when a measurement falls below 300, again
+// only once one has been back to 320 or more, and forces an alert at most once an hour. An empty
+// rule removes it.
+//
+// A rule that fires is counted until reported; one outside its hold off also owes an immediate
+// alert. Firing within the hold off only counts, so a flapping sensor costs no extra radio wakes.
+class Alarm {
+
+    public:
+    static bool parseRule(const char* text, AlarmRule* rule);
+    static bool check(Alarms* alarms, uint8_t source, uint16_t value, uint32_t time);
+    static bool isAlertDue(const Alarms* alarms);
+    static void alerted(Alarms* alarms, uint32_t time);
+    static uint8_t getFired(const Alarms* alarms);
+    static bool populateFired(const Alarms* alarms, uint8_t rule, uint16_t* value, uint8_t* count);
+    static void clear(Alarms* alarms);
+    static void reset(Alarms* alarms);
+};
+
+#endif // ALARMS
+
+#endif // ALARM_H
@@ -1,40 +1,89 @@
 #define NOT_FOUND __UINT32_MAX__
+#define LEGACY_FACTOR_MIN 0x3E000000UL    // 0.125f
+#define LEGACY_FACTOR_MAX 0x40800000UL    // 4.0f
 
-#include <cstdio>
 #include <ctype.h>
 #include <string.h>
 #include "Espx.h"
 
 #include "Configuration.h"
+#include "Format.h"
+#include "Alarm.h"
 
 Configuration::Configuration() {
-  rtcData.config.counter = 1;
-  rtcData.config.currentVersion = 0;
-  rtcData.config.measurementInterval = 0;
-  rtcData.config.sampleInterval = 0;
-  rtcData.config.nSamples = 0;
-  rtcData.config.transmitFrequency = 0;
-  rtcData.sync.calibrationFactor = 1.0;
-  rtcData.sync.syncTime = 0;
-  rtcData.sync.startTimeOfDay = 0;
+  rtc = &rtcData;
+  mapped = NULL;
+  memoryChecked = false;
+  memoryLayout = RTC_LAYOUT_INVALID;
+  rtc->config.counter = 1;
+  rtc->config.currentVersion = 0;
+  rtc->config.measurementInterval = 0;
+  rtc->config.sampleInterval = 0;
+  rtc->config.nSamples = 0;
+  rtc->config.transmitFrequency = 0;
+  rtc->config.transmitOffset = NO_TRANSMIT_OFFSET;
+  rtc->sync.driftPpm = 0;
+  rtc->sync.syncTime = 0;
+  rtc->sync.startTimeOfDay = 0;
+  rtc->wakeup.sleepStart = 0;
+  rtc->wakeup.sleepDuration = 0;
+  rtc->radio.calibrationMillivolts = 0;
+  rtc->radio.wakesSinceCalibration = 0;
+  rtc->radio.calibrationDue = 0;
+  rtc->overrun.count = 0;
+  rtc->overrun.flags = 0;
+  rtc->overrun.reserved = 0;
+  updateStaged = false;
+#ifdef ALARMS
+  memset(&rtc->alarms, 0, sizeof(rtc->alarms));
+#endif
 }
 
 
-void Configuration::setParameter(const char* key, const char* value) {
-  if (strcmp(key, "sampleInterval") == 0) {
-    if (strlen(value) > 0) sscanf(value, "%u" , &rtcData.config.sampleInterval);
+void Configuration::setParameter(ConfigUpdate* update, const char* key, const char* value) {
+  uint32_t number;
+  ActiveWindow window;
+  while (*value == ' ') value++;
+#ifdef ALARMS
+  if (strncmp(key, "alarm", 5) == 0 && key[5] >= '0' && key[5] < '0' + ALARM_RULES && key[6] == 0) {
+    AlarmRule rule;
+    if (Alarm::parseRule(value, &rule)) update->rules[key[5] - '0'] = rule;
+    return;
+  }
+#endif
+  bool negative = *value == '-';
+  if (!Format::parseUnsigned(negative ? value + 1 : value, &number)) return;
+  unpackActiveWindow(update->startTimeOfDay, &window);
+  if (strcmp(key, "utcOffset") == 0) {
+    int32_t minutes = (int32_t) (number / 60);
+    update->startTimeOfDay = packActiveWindow(window.startMinute, window.activeMinutes, negative ? -minutes : minutes);
+  }
+  else if (negative) return;
+  else if (number > UINT16_MAX && (strcmp(key, "nSamples") == 0 || strcmp(key, "transmitFrequency") == 0 ||
+                                   strcmp(key, "version") == 0)) return;
+  else if (strcmp(key, "startTimeOfDay") == 0) {
+    update->startTimeOfDay = packActiveWindow((number / 60) % MINUTES_PER_DAY, window.activeMinutes, window.utcOffsetMinutes);
+  }
+  else if (strcmp(key, "activeTime") == 0) {
+    update->startTimeOfDay = packActiveWindow(window.startMinute, number / 60, window.utcOffsetMinutes);
+  }
+  else if (strcmp(key, "sampleInterval") == 0) {
+    update->config.sampleInterval = number;
   }
   else if (strcmp(key, "nSamples") == 0) {
-    if (strlen(value) > 0) sscanf(value, "%hu", &rtcData.config.nSamples);
+    update->config.nSamples = (uint16_t) number;
   }
   else if (strcmp(key, "measurementInterval") == 0) {
-    if (strlen(value) > 0) sscanf(value, "%u", &rtcData.config.measurementInterval);
+    update->config.measurementInterval = number;
   }
   else if (strcmp(key, "transmitFrequency") == 0) {
-    if (strlen(value) > 0) sscanf(value, "%hu", &rtcData.config.transmitFrequency);
+    update->config.transmitFrequency = (uint16_t) number;
+  }
+  else if (strcmp(key, "transmitOffset") == 0) {
+    update->config.transmitOffset = number;
   }
   else if (strcmp(key, "version") == 0) {
-    if (strlen(value) > 0) sscanf(value, "%hu", &rtcData.config.currentVersion);
+    update->config.currentVersion = (uint16_t) number;
   }
 }
 
@@ -119,7 +168,26 @@ uint32_t Configuration::calculateCRC32(const uint8_t *data, size_t length) {
 }
 
 
+// Apply a config message to the live configuration straight away.
 void Configuration::fromJson(const char * json) {
+  ConfigUpdate update;
+  populateUpdate(&update);
+  parseJson(json, &update);
+  apply(update);
+}
+
+// Stage a config message, to be applied by applyStaged. False if it changes nothing.
+bool Configuration::stageJson(const char* json) {
+  ConfigUpdate update;
+  populateUpdate(&update);
+  parseJson(json, &update);
+  if (matches(update)) return false;
+  staged = update;
+  updateStaged = true;
+  return true;
+}
+
+void Configuration::parseJson(const char* json, ConfigUpdate* update) {
   char key[MAX_KEY_LENGTH];
   char value[MAX_VALUE_LENGTH];
   size_t length;
@@ -136,116 +204,363 @@ void Configuration::fromJson(const char * json) {
         pos++;
         parseToken(json, pos, length, value);
       }
-      setParameter(key, value);
+      setParameter(update, key, value);
     }
     pos = indexOf(',', json, pos);
     pos = (pos != NOT_FOUND) ? pos + 1 : length;
   }
-  this->resetCounter();
-  this->resetSynchronisation(0,1.0);
+}
+
+// Only a change to the shape of the schedule invalidates the counter, and only a change to the
+// layout of data the samples and measurements in it. The clock calibration always carries on.
+// A schedule that would not fit data is refused, as the samples, measurements and times would
+// run on into whatever follows it in RtcData.
+void Configuration::keepValidData(const Parameters& before) {
+  if (!fitsData(rtc->config.nSamples, rtc->config.transmitFrequency)) {
+    rtc->config.nSamples = before.nSamples;
+    rtc->config.transmitFrequency = before.transmitFrequency;
+  }
+  bool relaid = rtc->config.nSamples != before.nSamples || rtc->config.transmitFrequency != before.transmitFrequency;
+  if (relaid || rtc->config.measurementInterval != before.measurementInterval) this->resetCounter();
+  if (relaid) memset(rtc->data, 0, sizeof(rtc->data));
+}
+
+// Double buffering: hold the parameters, active window and alarm rules of update, e.g. parsed from
+// a config message mid-wake, until applyStaged. The live configuration runs the rest of the wake
+// unchanged.
+void Configuration::stage(Configuration& update) {
+  update.populateUpdate(&staged);
+  updateStaged = true;
+}
+
+// Make the staged update live, at the end of the wake that received it (the transmit wake, which
+// closes the cycle). False if there was none.
+bool Configuration::applyStaged() {
+  if (!updateStaged) return false;
+  updateStaged = false;
+  apply(staged);
+  return true;
+}
+
+void Configuration::populateUpdate(ConfigUpdate* update) {
+  update->config = rtc->config;
+  update->startTimeOfDay = rtc->sync.startTimeOfDay;
+#ifdef ALARMS
+  memcpy(update->rules, rtc->alarms.rules, sizeof(update->rules));
+#endif
+}
+
+void Configuration::apply(const ConfigUpdate& update) {
+  Parameters before = rtc->config;
+  rtc->config = update.config;
+  rtc->config.counter = before.counter;
+  rtc->sync.startTimeOfDay = update.startTimeOfDay;
+#ifdef ALARMS
+  for (uint8_t i=0; i < ALARM_RULES; i++) setAlarmRule(i, update.rules[i]);
+#endif
+  this->keepValidData(before);
+  parametersChanged();
+}
+
+bool Configuration::matches(const ConfigUpdate& update) {
+  return rtc->config.currentVersion == update.config.currentVersion &&
+         rtc->config.measurementInterval == update.config.measurementInterval &&
+         rtc->config.nSamples == update.config.nSamples &&
+         rtc->config.sampleInterval == update.config.sampleInterval &&
+         rtc->config.transmitFrequency == update.config.transmitFrequency &&
+         rtc->config.transmitOffset == update.config.transmitOffset &&
+         rtc->sync.startTimeOfDay == update.startTimeOfDay
+#ifdef ALARMS
+         && memcmp(rtc->alarms.rules, update.rules, sizeof(update.rules)) == 0
+#endif
+         ;
 }
 
 
+// Which layout memory holding crc32 and params was written in, going by what its CRC covers.
+uint8_t Configuration::layoutOf(uint32_t crc32, const Parameters* params) {
+  if (calculateCRC32((const uint8_t*) params, sizeof(Parameters)) == crc32) return RTC_LAYOUT_CURRENT;
+  if (calculateCRC32((const uint8_t*) params, LEGACY_PARAMETERS_SIZE) == crc32) return RTC_LAYOUT_LEGACY;
+  return RTC_LAYOUT_INVALID;
+}
+
 bool Configuration::checkMemory() {
+  if (mapped) {
+    if (!memoryChecked) {
+      memoryLayout = layoutOf(mapped->crc32, &mapped->config);
+      memoryChecked = true;
+    }
+    return memoryLayout != RTC_LAYOUT_INVALID;
+  }
   uint32_t crc32;
   Parameters params;
   if (Espx::rtcUserMemoryRead(OTA_OFFSET, &crc32, sizeof(crc32)) &&
       Espx::rtcUserMemoryRead(OTA_OFFSET + 1, (uint32_t*) &params, sizeof(params))) {
-    uint32_t crcOfParams = calculateCRC32((uint8_t*) &params, sizeof(params));
-    return crcOfParams == crc32;
+    return layoutOf(crc32, &params) != RTC_LAYOUT_INVALID;
   }
   return false;
 }
 
 bool Configuration::equivalentTo(Configuration& other) {
-  return this->rtcData.config.currentVersion == other.rtcData.config.currentVersion &&
-         this->rtcData.config.measurementInterval ==  other.rtcData.config.measurementInterval &&
-         this->rtcData.config.nSamples ==  other.rtcData.config.nSamples &&
-         this->rtcData.config.sampleInterval ==  other.rtcData.config.sampleInterval &&
-         this->rtcData.config.transmitFrequency ==  other.rtcData.config.transmitFrequency
-         ;
+  ConfigUpdate update;
+  other.populateUpdate(&update);
+  return matches(update);
 }
 
 bool Configuration::fromMemory() {
-  if (Espx::rtcUserMemoryRead(OTA_OFFSET, (uint32_t*) &rtcData, sizeof(rtcData))) {
-    uint32_t crcOfConfig = calculateCRC32((uint8_t*) &rtcData.config, sizeof(rtcData.config));
-    return crcOfConfig == rtcData.crc32;
+  uint8_t layout;
+  if (mapped) {
+    if (!checkMemory()) return false;
+    rtc = mapped;
+    layout = memoryLayout;
+  } else {
+    if (!Espx::rtcUserMemoryRead(OTA_OFFSET, (uint32_t*) &rtcData, sizeof(rtcData))) return false;
+    layout = layoutOf(rtc->crc32, &rtc->config);
   }
-  return false;
+  if (layout == RTC_LAYOUT_LEGACY) upgradeLayout();
+  return layout != RTC_LAYOUT_INVALID;
 }
 
 bool Configuration::save() {
-  rtcData.crc32 = calculateCRC32((uint8_t*) &rtcData.config, sizeof(rtcData.config));
-  return Espx::rtcUserMemoryWrite(OTA_OFFSET, &rtcData.crc32, sizeof(rtcData) );
+  rtc->crc32 = calculateCRC32((uint8_t*) &rtc->config, sizeof(rtc->config));
+  if (mapped) {
+    if (rtc != mapped) {
+      memcpy(mapped, rtc, sizeof(RtcData));
+      rtc = mapped;
+    }
+    memoryChecked = true;
+    memoryLayout = RTC_LAYOUT_CURRENT;
+    return true;
+  }
+  return Espx::rtcUserMemoryWrite(OTA_OFFSET, &rtc->crc32, sizeof(rtcData) );
 }
 
+// Work directly on the RTC copy of the configuration where the platform memory maps it, rather
+// than copying it in and out on every read and save. Only the live configuration should do this.
+bool Configuration::useRtcMemoryInPlace() {
+  mapped = (RtcData*) Espx::rtcUserMemoryMap(OTA_OFFSET);
+  memoryChecked = false;
+  return mapped != NULL;
+}
 
-void Configuration::setParameters(
+
+// A schedule that would not fit data is refused, as by a config message, leaving the parameters
+// as they were.
+bool Configuration::setParameters(
     uint32_t measurementInterval,
     uint32_t sampleInterval,
     uint16_t nSamples,
     uint16_t transmitFrequency) {
-  rtcData.config.measurementInterval = measurementInterval;
-  rtcData.config.sampleInterval = sampleInterval;
-  rtcData.config.nSamples = nSamples;
-  rtcData.config.transmitFrequency = transmitFrequency;
-  rtcData.config.counter = 1;
+  if (!fitsData(nSamples, transmitFrequency)) return false;
+  rtc->config.measurementInterval = measurementInterval;
+  rtc->config.sampleInterval = sampleInterval;
+  rtc->config.nSamples = nSamples;
+  rtc->config.transmitFrequency = transmitFrequency;
+  rtc->config.counter = 1;
+  parametersChanged();
+  return true;
 }
 
 uint16_t Configuration::getVersion() {
-  return rtcData.config.currentVersion;
+  return rtc->config.currentVersion;
+}
+
+// The version once any staged update is applied.
+uint16_t Configuration::getStagedVersion() {
+  return updateStaged ? staged.config.currentVersion : rtc->config.currentVersion;
 }
 
 void Configuration::setVersion(unsigned version) {
-  rtcData.config.currentVersion = version;
+  rtc->config.currentVersion = version;
+  staged.config.currentVersion = version;
+  parametersChanged();
 }
 
 uint16_t Configuration::getCounter() {
-  return rtcData.config.counter;
+  return rtc->config.counter;
 }
 
 uint16_t* Configuration::getData() {
-  return rtcData.data;
+  return rtc->data;
 }
 
+#ifdef ROLLUPS
+Rollups* Configuration::getRollups() {
+  return &rtc->rollups;
+}
+#endif
+
+#ifdef ALARMS
+Alarms* Configuration::getAlarms() {
+  return &rtc->alarms;
+}
+
+// A rule that changes starts afresh.
+void Configuration::setAlarmRule(uint8_t i, const AlarmRule& rule) {
+  if (memcmp(&rtc->alarms.rules[i], &rule, sizeof(rule)) == 0) return;
+  rtc->alarms.rules[i] = rule;
+  memset(&rtc->alarms.states[i], 0, sizeof(AlarmState));
+}
+#endif
+
 void Configuration::incrementCounter() {
-  rtcData.config.counter++;
+  rtc->config.counter++;
+  parametersChanged();
 }
 
 void Configuration::resetCounter() {
-  rtcData.config.counter = 1;
+  rtc->config.counter = 1;
+  parametersChanged();
+}
+
+// In place, RTC memory is written as the wake goes, not just at save. Keep the CRC over the
+// Parameters up to date with them, so a reset mid-wake (a crash or brownout) still finds valid
+// memory and keeps the calibration and buffered data, rather than starting again.
+void Configuration::parametersChanged() {
+  if (rtc == mapped) rtc->crc32 = calculateCRC32((uint8_t*) &rtc->config, sizeof(rtc->config));
 }
 
 void Configuration::populateStatusMsg(char * msg, size_t length) {
-  snprintf(msg, length, 
-          "Version: %hu, counter: %hu, measurementInterval: %u, sampleInterval: %u, nSamples: %hu, transmitFrequency: %hu, calibration: %f",
-          rtcData.config.currentVersion, rtcData.config.counter,
-          rtcData.config.measurementInterval, rtcData.config.sampleInterval, rtcData.config.nSamples, rtcData.config.transmitFrequency,
-          rtcData.sync.calibrationFactor);
+  size_t nchars = Format::text(msg, length, "Version: ");
+  nchars += Format::number(msg + nchars, length - nchars, rtc->config.currentVersion);
+  nchars += Format::text(msg + nchars, length - nchars, ", counter: ");
+  nchars += Format::number(msg + nchars, length - nchars, rtc->config.counter);
+  nchars += Format::text(msg + nchars, length - nchars, ", measurementInterval: ");
+  nchars += Format::number(msg + nchars, length - nchars, rtc->config.measurementInterval);
+  nchars += Format::text(msg + nchars, length - nchars, ", sampleInterval: ");
+  nchars += Format::number(msg + nchars, length - nchars, rtc->config.sampleInterval);
+  nchars += Format::text(msg + nchars, length - nchars, ", nSamples: ");
+  nchars += Format::number(msg + nchars, length - nchars, rtc->config.nSamples);
+  nchars += Format::text(msg + nchars, length - nchars, ", transmitFrequency: ");
+  nchars += Format::number(msg + nchars, length - nchars, rtc->config.transmitFrequency);
+  nchars += Format::text(msg + nchars, length - nchars, ", calibration: ");
+  Format::fixed(msg + nchars, length - nchars, PPM + rtc->sync.driftPpm, 6);
 }
 
 void Configuration::populateParameters(Parameters* params) {
-  params->counter = this->rtcData.config.counter;
-  params->currentVersion = this->rtcData.config.currentVersion;
-  params->measurementInterval = this->rtcData.config.measurementInterval;
-  params->sampleInterval = this->rtcData.config.sampleInterval;
-  params->nSamples = this->rtcData.config.nSamples;
-  params->transmitFrequency = this->rtcData.config.transmitFrequency;
+  params->counter = this->rtc->config.counter;
+  params->currentVersion = this->rtc->config.currentVersion;
+  params->measurementInterval = this->rtc->config.measurementInterval;
+  params->sampleInterval = this->rtc->config.sampleInterval;
+  params->nSamples = this->rtc->config.nSamples;
+  params->transmitFrequency = this->rtc->config.transmitFrequency;
+  params->transmitOffset = this->rtc->config.transmitOffset;
 }
 
 void Configuration::populateSynchronisation(Synchronisation* sync) {
-  sync->startTimeOfDay = this->rtcData.sync.startTimeOfDay;
-  sync->syncTime = this->rtcData.sync.syncTime;
-  sync->nominalElapsed = this->rtcData.sync.nominalElapsed;
-  sync->calibrationFactor = this->rtcData.sync.calibrationFactor;
+  sync->startTimeOfDay = this->rtc->sync.startTimeOfDay;
+  sync->syncTime = this->rtc->sync.syncTime;
+  sync->nominalElapsed = this->rtc->sync.nominalElapsed;
+  sync->driftPpm = this->rtc->sync.driftPpm;
+  sync->elapsedMs = this->rtc->sync.elapsedMs;
+  sync->reserved = 0;
+}
+
+void Configuration::populateActiveWindow(ActiveWindow* window) {
+  unpackActiveWindow(this->rtc->sync.startTimeOfDay, window);
 }
 
-void Configuration::resetSynchronisation(uint32_t time, float factor) {
-  this->rtcData.sync.syncTime = time;
-  this->rtcData.sync.nominalElapsed = 0;
-  this->rtcData.sync.calibrationFactor = factor;
+void Configuration::setActiveWindow(uint16_t startMinute, uint16_t activeMinutes, int16_t utcOffsetMinutes) {
+  this->rtc->sync.startTimeOfDay = packActiveWindow(startMinute, activeMinutes, utcOffsetMinutes);
 }
 
+void Configuration::unpackActiveWindow(uint32_t packed, ActiveWindow* window) {
+  window->startMinute = packed & 0x7FF;
+  window->activeMinutes = (packed >> 11) & 0x7FF;
+  window->utcOffsetMinutes = packed ? ((int16_t) ((packed >> 22) & 0x7F) - ACTIVE_WINDOW_OFFSET_BIAS) * 15 : 0;
+}
+
+// The start wraps to the day, the time open is held to a day and the offset to the nearest
+// quarter hour within +/-16 hours.
+uint32_t Configuration::packActiveWindow(uint16_t startMinute, uint16_t activeMinutes, int16_t utcOffsetMinutes) {
+  int32_t quarters = (utcOffsetMinutes + (utcOffsetMinutes < 0 ? -7 : 7)) / 15;
+  if (quarters < -ACTIVE_WINDOW_OFFSET_BIAS) quarters = -ACTIVE_WINDOW_OFFSET_BIAS;
+  if (quarters >= ACTIVE_WINDOW_OFFSET_BIAS) quarters = ACTIVE_WINDOW_OFFSET_BIAS - 1;
+  if (activeMinutes > MINUTES_PER_DAY) activeMinutes = MINUTES_PER_DAY;
+  return (startMinute % MINUTES_PER_DAY) | ((uint32_t) activeMinutes << 11) |
+         ((uint32_t) (quarters + ACTIVE_WINDOW_OFFSET_BIAS) << 22);
+}
+
+void Configuration::populateWakeup(Wakeup* wakeup) {
+  wakeup->sleepStart = this->rtc->wakeup.sleepStart;
+  wakeup->sleepDuration = this->rtc->wakeup.sleepDuration;
+}
+
+void Configuration::populateRadio(Radio* radio) {
+  radio->calibrationMillivolts = this->rtc->radio.calibrationMillivolts;
+  radio->wakesSinceCalibration = this->rtc->radio.wakesSinceCalibration;
+  radio->calibrationDue = this->rtc->radio.calibrationDue;
+}
+
+void Configuration::populateOverrun(Overrun* overrun) {
+  overrun->count = this->rtc->overrun.count;
+  overrun->flags = this->rtc->overrun.flags;
+  overrun->reserved = 0;
+}
+
+static int32_t clampDrift(int32_t driftPpm) {
+  return driftPpm > MAX_DRIFT_PPM ? MAX_DRIFT_PPM : (driftPpm < -MAX_DRIFT_PPM ? -MAX_DRIFT_PPM : driftPpm);
+}
+
+void Configuration::resetSynchronisation(uint32_t time, int32_t driftPpm) {
+  this->rtc->sync.syncTime = time;
+  this->rtc->sync.nominalElapsed = 0;
+  this->rtc->sync.elapsedMs = 0;
+  this->rtc->sync.reserved = 0;
+  this->rtc->sync.driftPpm = clampDrift(driftPpm);
+}
+
+// Whole seconds, with the ms carried over, so the elapsed time lasts as long as syncTime does.
 void Configuration::incrementElapsed(uint32_t msSleepTime) {
-  this->rtcData.sync.nominalElapsed += msSleepTime/1000;
+  uint32_t ms = this->rtc->sync.elapsedMs + msSleepTime;
+  this->rtc->sync.nominalElapsed += ms / 1000;
+  this->rtc->sync.elapsedMs = ms % 1000;
 }
+
+// Move what the first firmware wrote into the current layout. Its Synchronisation follows the
+// shorter Parameters; everything after it was its data, laid out differently, so that starts
+// again along with the counter.
+void Configuration::upgradeLayout() {
+  memmove(&rtc->sync, (uint8_t*) &rtc->config + LEGACY_PARAMETERS_SIZE, LEGACY_SYNCHRONISATION_SIZE);
+  rtc->sync.elapsedMs = 0;
+  rtc->sync.reserved = 0;
+  rtc->config.transmitOffset = NO_TRANSMIT_OFFSET;
+  rtc->config.counter = 1;
+  upgradeSynchronisation();
+  memset(&rtc->wakeup, 0, sizeof(RtcData) - offsetof(RtcData, wakeup));
+  rtc->crc32 = calculateCRC32((uint8_t*) &rtc->config, sizeof(rtc->config));
+  if (rtc == mapped) memoryLayout = RTC_LAYOUT_CURRENT;
+}
+
+// The first firmware kept a float calibration factor where driftPpm is. A float near 1.0 is far
+// outside the range of driftPpm, so convert it in place. Its elapsed time was whole seconds already.
+void Configuration::upgradeSynchronisation() {
+  uint32_t raw;
+  memcpy(&raw, &rtc->sync.driftPpm, sizeof(raw));
+  if (raw >= LEGACY_FACTOR_MIN && raw < LEGACY_FACTOR_MAX) {
+    float factor;
+    memcpy(&factor, &raw, sizeof(factor));
+    rtc->sync.driftPpm = clampDrift((int32_t) ((factor - 1.0f) * PPM + (factor >= 1.0f ? 0.5f : -0.5f)));
+  }
+}
+
+void Configuration::setWakeup(uint32_t sleepStart, uint32_t sleepDuration) {
+  this->rtc->wakeup.sleepStart = sleepStart;
+  this->rtc->wakeup.sleepDuration = sleepDuration;
+}
+
+void Configuration::setRadio(uint16_t calibrationMillivolts, uint8_t wakesSinceCalibration, bool calibrationDue) {
+  this->rtc->radio.calibrationMillivolts = calibrationMillivolts;
+  this->rtc->radio.wakesSinceCalibration = wakesSinceCalibration;
+  this->rtc->radio.calibrationDue = calibrationDue ? 1 : 0;
+}
+
+void Configuration::recordOverrun(uint8_t flags) {
+  if (this->rtc->overrun.count < UINT16_MAX) this->rtc->overrun.count++;
+  this->rtc->overrun.flags = flags;
+}
+
+void Configuration::clearOverrun() {
+  this->rtc->overrun.count = 0;
+  this->rtc->overrun.flags = 0;
+}
\ No newline at end of file
@@ -24,11 +24,55 @@
 #ifndef _CONFIGURATION_H
 #define _CONFIGURATION_H
 
+#include <stddef.h>
+#include <stdint.h>
+#include "Espx.h"
+
 #define MAX_KEY_LENGTH 20
 #define MAX_VALUE_LENGTH 20
 #define MAX_EXPECTED_CONFIG_STRING 220
-#define MAX_DATA_ELEMENTS 160
 #define OTA_OFFSET 32
+// RTC memory after RtcData set aside for other modules: the Log ring and transport statistics,
+// then the wake trace when built with -D WAKE_TRACE. The DNS cache of Espx takes the very end.
+#define RTC_LOG_TRANSPORT_SIZE 36
+#ifdef WAKE_TRACE
+#ifndef TRACE_RING_SIZE
+#if MAX_RTC_SIZE <= 512 && defined(ROLLUPS) && defined(ALARMS)
+#define TRACE_RING_SIZE 3             // With everything else the ESP8266 has no room for the 4th.
+#else
+#define TRACE_RING_SIZE 4
+#endif
+#endif
+#define RTC_TRACE_SIZE (4 + 16 * TRACE_RING_SIZE)
+#else
+#define RTC_TRACE_SIZE 0
+#endif
+// With -D ROLLUPS, hourly and daily summaries of the measurements follow the data in RtcData,
+// ROLLUP_HOURS and ROLLUP_DAYS of them, so MAX_DATA_ELEMENTS is smaller by RTC_ROLLUP_SIZE / 2.
+#ifdef ROLLUPS
+#ifndef ROLLUP_HOURS
+#define ROLLUP_HOURS 6
+#endif
+#ifndef ROLLUP_DAYS
+#define ROLLUP_DAYS 7
+#endif
+#define RTC_ROLLUP_SIZE (32 + 8 * (ROLLUP_HOURS + ROLLUP_DAYS))
+#else
+#define RTC_ROLLUP_SIZE 0
+#endif
+// With -D ALARMS, ALARM_RULES alarm rules from the config message and their state follow them, so
+// MAX_DATA_ELEMENTS is smaller again by RTC_ALARM_SIZE / 2.
+#ifdef ALARMS
+#ifndef ALARM_RULES
+#define ALARM_RULES 2
+#endif
+#define RTC_ALARM_SIZE (20 * ALARM_RULES)
+#else
+#define RTC_ALARM_SIZE 0
+#endif
+#ifndef RTC_RESERVED_SIZE
+#define RTC_RESERVED_SIZE (RTC_LOG_TRANSPORT_SIZE + RTC_TRACE_SIZE + RTC_DNS_SIZE)
+#endif
 
 typedef struct {
   uint16_t currentVersion;
@@ -37,57 +81,248 @@ typedef struct {
   uint32_t sampleInterval;
   uint16_t nSamples;
   uint16_t transmitFrequency;
+  uint32_t transmitOffset;    // ms into each transmit cycle assigned by the server, or NO_TRANSMIT_OFFSET.
 } Parameters;
 
+#define NO_TRANSMIT_OFFSET 0xFFFFFFFFUL
+
+// The first firmware kept only the Parameters before transmitOffset, with its CRC over just those,
+// and a float calibration factor in Synchronisation straight after them. Memory it wrote is
+// recognised by that CRC and upgraded on load.
+#define LEGACY_PARAMETERS_SIZE offsetof(Parameters, transmitOffset)
+
+#define RTC_LAYOUT_INVALID 0
+#define RTC_LAYOUT_LEGACY 1
+#define RTC_LAYOUT_CURRENT 2
+
+// Clock calibration in integer parts per million, so the timing path needs no (soft) floating point.
+#define PPM 1000000L
+#define MAX_DRIFT_PPM 500000L
+
 typedef struct {
-  uint32_t startTimeOfDay;
-  uint32_t syncTime;
-  uint32_t nominalElapsed;
-  float    calibrationFactor;
+  uint32_t startTimeOfDay;    // the active window, packed as ACTIVE_WINDOW_ below; 0 when always active.
+  uint32_t syncTime;          // seconds since the epoch at the start of the wake that last synchronised.
+  uint32_t nominalElapsed;    // whole seconds of scheduled sleep since syncTime.
+  int32_t  driftPpm;          // each sleep is scaled by (PPM + driftPpm) / PPM.
+  uint16_t elapsedMs;         // the ms of scheduled sleep beyond nominalElapsed, under 1000.
+  uint16_t reserved;
 } Synchronisation;
 
+// The first firmware's Synchronisation ended at driftPpm, where it kept a float factor.
+#define LEGACY_SYNCHRONISATION_SIZE offsetof(Synchronisation, elapsedMs)
+
+// The part of each local day the Sampler runs in, to the minute. Outside it the Sampler sleeps
+// straight through to the next opening. It is kept in Synchronisation.startTimeOfDay, which
+// earlier firmware left 0, so the RTC layout is unchanged: the start minute in bits 0-10, the
+// minutes it stays open in bits 11-21 and the UTC offset of local time in quarter hours, biased
+// by 64, in bits 22-28.
+typedef struct {
+  uint16_t startMinute;       // minutes after local midnight it opens.
+  uint16_t activeMinutes;     // 0 (or a whole day) for always active; may run past midnight.
+  int16_t  utcOffsetMinutes;  // local time less UTC.
+} ActiveWindow;
+
+#define MINUTES_PER_DAY 1440
+#define ACTIVE_WINDOW_OFFSET_BIAS 64
+
+typedef struct {
+  uint32_t sleepStart;
+  uint32_t sleepDuration;
+} Wakeup;
+
+typedef struct {
+  uint16_t calibrationMillivolts;   // battery voltage when the radio was last calibrated, 0 if unknown.
+  uint8_t  wakesSinceCalibration;   // radio wakes since then.
+  uint8_t  calibrationDue;
+} Radio;
+
+// What is due on a wake.
+#define WAKE_SAMPLE 0x01
+#define WAKE_MEASUREMENT 0x02
+#define WAKE_TRANSMIT 0x04
+
+typedef struct {
+  uint16_t count;             // wakes cut short by the awake-time budget since last cleared.
+  uint8_t  flags;             // WAKE_ flags of the last of them.
+  uint8_t  reserved;
+} Overrun;
+
+#ifdef ROLLUPS
+// A closed hour or day.
+typedef struct {
+  uint16_t min;
+  uint16_t max;
+  uint16_t mean;
+  uint16_t count;             // measurements in it, 0 for a period with none.
+} RollupSummary;
+
+// The hour or day still open.
+typedef struct {
+  uint32_t sum;
+  uint16_t count;
+  uint16_t min;
+  uint16_t max;
+  uint16_t reserved;
+} RollupAccumulator;
+
+typedef struct {
+  uint32_t hourStart;         // seconds at the start of the open hour, 0 before the first measurement.
+  uint8_t  nHours;            // closed summaries held in each ring.
+  uint8_t  nDays;
+  uint8_t  nextHour;          // where the next closed summary goes.
+  uint8_t  nextDay;
+  RollupAccumulator hour;
+  RollupAccumulator day;
+  RollupSummary hours[ROLLUP_HOURS];
+  RollupSummary days[ROLLUP_DAYS];
+} Rollups;
+
+static_assert(sizeof(Rollups) == RTC_ROLLUP_SIZE, "Rollups does not match RTC_ROLLUP_SIZE");
+#endif
+
+#ifdef ALARMS
+// A rule, set from the config message as alarm0, alarm1... (see Alarm.h).
+typedef struct {
+  uint8_t  type;              // ALARM_ABOVE etc., ALARM_NONE for an unused rule.
+  uint8_t  source;            // ALARM_SAMPLE or ALARM_MEASUREMENT.
+  uint16_t level;             // the threshold, or the change from one reading to the next.
+  uint16_t hysteresis;        // how far back a reading must come before the rule can fire again.
+  uint16_t holdOff;           // fewest seconds between the alerts it forces.
+} AlarmRule;
+
+typedef struct {
+  uint8_t  flags;             // ALARM_PRIMED etc.
+  uint8_t  fired;             // times fired since last reported, up to 255.
+  uint16_t last;              // the reading before.
+  uint16_t value;             // the reading it last fired on.
+  uint16_t reserved;
+  uint32_t alertedAt;         // seconds, as Sampler::currentTime, of the last alert it forced.
+} AlarmState;
+
+typedef struct {
+  AlarmRule rules[ALARM_RULES];
+  AlarmState states[ALARM_RULES];
+} Alarms;
+
+static_assert(sizeof(Alarms) == RTC_ALARM_SIZE, "Alarms does not match RTC_ALARM_SIZE");
+static_assert(ALARM_RULES > 0 && ALARM_RULES <= 8, "ALARM_RULES must be 1 to 8");
+#endif
+
+#define RTC_HEADER_SIZE (sizeof(uint32_t) + sizeof(Parameters) + sizeof(Synchronisation) + sizeof(Wakeup) + sizeof(Radio) + sizeof(Overrun))
+// Whatever RTC memory the platform has left over holds samples and measurements (kept even so
+// RtcData stays a whole number of 32 bit words).
+#define MAX_DATA_ELEMENTS ((int) (((MAX_RTC_SIZE - OTA_OFFSET * 4 - RTC_HEADER_SIZE - RTC_ROLLUP_SIZE - RTC_ALARM_SIZE - RTC_RESERVED_SIZE) / sizeof(uint16_t)) & ~1UL))
+
 typedef struct  {
   uint32_t crc32;
   Parameters config;
   Synchronisation sync;
+  Wakeup wakeup;
+  Radio radio;
+  Overrun overrun;
   uint16_t data[MAX_DATA_ELEMENTS];
+#ifdef ROLLUPS
+  Rollups rollups;
+#endif
+#ifdef ALARMS
+  Alarms alarms;
+#endif
 } RtcData;
 
+// What a config message can change: the Parameters, the active window and the alarm rules. It is
+// parsed into one of these rather than a whole Configuration, which on the ESP32 holds kilobytes of
+// RtcData and would not fit on the stack of the MQTT callback that receives the message.
+typedef struct {
+  Parameters config;
+  uint32_t startTimeOfDay;
+#ifdef ALARMS
+  AlarmRule rules[ALARM_RULES];
+#endif
+} ConfigUpdate;
+
+static_assert(offsetof(RtcData, data) == RTC_HEADER_SIZE, "RTC_HEADER_SIZE does not match RtcData");
+static_assert(MAX_RTC_SIZE > OTA_OFFSET * 4 + RTC_HEADER_SIZE + RTC_ROLLUP_SIZE + RTC_ALARM_SIZE + RTC_RESERVED_SIZE, "No RTC memory left for data");
+static_assert(OTA_OFFSET * 4 + sizeof(RtcData) + RTC_RESERVED_SIZE <= MAX_RTC_SIZE, "RtcData does not fit in RTC memory");
+
 
 class Configuration {
     
   private:
     RtcData rtcData;
-    void setParameter(const char* key, const char* value);
+    RtcData* rtc;
+    RtcData* mapped;
+    bool memoryChecked;
+    uint8_t memoryLayout;
+    ConfigUpdate staged;
+    bool updateStaged;
+#ifdef ALARMS
+    void setAlarmRule(uint8_t i, const AlarmRule& rule);
+#endif
+    static uint8_t layoutOf(uint32_t crc32, const Parameters* params);
+    void upgradeLayout();
+    void upgradeSynchronisation();
+    void keepValidData(const Parameters& before);
+    void parametersChanged();
+    void populateUpdate(ConfigUpdate* update);
+    bool matches(const ConfigUpdate& update);
+    void apply(const ConfigUpdate& update);
+    void parseJson(const char* json, ConfigUpdate* update);
+    static void setParameter(ConfigUpdate* update, const char* key, const char* value);
+    static void unpackActiveWindow(uint32_t packed, ActiveWindow* window);
+    static uint32_t packActiveWindow(uint16_t startMinute, uint16_t activeMinutes, int16_t utcOffsetMinutes);
     size_t indexOf(const char chr, const char* strng, size_t start = 0);
     size_t nextSeparator(const char* json, const size_t& start, const size_t& length);
     void parseToken(const char * json, size_t& pos, const size_t length, char* token);
     size_t trim(const char* json, size_t &length) ;
-    uint32_t calculateCRC32(const uint8_t *data, size_t length) ;
 
   public:
+    static uint32_t calculateCRC32(const uint8_t *data, size_t length);
+    // nSamples samples, then transmitFrequency measurements, their deltas and the base time.
+    static constexpr bool fitsData(uint16_t nSamples, uint16_t transmitFrequency) {
+      return (uint32_t) nSamples + 2 * (uint32_t) transmitFrequency + 2 <= MAX_DATA_ELEMENTS;
+    }
     Configuration();
-    void setParameters(
+    bool setParameters(
           uint32_t measurementInterval,
           uint32_t sampleInterval,
           uint16_t nSamples,
           uint16_t transmitFrequency);
     void populateParameters(Parameters* params);
     void populateSynchronisation(Synchronisation* sync);
+    void populateActiveWindow(ActiveWindow* window);
+    void setActiveWindow(uint16_t startMinute, uint16_t activeMinutes, int16_t utcOffsetMinutes);
+    void populateWakeup(Wakeup* wakeup);
+    void populateRadio(Radio* radio);
+    void populateOverrun(Overrun* overrun);
     void populateStatusMsg(char * msg, size_t length);
     bool equivalentTo(Configuration& other);
     void fromJson(const char * json);
+    void stage(Configuration& update);
+    bool stageJson(const char* json);
+    bool applyStaged();
     bool checkMemory();
     bool fromMemory();
     bool save();
+    bool useRtcMemoryInPlace();
     void setVersion(unsigned version);
     uint16_t getVersion();
+    uint16_t getStagedVersion();
     void incrementCounter();
     void resetCounter();
     uint16_t getCounter();
     uint16_t* getData();
-    void resetSynchronisation(uint32_t time, float factor);
+#ifdef ROLLUPS
+    Rollups* getRollups();
+#endif
+#ifdef ALARMS
+    Alarms* getAlarms();
+#endif
+    void resetSynchronisation(uint32_t time, int32_t driftPpm);
     void incrementElapsed(uint32_t msSleepTime);
+    void setWakeup(uint32_t sleepStart, uint32_t sleepDuration);
+    void setRadio(uint16_t calibrationMillivolts, uint8_t wakesSinceCalibration, bool calibrationDue);
+    void recordOverrun(uint8_t flags);
+    void clearOverrun();
 };
 
 #endif  // _CONFIGURATION_H
@@ -3,36 +3,179 @@
 
 
 #if defined(ESP32)
+#include <sys/time.h>
 
-#ifndef MAX_RTC_SIZE 
-#define MAX_RTC_SIZE 512
-#endif
+static_assert(MAX_RTC_SIZE <= 8192, "MAX_RTC_SIZE exceeds the ESP32 RTC slow memory");
+
+static_assert(MAX_RTC_SIZE % 4 == 0, "MAX_RTC_SIZE must be a whole number of 32 bit words");
 
-RTC_DATA_ATTR uint8_t RTC[MAX_RTC_SIZE];
+// Words, so the RtcData mapped onto it is aligned as the ESP8266 RTC user memory is.
+RTC_DATA_ATTR uint32_t RTC[MAX_RTC_SIZE / 4];
 
 void Espx::deepSleep(uint64_t time_us, bool wakeWithWifi = true) {
     esp_sleep_enable_timer_wakeup(time_us);
     esp_deep_sleep_start();
 }
 
+// The ESP32 restores its RF calibration data from NVS itself, so there is nothing to choose.
+void Espx::deepSleep(uint64_t time_us, bool wakeWithWifi, bool calibrateRadio) {
+    deepSleep(time_us, wakeWithWifi);
+}
+
+void Espx::enableExternalWakeup(uint8_t pin, bool level) {
+    esp_sleep_enable_ext0_wakeup((gpio_num_t) pin, level ? 1 : 0);
+}
+
+void Espx::enableExternalWakeupMask(uint64_t pinMask, bool anyHigh) {
+    esp_sleep_enable_ext1_wakeup(pinMask, anyHigh ? ESP_EXT1_WAKEUP_ANY_HIGH : ESP_EXT1_WAKEUP_ALL_LOW);
+}
+
+WakeCause Espx::getWakeCause() {
+    switch (esp_sleep_get_wakeup_cause()) {
+    case ESP_SLEEP_WAKEUP_TIMER:
+        return WAKE_CAUSE_TIMER;
+    case ESP_SLEEP_WAKEUP_EXT0:
+    case ESP_SLEEP_WAKEUP_EXT1:
+        return WAKE_CAUSE_EXTERNAL;
+    default:
+        return WAKE_CAUSE_RESET;
+    }
+}
+
+// The RTC keeps time through deepsleep on the ESP32, so gettimeofday does too.
+uint32_t Espx::rtcTime() {
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return (uint32_t) ((uint64_t) tv.tv_sec * 1000ULL + tv.tv_usec / 1000);
+}
+
+uint32_t Espx::rtcElapsedMillis(uint32_t since) {
+    return rtcTime() - since;
+}
+
+static esp_timer_handle_t watchdog = NULL;
+static WatchdogCallBack watchdogFn = NULL;
+static TaskHandle_t watchedTask = NULL;
+
+// The task that started the watchdog is suspended first, so fn has RtcData to itself.
+static void watchdogFired(void* arg) {
+    if (watchedTask) vTaskSuspend(watchedTask);
+    watchdogFn(arg);
+}
+
+// Runs fn once after ms from the esp_timer task, which keeps running while the loop task is stuck.
+void Espx::startWatchdog(uint32_t ms, WatchdogCallBack fn, void* arg) {
+    stopWatchdog();
+    if (watchdog) esp_timer_delete(watchdog);
+    watchdogFn = fn;
+    watchedTask = xTaskGetCurrentTaskHandle();
+    esp_timer_create_args_t args = {};
+    args.callback = watchdogFired;
+    args.arg = arg;
+    args.dispatch_method = ESP_TIMER_TASK;
+    args.name = "awake";
+    if (esp_timer_create(&args, &watchdog) == ESP_OK) esp_timer_start_once(watchdog, (uint64_t) ms * 1000ULL);
+}
+
+void Espx::stopWatchdog() {
+    if (watchdog) esp_timer_stop(watchdog);
+}
+
 bool Espx::rtcUserMemoryRead(uint32_t offset, uint32_t *data, size_t size) {
-    memcpy(data, &(RTC[offset*4]), size);
+    memcpy(data, &(RTC[offset]), size);
     return true;
 }
 
 bool Espx::rtcUserMemoryWrite(uint32_t offset, uint32_t *data, size_t size){
-    memcpy( &(RTC[offset*4]), data, size);
+    memcpy( &(RTC[offset]), data, size);
     return true;
 }
 
+uint32_t* Espx::rtcUserMemoryMap(uint32_t offset) {
+    return &(RTC[offset]);
+}
+
 t_httpUpdate_return Espx::httpUpdate(WiFiClient& client, const String& host, uint16_t port, const String& uri,
                                const String& currentVersion) {
     return ESPhttpUpdate.update(host, port, uri, currentVersion);
 }
 #elif defined(ESP8266)
 
+static_assert(MAX_RTC_SIZE <= 512, "MAX_RTC_SIZE exceeds the ESP8266 RTC user memory");
+
+static volatile bool inWatchdog = false;
+
+// ESP.deepSleep suspends the sketch until the sleep takes hold, which is not allowed in the SDK
+// context the watchdog runs in, so from there ask the SDK directly and return.
+static void deepSleepWith(uint64_t time_us, RFMode mode) {
+    if (inWatchdog) {
+        system_deep_sleep_set_option(mode);
+        system_deep_sleep(time_us);
+    } else {
+        ESP.deepSleep(time_us, mode);
+    }
+}
+
 void Espx::deepSleep(uint64_t time_us, bool wakeWithWifi = true) {
-    ESP.deepSleep(time_us, wakeWithWifi?RF_DEFAULT: RF_DISABLED);
+    deepSleepWith(time_us, wakeWithWifi?RF_DEFAULT: RF_DISABLED);
+}
+
+// RF_DEFAULT may run a full RF calibration (~30ms at high current) on every radio wake, so let
+// the caller decide when it is needed.
+void Espx::deepSleep(uint64_t time_us, bool wakeWithWifi, bool calibrateRadio) {
+    deepSleepWith(time_us, wakeWithWifi ? (calibrateRadio ? RF_CAL : RF_NO_CAL) : RF_DISABLED);
+}
+
+// The ESP8266 has no GPIO wake from deepsleep, only a pulse on RST, and that restarts the RTC
+// timer, so neither the event nor the rest of the interrupted sleep could be known on waking.
+void Espx::enableExternalWakeup(uint8_t pin, bool level) {
+}
+
+void Espx::enableExternalWakeupMask(uint64_t pinMask, bool anyHigh) {
+}
+
+WakeCause Espx::getWakeCause() {
+    switch (ESP.getResetInfoPtr()->reason) {
+    case REASON_DEEP_SLEEP_AWAKE:
+        return WAKE_CAUSE_TIMER;
+    default:                // including an RST pulse while awake, reported as REASON_EXT_SYS_RST.
+        return WAKE_CAUSE_RESET;
+    }
+}
+
+// RTC timer ticks are preserved over deepsleep. The 32 bit counter wraps every few hours,
+// so elapsed time is taken as a tick difference before converting (calibration is us per tick Q12).
+uint32_t Espx::rtcTime() {
+    return system_get_rtc_time();
+}
+
+uint32_t Espx::rtcElapsedMillis(uint32_t since) {
+    uint32_t elapsedTicks = system_get_rtc_time() - since;
+    return (uint32_t) ((((uint64_t) elapsedTicks) * system_rtc_clock_cali_proc()) >> 12) / 1000;
+}
+
+static os_timer_t watchdog;
+static WatchdogCallBack watchdogFn = NULL;
+
+static void watchdogFired(void* arg) {
+    inWatchdog = true;
+    watchdogFn(arg);
+    inWatchdog = false;
+}
+
+// An SDK software timer: fn runs whenever the sketch yields (delay(), waiting on WiFi), which is
+// where a hung connection spends its time. A loop that never yields is left to the hardware WDT.
+// The sketch is parked at that yield, so fn has RtcData to itself, but it runs in the SDK's
+// context and must not yield: it may write RAM and RTC memory and call deepSleep, nothing more.
+void Espx::startWatchdog(uint32_t ms, WatchdogCallBack fn, void* arg) {
+    os_timer_disarm(&watchdog);
+    watchdogFn = fn;
+    os_timer_setfn(&watchdog, watchdogFired, arg);
+    os_timer_arm(&watchdog, ms, false);
+}
+
+void Espx::stopWatchdog() {
+    os_timer_disarm(&watchdog);
 }
 
 bool Espx::rtcUserMemoryRead(uint32_t offset, uint32_t *data, size_t size) {
@@ -42,8 +185,87 @@ bool Espx::rtcUserMemoryWrite(uint32_t offset, uint32_t *data, size_t size){
     return ESP.rtcUserMemoryWrite(offset, data, size);
 }
 
+// Copy in and out via the SDK unless told where RTC user memory is mapped.
+uint32_t* Espx::rtcUserMemoryMap(uint32_t offset) {
+#if defined(RTC_USER_MEMORY_MAP)
+    return RTC_USER_MEMORY_MAP + offset;
+#else
+    return NULL;
+#endif
+}
+
 t_httpUpdate_return Espx::httpUpdate(WiFiClient& client, const String& host, uint16_t port, const String& uri,
                                const String& currentVersion) {
     return ESPhttpUpdate.update(client, host, port, uri, currentVersion);
 }
-#endif
\ No newline at end of file
+#endif
+
+// =============== DNS cache ===============================================================
+
+#if DNS_CACHE_SIZE > 0
+static_assert(RTC_DNS_SIZE == sizeof(DnsCache), "DnsCache does not match RTC_DNS_SIZE");
+
+static uint32_t hashHost(const char* host) {
+    uint32_t hash = 2166136261UL;
+    while (*host) hash = (hash ^ (uint8_t) *host++) * 16777619UL;
+    return hash ? hash : 1;
+}
+
+static void readDnsCache(DnsCache* cache) {
+    if (!Espx::rtcUserMemoryRead(DNS_OFFSET, (uint32_t*) cache, sizeof(DnsCache)) || cache->magic != DNS_MAGIC) {
+        memset(cache, 0, sizeof(DnsCache));
+        cache->magic = DNS_MAGIC;
+    }
+}
+
+static DnsEntry* findHost(DnsCache* cache, uint32_t hash) {
+    for (uint8_t i=0; i < DNS_CACHE_SIZE; i++) {
+        if (cache->entries[i].hostHash == hash) return &cache->entries[i];
+    }
+    return NULL;
+}
+#endif
+
+// An address looked up within the last DNS_TTL_SECONDS comes from RTC memory, with cached set.
+// The RTC counter of the ESP8266 wraps every few hours, so an entry much older than that can
+// look fresh: if connecting to a cached address fails, forgetHost and look it up again.
+bool Espx::hostByName(const char* host, IPAddress& address, bool* cached) {
+    if (cached) *cached = false;
+#if DNS_CACHE_SIZE > 0
+    DnsCache cache;
+    readDnsCache(&cache);
+    uint32_t hash = hashHost(host);
+    DnsEntry* entry = findHost(&cache, hash);
+    if (entry && rtcElapsedMillis(entry->resolvedAt) < DNS_TTL_SECONDS * 1000UL) {
+        address = IPAddress(entry->address);
+        if (cached) *cached = true;
+        return true;
+    }
+    if (!WiFi.hostByName(host, address)) return false;
+    if (!entry) entry = findHost(&cache, 0);
+    if (!entry) {
+        entry = &cache.entries[0];
+        for (uint8_t i=1; i < DNS_CACHE_SIZE; i++) {
+            if (rtcElapsedMillis(cache.entries[i].resolvedAt) > rtcElapsedMillis(entry->resolvedAt)) entry = &cache.entries[i];
+        }
+    }
+    entry->hostHash = hash;
+    entry->address = (uint32_t) address;
+    entry->resolvedAt = rtcTime();
+    rtcUserMemoryWrite(DNS_OFFSET, (uint32_t*) &cache, sizeof(cache));
+    return true;
+#else
+    return WiFi.hostByName(host, address);
+#endif
+}
+
+void Espx::forgetHost(const char* host) {
+#if DNS_CACHE_SIZE > 0
+    DnsCache cache;
+    readDnsCache(&cache);
+    DnsEntry* entry = findHost(&cache, hashHost(host));
+    if (!entry) return;
+    memset(entry, 0, sizeof(DnsEntry));
+    rtcUserMemoryWrite(DNS_OFFSET, (uint32_t*) &cache, sizeof(cache));
+#endif
+}
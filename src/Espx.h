@@ -34,14 +34,71 @@
 #include <ESP32httpUpdate.h>
 #endif
 
+// RTC memory preserved over deepsleep. The ESP8266 has 512 bytes of RTC user memory; the ESP32
+// has 8K of RTC slow memory, part of which is used by the core and libraries.
+#ifndef MAX_RTC_SIZE
+#if defined(ESP32)
+#define MAX_RTC_SIZE 6144
+#else
+#define MAX_RTC_SIZE 512
+#endif
+#endif
+
+// Addresses looked up by hostByName are kept in RTC memory, at the very end, for DNS_TTL_SECONDS
+// so each transmit need not look up every server again. -D DNS_CACHE_SIZE=0 turns it off.
+#ifndef DNS_CACHE_SIZE
+#define DNS_CACHE_SIZE 3
+#endif
+#ifndef DNS_TTL_SECONDS
+#define DNS_TTL_SECONDS 3600
+#endif
+#if DNS_CACHE_SIZE > 0
+#define RTC_DNS_SIZE (4 + 12 * DNS_CACHE_SIZE)
+#else
+#define RTC_DNS_SIZE 0
+#endif
+#define DNS_MAGIC 0xD45C
+#define DNS_OFFSET ((MAX_RTC_SIZE - RTC_DNS_SIZE) / 4)
+
+typedef struct {
+  uint32_t hostHash;          // FNV-1a of the host name, 0 if the entry is free.
+  uint32_t address;
+  uint32_t resolvedAt;        // rtcTime() of the lookup.
+} DnsEntry;
+
+typedef struct {
+  uint16_t magic;
+  uint16_t reserved;
+  DnsEntry entries[DNS_CACHE_SIZE > 0 ? DNS_CACHE_SIZE : 1];
+} DnsCache;
+
+enum WakeCause {
+    WAKE_CAUSE_RESET,       // Power on, reset button or anything we don't recognise.
+    WAKE_CAUSE_TIMER,       // Deepsleep timer expired.
+    WAKE_CAUSE_EXTERNAL     // GPIO (ESP32 ext0/ext1). The ESP8266 never reports it.
+};
+
+using WatchdogCallBack = void (*)(void*);
 
 class Espx {
 
     public:
         static void deepSleep(uint64_t time_us, bool WakeWithWifi);
+        static void deepSleep(uint64_t time_us, bool wakeWithWifi, bool calibrateRadio);
+        static void enableExternalWakeup(uint8_t pin, bool level);
+        static void enableExternalWakeupMask(uint64_t pinMask, bool anyHigh);
+        static WakeCause getWakeCause();
+        static uint32_t rtcTime();
+        static uint32_t rtcElapsedMillis(uint32_t since);
+        static void startWatchdog(uint32_t ms, WatchdogCallBack fn, void* arg);
+        static void stopWatchdog();
 
         static bool rtcUserMemoryRead(uint32_t offset, uint32_t *data, size_t size);
         static bool rtcUserMemoryWrite(uint32_t offset, uint32_t *data, size_t size);
+        static uint32_t* rtcUserMemoryMap(uint32_t offset);
+
+        static bool hostByName(const char* host, IPAddress& address, bool* cached = NULL);
+        static void forgetHost(const char* host);
 
         static t_httpUpdate_return httpUpdate(WiFiClient& client, const String& host, uint16_t port, const String& uri = "/",
                                const String& currentVersion = "");
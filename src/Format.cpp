@@ -0,0 +1,80 @@
+#include <string.h>
+#include "Format.h"
+
+// Leading spaces and a '+' are skipped, then decimal digits are read up to the first non-digit.
+// False, with value unchanged, if there are none or they are more than a uint32_t holds.
+bool Format::parseUnsigned(const char* text, uint32_t* value) {
+  while (*text == ' ') text++;
+  if (*text == '+') text++;
+  if (*text < '0' || *text > '9') return false;
+  uint32_t result = 0;
+  while (*text >= '0' && *text <= '9') {
+    uint32_t digit = *text++ - '0';
+    if (result > (UINT32_MAX - digit) / 10) return false;
+    result = result * 10 + digit;
+  }
+  *value = result;
+  return true;
+}
+
+// The unsigned value of key, quoted or not, in a flat JSON object: {"time": 1700000000, "ms": 250}.
+bool Format::findUnsigned(const char* json, const char* key, uint32_t* value) {
+  size_t keyLength = strlen(key);
+  for (const char* p = json; (p = strstr(p, key)) != NULL; p += keyLength) {
+    char before = (p > json) ? p[-1] : ' ';
+    if ((before >= 'a' && before <= 'z') || (before >= 'A' && before <= 'Z') || (before >= '0' && before <= '9')) continue;
+    const char* q = p + keyLength;
+    if (*q == '"') q++;
+    while (*q == ' ') q++;
+    if (*q == ':') return parseUnsigned(q + 1, value);
+  }
+  return false;
+}
+
+size_t Format::text(char* msg, size_t length, const char* s) {
+  size_t nchars = 0;
+  if (length == 0) return 0;
+  while (s[nchars] && nchars < length - 1) {
+    msg[nchars] = s[nchars];
+    nchars++;
+  }
+  msg[nchars] = 0;
+  return nchars;
+}
+
+size_t Format::number(char* msg, size_t length, uint32_t value) {
+  char digits[10];
+  size_t n = 0;
+  do {
+    digits[n++] = '0' + value % 10;
+    value /= 10;
+  } while (value > 0);
+  size_t nchars = 0;
+  if (length == 0) return 0;
+  while (n > 0 && nchars < length - 1) msg[nchars++] = digits[--n];
+  msg[nchars] = 0;
+  return nchars;
+}
+
+size_t Format::signedNumber(char* msg, size_t length, int32_t value) {
+  if (value >= 0) return number(msg, length, value);
+  size_t nchars = text(msg, length, "-");
+  return nchars + number(msg + nchars, length - nchars, (uint32_t) 0 - (uint32_t) value);
+}
+
+// value / 10^decimals with all the decimals shown, e.g. fixed(3300, 3) is "3.300".
+size_t Format::fixed(char* msg, size_t length, int32_t value, uint8_t decimals) {
+  uint32_t scale = 1;
+  for (uint8_t i=0; i < decimals; i++) scale *= 10;
+  size_t nchars = (value < 0) ? text(msg, length, "-") : 0;
+  uint32_t magnitude = (value < 0) ? (uint32_t) 0 - (uint32_t) value : value;
+  nchars += number(msg + nchars, length - nchars, magnitude / scale);
+  if (decimals == 0) return nchars;
+  nchars += text(msg + nchars, length - nchars, ".");
+  uint32_t fraction = magnitude % scale;
+  for (uint32_t place = scale / 10; place > 0; place /= 10) {
+    char digit[2] = {(char) ('0' + (fraction / place) % 10), 0};
+    nchars += text(msg + nchars, length - nchars, digit);
+  }
+  return nchars;
+}
\ No newline at end of file
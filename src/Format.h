@@ -0,0 +1,45 @@
+// MIT License
+
+// Low Power Sampler Format - integer parsing and formatting without the printf/scanf family.
+// Copyright (c) 2021 Simon Chinnick
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#ifndef FORMAT_H
+#define FORMAT_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Each formatter writes at most length - 1 characters and a terminating NUL, and returns the
+// number of characters written, so calls can be chained as with snprintf:
+//   n += Format::text(msg + n, length - n, ", counter: ");
+//   n += Format::number(msg + n, length - n, counter);
+class Format {
+
+    public:
+    static bool parseUnsigned(const char* text, uint32_t* value);
+    static bool findUnsigned(const char* json, const char* key, uint32_t* value);
+    static size_t text(char* msg, size_t length, const char* s);
+    static size_t number(char* msg, size_t length, uint32_t value);
+    static size_t signedNumber(char* msg, size_t length, int32_t value);
+    static size_t fixed(char* msg, size_t length, int32_t value, uint8_t decimals);
+};
+
+#endif // FORMAT_H
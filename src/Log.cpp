@@ -0,0 +1,63 @@
+#include <string.h>
+#include "Espx.h"
+#include <Arduino.h>
+
+#include "Log.h"
+#include "Format.h"
+
+LogRing Log::ring;
+
+void Log::begin() {
+  if (!Espx::rtcUserMemoryRead(LOG_OFFSET, (uint32_t*) &ring, sizeof(ring)) ||
+      ring.magic != LOG_MAGIC || ring.head >= LOG_RING_SIZE || ring.count > LOG_RING_SIZE) {
+    clear();
+  }
+}
+
+void Log::write(uint8_t level, uint8_t code, uint16_t value) {
+  if (ring.magic != LOG_MAGIC) begin();
+  uint8_t index = ring.head;
+  ring.records[index].level = level;
+  ring.records[index].code = code;
+  ring.records[index].value = value;
+  ring.head = (index + 1) % LOG_RING_SIZE;
+  if (ring.count < LOG_RING_SIZE) ring.count++;
+  Espx::rtcUserMemoryWrite(LOG_OFFSET + 1 + index, (uint32_t*) &ring.records[index], sizeof(LogRecord));
+  Espx::rtcUserMemoryWrite(LOG_OFFSET, (uint32_t*) &ring, sizeof(uint32_t));
+#ifdef LOG_SERIAL
+  Serial.printf("\n[%u] %u: %u", level, code, value);
+#endif
+}
+
+uint8_t Log::getCount() {
+  return ring.count;
+}
+
+bool Log::populateRecord(uint8_t index, LogRecord* record) {
+  if (index >= ring.count) return false;
+  uint8_t oldest = (ring.head + LOG_RING_SIZE - ring.count) % LOG_RING_SIZE;
+  *record = ring.records[(oldest + index) % LOG_RING_SIZE];
+  return true;
+}
+
+size_t Log::populateMsg(char* msg, size_t length) {
+  LogRecord record;
+  size_t nchars = Format::text(msg, length, "[");
+  for (uint8_t i=0; i < ring.count; i++) {
+    populateRecord(i, &record);
+    if (i > 0) nchars += Format::text(msg + nchars, length - nchars, ",");
+    nchars += Format::number(msg + nchars, length - nchars, record.level);
+    nchars += Format::text(msg + nchars, length - nchars, ":");
+    nchars += Format::number(msg + nchars, length - nchars, record.code);
+    nchars += Format::text(msg + nchars, length - nchars, ":");
+    nchars += Format::number(msg + nchars, length - nchars, record.value);
+  }
+  nchars += Format::text(msg + nchars, length - nchars, "]");
+  return nchars;
+}
+
+void Log::clear() {
+  memset(&ring, 0, sizeof(ring));
+  ring.magic = LOG_MAGIC;
+  Espx::rtcUserMemoryWrite(LOG_OFFSET, (uint32_t*) &ring, sizeof(ring));
+}
@@ -0,0 +1,103 @@
+// MIT License
+
+// Low Power Sampler Log - compact binary log records held in RTC memory.
+// Copyright (c) 2021 Simon Chinnick
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#ifndef LOG_H
+#define LOG_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "Configuration.h"
+
+#define LOG_LEVEL_NONE  0
+#define LOG_LEVEL_ERROR 1
+#define LOG_LEVEL_WARN  2
+#define LOG_LEVEL_INFO  3
+#define LOG_LEVEL_DEBUG 4
+
+// Levels above LOG_LEVEL are compiled out entirely - set with -D LOG_LEVEL=n.
+#ifndef LOG_LEVEL
+#define LOG_LEVEL LOG_LEVEL_WARN
+#endif
+
+#ifndef LOG_RING_SIZE
+#define LOG_RING_SIZE 4
+#endif
+
+#define LOG_MAGIC 0x106A
+// Ring lives in RTC user memory immediately after the Configuration data.
+#define LOG_OFFSET (OTA_OFFSET + (sizeof(RtcData) + 3) / 4)
+
+typedef struct {
+  uint8_t  level;
+  uint8_t  code;
+  uint16_t value;
+} LogRecord;
+
+typedef struct {
+  uint16_t magic;
+  uint8_t  head;
+  uint8_t  count;
+  LogRecord records[LOG_RING_SIZE];
+} LogRing;
+
+static_assert(sizeof(LogRing) <= RTC_RESERVED_SIZE, "LogRing does not fit in RTC_RESERVED_SIZE");
+
+class Log {
+
+    private:
+    static LogRing ring;
+
+    public:
+    static void begin();
+    static void write(uint8_t level, uint8_t code, uint16_t value);
+    static uint8_t getCount();
+    static bool populateRecord(uint8_t index, LogRecord* record);
+    static size_t populateMsg(char* msg, size_t length);
+    static void clear();
+};
+
+#if LOG_LEVEL >= LOG_LEVEL_ERROR
+#define LOG_ERROR(code, value) Log::write(LOG_LEVEL_ERROR, (code), (value))
+#else
+#define LOG_ERROR(code, value) ((void)0)
+#endif
+
+#if LOG_LEVEL >= LOG_LEVEL_WARN
+#define LOG_WARN(code, value) Log::write(LOG_LEVEL_WARN, (code), (value))
+#else
+#define LOG_WARN(code, value) ((void)0)
+#endif
+
+#if LOG_LEVEL >= LOG_LEVEL_INFO
+#define LOG_INFO(code, value) Log::write(LOG_LEVEL_INFO, (code), (value))
+#else
+#define LOG_INFO(code, value) ((void)0)
+#endif
+
+#if LOG_LEVEL >= LOG_LEVEL_DEBUG
+#define LOG_DEBUG(code, value) Log::write(LOG_LEVEL_DEBUG, (code), (value))
+#else
+#define LOG_DEBUG(code, value) ((void)0)
+#endif
+
+#endif // LOG_H
@@ -0,0 +1,115 @@
+#include <string.h>
+#include "Espx.h"
+#include <Arduino.h>
+
+#include "Ntp.h"
+
+#define NTP_MAX_HELD_SECONDS 60          // longer than any server holds a request.
+
+static uint32_t readUnsigned(const uint8_t* data) {
+  return ((uint32_t) data[0] << 24) | ((uint32_t) data[1] << 16) | ((uint32_t) data[2] << 8) | data[3];
+}
+
+// The fraction of a timestamp is in units of 2^-32 s.
+static uint32_t fractionToMs(uint32_t fraction) {
+  return ((uint64_t) fraction * 1000) >> 32;
+}
+
+NtpClient::NtpClient(UDP& udp, uint16_t localPort) {
+  this->udp = &udp;
+  this->localPort = localPort;
+  this->serverPort = NTP_PORT;
+  this->queries = 0;
+  this->sent = 0;
+  this->answered = false;
+  this->sampled = false;
+  this->bestDelay = 0;
+}
+
+// Starts listening and sends the first of queries requests. The rest are sent by poll, each once
+// the one before has been answered or has timed out.
+bool NtpClient::begin(IPAddress server, uint8_t queries, uint16_t port) {
+  this->server = server;
+  this->serverPort = port;
+  this->queries = queries > 0 ? queries : 1;
+  this->sent = 0;
+  this->sampled = false;
+  if (!this->udp->begin(this->localPort)) return false;
+  return request();
+}
+
+bool NtpClient::request() {
+  uint8_t packet[NTP_PACKET_SIZE];
+  memset(packet, 0, sizeof(packet));
+  packet[0] = 0b11100011;              // LI unsynchronised, version 4, mode client.
+  this->sentAt = millis();
+  this->sent++;
+  this->answered = false;
+  memset(this->nonce, 0, sizeof(this->nonce));
+  for (int i=0; i < 4; i++) this->nonce[i] = this->sentAt >> (24 - 8 * i);
+  this->nonce[4] = this->sent;
+  memcpy(packet + 40, this->nonce, sizeof(this->nonce));
+  if (!this->udp->beginPacket(this->server, this->serverPort)) return false;
+  if (this->udp->write(packet, sizeof(packet)) != sizeof(packet)) return false;
+  return this->udp->endPacket();
+}
+
+// Takes the reply to the current request, received at now, if it is one.
+bool NtpClient::receive(const uint8_t* packet, uint32_t now) {
+  uint8_t leap = packet[0] >> 6;
+  uint8_t mode = packet[0] & 0x07;
+  uint8_t stratum = packet[1];
+  if (leap == 3 || mode != 4 || stratum == 0 || stratum > 15) return false;
+  if (memcmp(packet + 24, this->nonce, sizeof(this->nonce)) != 0) return false;
+  uint32_t receiveSeconds = readUnsigned(packet + 32);
+  uint32_t transmitSeconds = readUnsigned(packet + 40);
+  if (transmitSeconds == 0 || transmitSeconds - receiveSeconds > NTP_MAX_HELD_SECONDS) return false;
+
+  int32_t heldMs = (transmitSeconds - receiveSeconds) * 1000 + fractionToMs(readUnsigned(packet + 44))
+                   - fractionToMs(readUnsigned(packet + 36));
+  int32_t delay = (int32_t) (now - this->sentAt) - heldMs;
+  if (delay < 0) delay = 0;
+  if (!this->sampled || (uint32_t) delay < this->bestDelay) {
+    // Unsigned arithmetic carries the offset over the 2036 NTP era rollover.
+    uint32_t unixSeconds = transmitSeconds - NTP_UNIX_OFFSET;
+    this->bestMs = (uint64_t) unixSeconds * 1000 + fractionToMs(readUnsigned(packet + 44)) + delay / 2;
+    this->bestDelay = delay;
+    this->receivedAt = now;
+    this->sampled = true;
+  }
+  return true;
+}
+
+// Reads any replies and sends the next query when due. True once all the queries have been
+// answered or timed out and at least one valid reply has been taken.
+bool NtpClient::poll() {
+  uint8_t packet[NTP_PACKET_SIZE];
+  if (this->sent == 0) return false;
+  while (!this->answered) {
+    int length = this->udp->parsePacket();
+    if (length <= 0) break;
+    if (length >= NTP_PACKET_SIZE && this->udp->read(packet, NTP_PACKET_SIZE) == NTP_PACKET_SIZE) {
+      this->answered = receive(packet, millis());
+    }
+  }
+  if (!this->answered && millis() - this->sentAt <= NTP_QUERY_TIMEOUT_MS) return false;
+  if (this->sent < this->queries) {
+    request();
+    return false;
+  }
+  return this->sampled;
+}
+
+// The server time now, from the best reply and the time since it arrived.
+bool NtpClient::populateTime(uint32_t* seconds, uint16_t* ms) {
+  if (!this->sampled) return false;
+  uint64_t now = this->bestMs + (uint32_t) (millis() - this->receivedAt);
+  *seconds = now / 1000;
+  *ms = now % 1000;
+  return true;
+}
+
+// The round trip of the best reply less the time the server held it, in ms.
+uint32_t NtpClient::getDelay() {
+  return this->bestDelay;
+}
@@ -0,0 +1,70 @@
+// MIT License
+
+// Low Power Sampler NTP - SNTP client timed to the millisecond, with round trip compensation.
+// Copyright (c) 2021 Simon Chinnick
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#ifndef NTP_H
+#define NTP_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "Espx.h"
+
+#define NTP_PACKET_SIZE 48
+#define NTP_PORT 123
+#define NTP_UNIX_OFFSET 2208988800UL    // seconds from 1900 (NTP) to 1970 (Unix).
+#ifndef NTP_QUERY_TIMEOUT_MS
+#define NTP_QUERY_TIMEOUT_MS 1000       // a reply later than this is taken as lost.
+#endif
+
+// Asks an NTP server the time and takes the server's receive and transmit timestamps, fractions
+// included, with the round trip measured by millis(): the server time at the reply is its transmit
+// time plus half the round trip less the time it held the request. With several queries the reply
+// with the least delay is kept, as it has the least room for an asymmetric path. The request's
+// transmit timestamp is a nonce the server echoes, so stale or stray replies are dropped.
+class NtpClient {
+
+    private:
+    UDP* udp;
+    uint16_t localPort;
+    IPAddress server;
+    uint16_t serverPort;
+    uint8_t queries;
+    uint8_t sent;
+    bool answered;
+    uint32_t sentAt;
+    uint8_t nonce[8];
+    bool sampled;
+    uint64_t bestMs;                    // Unix time of the best reply, in ms, when it was received.
+    uint32_t bestDelay;
+    uint32_t receivedAt;
+    bool request();
+    bool receive(const uint8_t* packet, uint32_t now);
+
+    public:
+    NtpClient(UDP& udp, uint16_t localPort = NTP_PORT);
+    bool begin(IPAddress server, uint8_t queries = 1, uint16_t port = NTP_PORT);
+    bool poll();
+    bool populateTime(uint32_t* seconds, uint16_t* ms);
+    uint32_t getDelay();
+};
+
+#endif // NTP_H
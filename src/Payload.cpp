@@ -0,0 +1,95 @@
+#include <string.h>
+#include "Espx.h"
+#include <Arduino.h>
+
+#include "Payload.h"
+#include "Format.h"
+
+// Big enough for any number Format writes.
+#define FIELD_SIZE 16
+
+// =============== PayloadWriter ===========================================================
+
+PayloadWriter::PayloadWriter(Print* out) {
+  this->out = out;
+  this->length = 0;
+  this->failed = false;
+}
+
+size_t PayloadWriter::getLength() {
+  return this->length;
+}
+
+bool PayloadWriter::hasFailed() {
+  return this->failed;
+}
+
+// Once the Print has failed the rest is dropped, but still counted.
+void PayloadWriter::bytes(const uint8_t* data, size_t n) {
+  this->length += n;
+  if (this->out == NULL || this->failed || n == 0) return;
+  if (this->out->write(data, n) != n) this->failed = true;
+}
+
+void PayloadWriter::text(const char* s) {
+  bytes((const uint8_t*) s, strlen(s));
+}
+
+void PayloadWriter::number(uint32_t value) {
+  char field[FIELD_SIZE];
+  bytes((const uint8_t*) field, Format::number(field, sizeof(field), value));
+}
+
+void PayloadWriter::signedNumber(int32_t value) {
+  char field[FIELD_SIZE];
+  bytes((const uint8_t*) field, Format::signedNumber(field, sizeof(field), value));
+}
+
+void PayloadWriter::fixed(int32_t value, uint8_t decimals) {
+  char field[FIELD_SIZE];
+  bytes((const uint8_t*) field, Format::fixed(field, sizeof(field), value, decimals));
+}
+
+// Lower case, two digits a byte.
+void PayloadWriter::hex(const uint8_t* data, size_t n) {
+  static const char digits[] = "0123456789abcdef";
+  for (size_t i=0; i < n; i++) {
+    uint8_t pair[2] = {(uint8_t) digits[data[i] >> 4], (uint8_t) digits[data[i] & 0x0F]};
+    bytes(pair, sizeof(pair));
+  }
+}
+
+void PayloadWriter::u8(uint8_t value) {
+  bytes(&value, 1);
+}
+
+void PayloadWriter::u16(uint16_t value) {
+  uint8_t field[2] = {(uint8_t) value, (uint8_t) (value >> 8)};
+  bytes(field, sizeof(field));
+}
+
+void PayloadWriter::u32(uint32_t value) {
+  uint8_t field[4] = {(uint8_t) value, (uint8_t) (value >> 8), (uint8_t) (value >> 16), (uint8_t) (value >> 24)};
+  bytes(field, sizeof(field));
+}
+
+// =============== Payload =================================================================
+
+bool Payload::isBinary() {
+  return false;
+}
+
+size_t Payload::getLength() {
+  PayloadWriter counter;
+  writeTo(counter);
+  return counter.getLength();
+}
+
+BytesPayload::BytesPayload(const uint8_t* data, size_t length) {
+  this->data = data;
+  this->length = length;
+}
+
+void BytesPayload::writeTo(PayloadWriter& writer) {
+  writer.bytes(this->data, this->length);
+}
@@ -0,0 +1,80 @@
+// MIT License
+
+// Low Power Sampler Payload - messages written straight into the transport's client.
+// Copyright (c) 2021 Simon Chinnick
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#ifndef PAYLOAD_H
+#define PAYLOAD_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "Espx.h"
+
+// Writes a payload field by field to a Print (a PubSubClient between beginPublish and endPublish,
+// a Client or a UDP packet). With no Print it only counts, which is how a transport that must
+// send the length first finds it. Text fields are formatted by Format; binary fields are little
+// endian.
+class PayloadWriter {
+
+    private:
+    Print* out;
+    size_t length;
+    bool failed;
+
+    public:
+    PayloadWriter(Print* out = NULL);
+    size_t getLength();
+    bool hasFailed();                   // the Print took less than it was given.
+    void bytes(const uint8_t* data, size_t n);
+    void text(const char* s);
+    void number(uint32_t value);
+    void signedNumber(int32_t value);
+    void fixed(int32_t value, uint8_t decimals);
+    void hex(const uint8_t* data, size_t n);
+    void u8(uint8_t value);
+    void u16(uint16_t value);
+    void u32(uint32_t value);
+};
+
+// A message built as it is sent, so there is no buffer to hold it and no limit on its size.
+// writeTo is called once to count and again to send, so must write the same each time.
+class Payload {
+
+    public:
+    virtual ~Payload() {}
+    virtual void writeTo(PayloadWriter& writer) = 0;
+    virtual bool isBinary();
+    size_t getLength();
+};
+
+// A message that is already in memory.
+class BytesPayload : public Payload {
+
+    private:
+    const uint8_t* data;
+    size_t length;
+
+    public:
+    BytesPayload(const uint8_t* data, size_t length);
+    void writeTo(PayloadWriter& writer);
+};
+
+#endif // PAYLOAD_H
@@ -0,0 +1,94 @@
+#include <string.h>
+#include <limits.h>
+
+#include "Rollup.h"
+
+#ifdef ROLLUPS
+
+static_assert(ROLLUP_HOURS > 0 && ROLLUP_HOURS < 256, "ROLLUP_HOURS must be 1 to 255");
+static_assert(ROLLUP_DAYS > 0 && ROLLUP_DAYS < 256, "ROLLUP_DAYS must be 1 to 255");
+
+void Rollup::accumulate(RollupAccumulator* accumulator, uint32_t sum, uint16_t count, uint16_t min, uint16_t max) {
+  if (count == 0 || accumulator->count > USHRT_MAX - count) return;
+  if (accumulator->count == 0 || min < accumulator->min) accumulator->min = min;
+  if (accumulator->count == 0 || max > accumulator->max) accumulator->max = max;
+  accumulator->sum += sum;
+  accumulator->count += count;
+}
+
+void Rollup::close(RollupAccumulator* accumulator, RollupSummary* ring, uint8_t size, uint8_t* next, uint8_t* count) {
+  RollupSummary* summary = &ring[*next];
+  summary->count = accumulator->count;
+  summary->min = accumulator->count ? accumulator->min : 0;
+  summary->max = accumulator->count ? accumulator->max : 0;
+  summary->mean = accumulator->count ? (accumulator->sum + accumulator->count / 2) / accumulator->count : 0;
+  *next = (*next + 1) % size;
+  if (*count < size) (*count)++;
+  memset(accumulator, 0, sizeof(*accumulator));
+}
+
+// Empty summaries for periods with no measurements; more than the ring holds just empties it.
+void Rollup::skip(uint32_t periods, RollupSummary* ring, uint8_t size, uint8_t* next, uint8_t* count) {
+  RollupAccumulator empty;
+  memset(&empty, 0, sizeof(empty));
+  for (uint32_t i=0; i < periods && i < size; i++) close(&empty, ring, size, next, count);
+}
+
+// time is in seconds, as Sampler::currentTime. Time going backwards (a resync) keeps to the
+// open hour.
+void Rollup::add(Rollups* rollups, uint16_t value, uint32_t time) {
+  uint32_t hour = time - time % ROLLUP_HOUR_SECONDS;
+  if (rollups->hourStart == 0 && rollups->hour.count == 0) {
+    rollups->hourStart = hour;
+  } else if (hour > rollups->hourStart) {
+    RollupAccumulator* open = &rollups->hour;
+    accumulate(&rollups->day, open->sum, open->count, open->min, open->max);
+    close(open, rollups->hours, ROLLUP_HOURS, &rollups->nextHour, &rollups->nHours);
+    skip((hour - rollups->hourStart) / ROLLUP_HOUR_SECONDS - 1, rollups->hours, ROLLUP_HOURS,
+         &rollups->nextHour, &rollups->nHours);
+    uint32_t openDay = rollups->hourStart / ROLLUP_DAY_SECONDS;
+    uint32_t day = hour / ROLLUP_DAY_SECONDS;
+    if (day > openDay) {
+      close(&rollups->day, rollups->days, ROLLUP_DAYS, &rollups->nextDay, &rollups->nDays);
+      skip(day - openDay - 1, rollups->days, ROLLUP_DAYS, &rollups->nextDay, &rollups->nDays);
+    }
+    rollups->hourStart = hour;
+  }
+  accumulate(&rollups->hour, value, 1, value, value);
+}
+
+// The first synchronise moves the clock from time since first boot to UTC. The open hour and day
+// carry on from time with the measurements they hold, rather than the jump closing them and filling
+// both rings with empty periods.
+void Rollup::restart(Rollups* rollups, uint32_t time) {
+  rollups->hourStart = time - time % ROLLUP_HOUR_SECONDS;
+}
+
+uint8_t Rollup::getCount(const Rollups* rollups, RollupTier tier) {
+  return tier == ROLLUP_HOUR ? rollups->nHours : rollups->nDays;
+}
+
+// The closed summaries, oldest first, with the time each period started.
+bool Rollup::populateSummary(const Rollups* rollups, RollupTier tier, uint8_t index, RollupSummary* summary, uint32_t* start) {
+  bool hours = tier == ROLLUP_HOUR;
+  uint8_t count = hours ? rollups->nHours : rollups->nDays;
+  uint8_t size = hours ? ROLLUP_HOURS : ROLLUP_DAYS;
+  uint8_t next = hours ? rollups->nextHour : rollups->nextDay;
+  if (index >= count) return false;
+  *summary = (hours ? rollups->hours : rollups->days)[(next + size - count + index) % size];
+  uint32_t period = hours ? ROLLUP_HOUR_SECONDS : ROLLUP_DAY_SECONDS;
+  uint32_t open = rollups->hourStart - rollups->hourStart % period;
+  *start = open - (uint32_t) (count - index) * period;
+  return true;
+}
+
+// Drops the closed summaries of a tier once they have been delivered. The open periods carry on.
+void Rollup::clear(Rollups* rollups, RollupTier tier) {
+  if (tier == ROLLUP_HOUR) {
+    rollups->nHours = 0;
+  } else {
+    rollups->nDays = 0;
+  }
+}
+
+#endif // ROLLUPS
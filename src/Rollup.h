@@ -0,0 +1,63 @@
+// MIT License
+
+// Low Power Sampler Rollup - hourly and daily summaries of the measurements in RTC memory.
+// Copyright (c) 2021 Simon Chinnick
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#ifndef ROLLUP_H
+#define ROLLUP_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "Configuration.h"
+
+// Compiled in only with -D ROLLUPS, which also sets aside the Rollups in RtcData.
+#ifdef ROLLUPS
+
+#define ROLLUP_HOUR_SECONDS 3600UL
+#define ROLLUP_DAY_SECONDS 86400UL
+
+typedef enum {
+  ROLLUP_HOUR,
+  ROLLUP_DAY
+} RollupTier;
+
+// Each measurement is added to the open hour and, when the hour closes, the hour to the open day.
+// Closed summaries go into a ring per tier, oldest overwritten. A period with no measurements is
+// held as an empty summary, so the start of each is known from the open hour without storing it.
+// Hours and days are whole periods of the Sampler's time: UTC once synchronised.
+class Rollup {
+
+    private:
+    static void close(RollupAccumulator* accumulator, RollupSummary* ring, uint8_t size, uint8_t* next, uint8_t* count);
+    static void skip(uint32_t periods, RollupSummary* ring, uint8_t size, uint8_t* next, uint8_t* count);
+    static void accumulate(RollupAccumulator* accumulator, uint32_t sum, uint16_t count, uint16_t min, uint16_t max);
+
+    public:
+    static void add(Rollups* rollups, uint16_t value, uint32_t time);
+    static void restart(Rollups* rollups, uint32_t time);
+    static uint8_t getCount(const Rollups* rollups, RollupTier tier);
+    static bool populateSummary(const Rollups* rollups, RollupTier tier, uint8_t index, RollupSummary* summary, uint32_t* start);
+    static void clear(Rollups* rollups, RollupTier tier);
+};
+
+#endif // ROLLUPS
+
+#endif // ROLLUP_H
@@ -1,89 +1,486 @@
 #include "Sampler.h"
 #include <limits.h>
-#include <math.h>
+#include <stdlib.h>
+#include <string.h>
 #include "Espx.h"
 #include <Arduino.h>
 
 #define MAX_SLEEP_TIME_MS 3600000
+#define ALERT_SLEEP_MS 10               // the sleep before an alert wake.
 
-Sampler::Sampler(Configuration& config) {
+SamplerBase::SamplerBase(Configuration& config) {
     this->configuration = &config;
-    config.resetSynchronisation(0,1.0);
+    this->eventPin = -1;
+    this->wakeCause = WAKE_CAUSE_RESET;
+    this->calibrationInterval = 0;
+    this->calibrationMillivoltChange = RF_CAL_MILLIVOLT_CHANGE;
+    this->batteryMillivolts = 0;
+    this->defaultTransmitOffset = NO_TRANSMIT_OFFSET;
+    this->sampleBudget = 0;
+    this->measurementBudget = 0;
+    this->transmitBudget = 0;
+    this->wakeCounter = 0;
+    this->watching = false;
+    this->overrun = false;
+    this->freshStart = false;
+    config.resetSynchronisation(0,0);
 }
 
-void Sampler::setup() {
+void SamplerBase::setup() {
     this->initialTime = millis();
-    if (this->configuration->checkMemory()) {
+    this->wakeCause = Espx::getWakeCause();
+    this->freshStart = !this->configuration->checkMemory();
+    if (!this->freshStart) {
         this->configuration->fromMemory();
     } else {
         uint16_t* data = this->configuration->getData();
         for (int i=0; i < MAX_DATA_ELEMENTS; i++) data[i]=0;
+#ifdef ROLLUPS
+        memset(this->configuration->getRollups(), 0, sizeof(Rollups));
+#endif
+#ifdef ALARMS
+        Alarm::reset(this->configuration->getAlarms());
+#endif
     }
     this->configuration->populateParameters(&params);
     this->configuration->populateSynchronisation(&sync);
+    this->configuration->populateActiveWindow(&window);
     this->d = ((params.measurementInterval - 1) / MAX_SLEEP_TIME_MS) + 1;
     this->y = params.nSamples + this->d - 1;
     this->x = params.transmitFrequency * this->y;
-    this->offset = 0.0;
+    this->offset = 0;
+    this->overrun = false;
 }
 
-void Sampler::loop() {
+// Move the counter on for this wake and start timing it; returns the counter the wake is for.
+uint16_t SamplerBase::beginWake() {
     uint16_t counter = this->configuration->getCounter();
-    uint16_t* data = this->configuration->getData();
     if (counter % this->x == 0 && counter > (USHRT_MAX - this->x)) {
         this->configuration->resetCounter();
     } else { 
         this->configuration->incrementCounter();
     }
+    this->watch(counter);
+    return counter;
+}
 
-    if (this->cbTakeSample && isSampleDue(counter)) {
-        data[(counter - 1) % this-> y ] = this->cbTakeSample();
-    }
-    if (this->cbTakeMeasurement && isMeasurementDue(counter)) {
-        uint32_t index = params.nSamples + ((counter + (this->d -1) + (this->x - this->y)) / this->y) % params.transmitFrequency; 
-        data[index] = this->cbTakeMeasurement(data,params.nSamples);
-    }
-    if (this->cbTransmit && isTransmitDue(counter)) {
-        this->cbTransmit(data + params.nSamples, params.transmitFrequency);
-    }
+// Which of the transmitFrequency measurements in data this wake's measurement is.
+uint32_t SamplerBase::measurementIndex(uint16_t counter) {
+    return ((counter + (this->d -1) + (this->x - this->y)) / this->y) % params.transmitFrequency;
+}
+
+uint32_t SamplerBase::measurementBaseTime(uint16_t* data) {
+    uint16_t* timestamps = data + params.nSamples + params.transmitFrequency;
+    return ((uint32_t) timestamps[params.transmitFrequency] << 16) | timestamps[params.transmitFrequency + 1];
+}
+
+void SamplerBase::endWake(uint16_t counter) {
+    if (this->watching) Espx::stopWatchdog();
+    if (!this->overrun) this->sleepUntilNextWake(counter, dueFlags(counter));
+    this->setup();
+}
+
+void SamplerBase::sleepUntilNextWake(uint16_t counter, uint8_t flags) {
     uint32_t nominalSleepTime = calculateSleepTime(counter);
-    long correctionTime = (long)(this->offset*1000UL);
+    if (isTransmitDue(counter)) this->offset = slotCorrection(nominalSleepTime);
+    long correctionTime = this->offset;
+    bool wakeWithWifi = isTransmitDue(counter+1);
+    // If the next wake would fall outside the active window, sleep on towards its opening.
+    uint64_t nextWake = wakeStartMs() +
+                        (correctionTime > (long) nominalSleepTime ? 0 : nominalSleepTime - correctionTime);
+    uint32_t quiet = windowDelay(nextWake);
+    if (quiet > 0 && nominalSleepTime < MAX_SLEEP_TIME_MS) {
+        if (quiet > MAX_SLEEP_TIME_MS - nominalSleepTime) {
+            quiet = MAX_SLEEP_TIME_MS - nominalSleepTime;
+            wakeWithWifi = false;
+        }
+        nominalSleepTime += quiet;
+    }
     this->configuration->incrementElapsed(correctionTime >  (long) nominalSleepTime ? 0 : (nominalSleepTime - correctionTime));
-    this->configuration->save();
 
     correctionTime += millis() - this->initialTime;
     unsigned long sleepTime = (correctionTime > (long) nominalSleepTime) ? 0 : (nominalSleepTime - correctionTime);
-    Espx::deepSleep((unsigned long)round(sleepTime*sync.calibrationFactor)*1000UL, isTransmitDue(counter+1));
-    this->setup();
+    trace(counter, flags, nominalSleepTime, correctionTime);
+    this->sleep(calibratedMicros(sleepTime, sync.driftPpm), wakeWithWifi);
 }
 
-void Sampler::synchronise(uint32_t timeInSeconds) {
-    uint32_t processingSeconds = (millis() - this->initialTime)/1000;
-    if (sync.syncTime != 0) {
-        float actualElapsed = timeInSeconds - (sync.syncTime + processingSeconds);
-        if (sync.nominalElapsed > 0) {
-            this->offset = actualElapsed - sync.nominalElapsed;
-            sync.calibrationFactor *= (1.0 - this->offset/actualElapsed);
-        }
-        this->configuration->resetSynchronisation(timeInSeconds - processingSeconds, sync.calibrationFactor);
+// Abort the wake once its work has taken longer than the budget for the most expensive of it.
+void SamplerBase::limitAwakeTime(uint32_t sampleMs, uint32_t measurementMs, uint32_t transmitMs) {
+    this->sampleBudget = sampleMs;
+    this->measurementBudget = measurementMs;
+    this->transmitBudget = transmitMs;
+}
+
+// Lift the limit for the rest of this wake, e.g. before an OTA update.
+void SamplerBase::keepAwake() {
+    if (this->watching) Espx::stopWatchdog();
+    this->watching = false;
+}
+
+void SamplerBase::watch(uint16_t counter) {
+    uint8_t due = dueFlags(counter);
+    uint32_t budget = (due & WAKE_TRANSMIT) ? this->transmitBudget :
+                      (due & WAKE_MEASUREMENT) ? this->measurementBudget : this->sampleBudget;
+    this->watching = budget > 0;
+    if (!this->watching) return;
+    this->wakeCounter = counter;
+    uint32_t awake = millis() - this->initialTime;
+    Espx::startWatchdog(budget > awake ? budget - awake : 1, awakeTimeExpired, this);
+}
+
+void SamplerBase::awakeTimeExpired(void* sampler) {
+    ((SamplerBase*) sampler)->abortWake();
+}
+
+// Runs from the watchdog while a callback is stuck, with the loop parked (ESP8266) or suspended
+// (ESP32), so nothing else is changing the configuration. Note the overrun and go to sleep as the
+// wake would have - the counter is already moved on - so the schedule is kept. Nothing here may
+// yield: save only writes memory and Espx::deepSleep asks the SDK directly from the watchdog.
+// On the ESP8266 the sketch may run on until the sleep takes hold; loop() does nothing more once
+// the callback returns.
+void SamplerBase::abortWake() {
+    uint8_t due = dueFlags(this->wakeCounter);
+    this->overrun = true;
+    this->configuration->recordOverrun(due);
+    this->sleepUntilNextWake(this->wakeCounter, due | TRACE_OVERRUN);
+}
+
+// Seconds since the epoch (or since first boot if never synchronised). The sleeps that make up
+// nominalElapsed have already been corrected for drift, so they are in real time.
+uint32_t SamplerBase::currentTime() {
+    return sync.syncTime + sync.nominalElapsed + (sync.elapsedMs + (millis() - this->initialTime))/1000;
+}
+
+// As above in ms, at the start of this wake by the schedule.
+uint64_t SamplerBase::wakeStartMs() {
+    return ((uint64_t) sync.syncTime + sync.nominalElapsed) * 1000 + sync.elapsedMs;
+}
+
+// Measurement times follow the measurements in data: transmitFrequency 16 bit deltas, each from
+// the previous measurement (the first is 0), then the time of the first measurement as two words.
+void SamplerBase::recordTimestamp(uint16_t* data, uint32_t k) {
+    uint16_t* deltas = data + params.nSamples + params.transmitFrequency;
+    uint16_t* base = deltas + params.transmitFrequency;
+    uint32_t now = currentTime();
+    if (k == 0) {
+        base[0] = now >> 16;
+        base[1] = now & 0xFFFF;
+        deltas[0] = 0;
+        return;
+    }
+    uint32_t previous = ((uint32_t) base[0] << 16) | base[1];
+    for (uint32_t i=1; i < k; i++) previous += deltas[i];
+    uint32_t delta = (now > previous) ? now - previous : 0;
+    deltas[k] = (delta > USHRT_MAX) ? USHRT_MAX : delta;
+}
+
+// An external wake interrupts a scheduled sleep. The loop takes an out-of-cycle sample for the
+// event callback, then finishEvent sleeps out the remainder so the periodic schedule is unaffected.
+bool SamplerBase::isEventPending() {
+    Wakeup wakeup;
+    this->configuration->populateWakeup(&wakeup);
+    return Espx::rtcElapsedMillis(wakeup.sleepStart) < wakeup.sleepDuration;
+}
+
+void SamplerBase::finishEvent() {
+    Wakeup wakeup;
+    this->configuration->populateWakeup(&wakeup);
+    uint32_t elapsed = Espx::rtcElapsedMillis(wakeup.sleepStart);
+    uint32_t remaining = (elapsed >= wakeup.sleepDuration) ? 0 : wakeup.sleepDuration - elapsed;
+    trace(this->configuration->getCounter(), TRACE_EVENT, remaining, 0);
+    this->sleep((uint64_t) remaining*1000ULL, isTransmitDue(this->configuration->getCounter()));
+}
+
+// Note what was decided on this wake; sleep adds how the next wake was asked for and keeps it.
+void SamplerBase::trace(uint16_t counter, uint8_t flags, uint32_t nominalSleepTime, int32_t correctionTime) {
+#ifdef WAKE_TRACE
+    this->traceRecord.counter = counter;
+    this->traceRecord.flags = flags;
+    this->traceRecord.reserved = 0;
+    this->traceRecord.nominalSleepTime = nominalSleepTime;
+    this->traceRecord.correctionTime = correctionTime;
+#endif
+}
+
+// Add the measurement to the hourly and daily summaries when built with -D ROLLUPS.
+void SamplerBase::rollUp(uint16_t measurement) {
+#ifdef ROLLUPS
+    Rollup::add(this->configuration->getRollups(), measurement, currentTime());
+#endif
+}
+
+// Run the alarm rules on a reading when built with -D ALARMS.
+void SamplerBase::alarm(uint8_t source, uint16_t value) {
+#ifdef ALARMS
+    Alarm::check(this->configuration->getAlarms(), source, value, currentTime());
+#endif
+}
+
+bool SamplerBase::isAlertDue() {
+#ifdef ALARMS
+    return Alarm::isAlertDue(this->configuration->getAlarms());
+#else
+    return false;
+#endif
+}
+
+// An alert is sent from a short radio wake in place of the sleep of the wake a rule fired on.
+// That sleep is kept as the wakeup, so the alert wake finishes it as an event wake would.
+bool SamplerBase::isAlertWake() {
+    return isAlertDue() && isEventPending();
+}
+
+uint8_t SamplerBase::getFiredAlarms() {
+#ifdef ALARMS
+    return Alarm::getFired(this->configuration->getAlarms());
+#else
+    return 0;
+#endif
+}
+
+void SamplerBase::alerted() {
+#ifdef ALARMS
+    Alarm::alerted(this->configuration->getAlarms(), currentTime());
+#endif
+}
+
+void SamplerBase::sleep(uint64_t usSleepTime, bool wakeWithWifi) {
+    bool alert = isAlertDue() && usSleepTime > ALERT_SLEEP_MS * 1000ULL;
+    if (alert) wakeWithWifi = true;
+    bool calibrate = wakeWithWifi && this->calibrationInterval > 0 && isRadioCalibrationDue();
+#ifdef WAKE_TRACE
+    this->traceRecord.sleepTime = usSleepTime / 1000;
+    this->traceRecord.flags |= (wakeWithWifi ? TRACE_RADIO : 0) | (calibrate ? TRACE_RF_CAL : 0);
+    Trace::write(&this->traceRecord);
+#endif
+    this->configuration->setWakeup(Espx::rtcTime(), usSleepTime/1000);
+    this->configuration->applyStaged();     // this wake was timed by the old schedule, the next is by the new.
+    this->configuration->save();
+    if (this->eventPin >= 0) {
+        Espx::enableExternalWakeup(this->eventPin, digitalRead(this->eventPin) == LOW);
+    }
+    if (alert) usSleepTime = ALERT_SLEEP_MS * 1000ULL;
+    if (this->calibrationInterval > 0) {
+        Espx::deepSleep(usSleepTime, wakeWithWifi, calibrate);
     } else {
-        this->configuration->resetSynchronisation(timeInSeconds - processingSeconds, 1.0);
+        Espx::deepSleep(usSleepTime, wakeWithWifi);
     }
 }
 
+// Called for each radio wake when calibrateRadio is enabled - calibrate on every Nth, or sooner
+// if the battery has moved or a connection failed since the last calibration.
+bool SamplerBase::isRadioCalibrationDue() {
+    Radio radio;
+    this->configuration->populateRadio(&radio);
+    bool due = radio.calibrationDue || radio.wakesSinceCalibration + 1 >= this->calibrationInterval;
+    if (due) {
+        uint16_t millivolts = this->batteryMillivolts ? this->batteryMillivolts : radio.calibrationMillivolts;
+        this->configuration->setRadio(millivolts, 0, false);
+    } else {
+        this->configuration->setRadio(radio.calibrationMillivolts, radio.wakesSinceCalibration + 1, false);
+    }
+    return due;
+}
+
+void SamplerBase::calibrateRadio(uint8_t everyNWakes, uint16_t millivoltChange) {
+    this->calibrationInterval = everyNWakes;
+    this->calibrationMillivoltChange = millivoltChange;
+}
+
+// Power-on always calibrates, so the first reading is taken as the calibrated voltage.
+void SamplerBase::setBatteryVoltage(uint16_t millivolts) {
+    Radio radio;
+    this->batteryMillivolts = millivolts;
+    this->configuration->populateRadio(&radio);
+    if (radio.calibrationMillivolts == 0) {
+        this->configuration->setRadio(millivolts, radio.wakesSinceCalibration, radio.calibrationDue);
+    } else if (abs((int32_t) millivolts - radio.calibrationMillivolts) >= this->calibrationMillivoltChange) {
+        this->configuration->setRadio(radio.calibrationMillivolts, radio.wakesSinceCalibration, true);
+    }
+}
+
+// Start the transmit wakes transmitOffset ms into each transmit cycle (measurementInterval *
+// transmitFrequency), unless the server has assigned an offset in the configuration.
+void SamplerBase::slotTransmits(uint32_t transmitOffset) {
+    this->defaultTransmitOffset = transmitOffset;
+}
+
+// FNV-1a, so each device gets the same offset on every boot and a fleet is spread out.
+uint32_t SamplerBase::slotFor(const char* id) {
+    uint32_t hash = 2166136261UL;
+    while (*id) {
+        hash ^= (uint8_t) *id++;
+        hash *= 16777619UL;
+    }
+    return hash;
+}
+
+uint32_t SamplerBase::transmitSlot() {
+    return (params.transmitOffset != NO_TRANSMIT_OFFSET) ? params.transmitOffset : this->defaultTransmitOffset;
+}
+
+// After power on, sleep until the first transmit wake will fall in the slot, rather than
+// transmitting along with every other device that was powered up at the same moment.
+bool SamplerBase::waitForSlot() {
+    uint32_t slot = transmitSlot();
+    uint64_t cycle = (uint64_t) params.measurementInterval * params.transmitFrequency;
+    if (slot == NO_TRANSMIT_OFFSET || cycle == 0) return false;
+    uint64_t toTransmit = 0;
+    for (int32_t c=1; !isTransmitDue(c); c++) toTransmit += calculateSleepTime(c);
+    uint64_t wakeStart = wakeStartMs();
+    uint32_t delay = (uint32_t) ((slot % cycle + 2 * cycle - (wakeStart + toTransmit) % cycle) % cycle);
+    if (delay == 0) return false;
+    if (delay > MAX_SLEEP_TIME_MS) delay = MAX_SLEEP_TIME_MS;
+    this->configuration->incrementElapsed(delay);
+    uint32_t processing = millis() - this->initialTime;
+    trace(this->configuration->getCounter(), TRACE_SLOT, delay, processing);
+    this->sleep(calibratedMicros(delay > processing ? delay - processing : 0, sync.driftPpm),
+                isTransmitDue(this->configuration->getCounter()));
+    return true;
+}
+
+// ms from atMs (synchronised time) until the active window next opens: 0 if it is open then, or
+// there is no window. There is no local time to go by until the first synchronise.
+uint32_t SamplerBase::windowDelay(uint64_t atMs) {
+    const uint64_t day = MINUTES_PER_DAY * 60000ULL;
+    if (sync.syncTime == 0 || window.activeMinutes == 0 || window.activeMinutes >= MINUTES_PER_DAY) return 0;
+    uint64_t local = (atMs + day + (int64_t) window.utcOffsetMinutes * 60000) % day;
+    uint64_t sinceOpening = (local + day - window.startMinute * 60000ULL) % day;
+    if (sinceOpening < window.activeMinutes * 60000ULL) return 0;
+    return (uint32_t) (day - sinceOpening);
+}
+
+// Outside the active window, sleep until it opens, MAX_SLEEP_TIME_MS at a time, instead of
+// running the schedule. The counter stays put, so the schedule carries on where it left off.
+bool SamplerBase::waitForWindow() {
+    uint32_t delay = windowDelay(wakeStartMs());
+    if (delay == 0) return false;
+    bool opens = delay <= MAX_SLEEP_TIME_MS;
+    if (!opens) delay = MAX_SLEEP_TIME_MS;
+    this->configuration->incrementElapsed(delay);
+    uint32_t processing = millis() - this->initialTime;
+    uint16_t counter = this->configuration->getCounter();
+    trace(counter, TRACE_SLOT, delay, processing);
+    this->sleep(calibratedMicros(delay > processing ? delay - processing : 0, sync.driftPpm),
+                opens && isTransmitDue(counter));
+    return true;
+}
+
+// On a transmit wake, how much to shorten the next sleep so the whole schedule moves towards the
+// slot. The phase is taken from the time (synchronised or since first boot) at the start of this
+// wake, which already includes any synchronisation, so it replaces the offset from synchronise.
+// At most half the next sleep is taken per cycle, so sample spacing is never squeezed to nothing.
+int32_t SamplerBase::slotCorrection(uint32_t nominalSleepTime) {
+    uint32_t slot = transmitSlot();
+    if (slot == NO_TRANSMIT_OFFSET) return this->offset;
+    uint64_t cycle = (uint64_t) params.measurementInterval * params.transmitFrequency;
+    if (cycle == 0) return this->offset;
+    uint64_t wakeStart = wakeStartMs();
+    int64_t error = (int64_t) ((wakeStart + cycle - slot % cycle) % cycle);
+    if (error > (int64_t) cycle / 2) error -= cycle;
+    int64_t limit = nominalSleepTime / 2;
+    int64_t longest = MAX_SLEEP_TIME_MS - (int64_t) nominalSleepTime;
+    if (error > limit) error = limit;
+    if (error < -limit) error = -limit;
+    if (error < -longest) error = -longest;
+    return (int32_t) error;
+}
+
+void SamplerBase::connectionFailed() {
+    Radio radio;
+    this->configuration->populateRadio(&radio);
+    this->configuration->setRadio(radio.calibrationMillivolts, radio.wakesSinceCalibration, true);
+}
+
+uint64_t SamplerBase::calibratedMicros(uint32_t msSleepTime, int32_t driftPpm) {
+    return ((uint64_t) msSleepTime * (uint64_t) (PPM + driftPpm) + 500) / 1000;
+}
+
+// Calibrate against a time server. The reference point is the start of the synchronising wake,
+// rounded back to a whole second with the remainder carried in elapsedMs.
+void SamplerBase::synchronise(uint32_t timeInSeconds) {
+    synchronise(timeInSeconds, 0);
+}
+
+// As above with the time to the millisecond, e.g. from NTP, so drift is measured without the
+// up to a second of error that whole seconds leave.
+void SamplerBase::synchronise(uint32_t timeInSeconds, uint16_t ms) {
+    uint32_t processingMs = millis() - this->initialTime;
+    uint64_t syncMs = (uint64_t) timeInSeconds * 1000 + ms - processingMs;
+    int32_t driftPpm = 0;
+    bool firstSync = sync.syncTime == 0;
+    if (!firstSync) {
+        int64_t actualElapsed = (int64_t) syncMs - (int64_t) sync.syncTime * 1000;
+        int64_t nominalElapsed = (int64_t) sync.nominalElapsed * 1000 + sync.elapsedMs;
+        driftPpm = sync.driftPpm;
+        if (nominalElapsed > 0 && actualElapsed > 0) {
+            this->offset = (int32_t) (actualElapsed - nominalElapsed);
+            driftPpm = (int32_t) (((int64_t) (PPM + sync.driftPpm) * nominalElapsed + actualElapsed/2) / actualElapsed - PPM);
+        }
+    }
+    this->configuration->resetSynchronisation((uint32_t) (syncMs / 1000), driftPpm);
+    this->configuration->incrementElapsed((uint32_t) (syncMs % 1000));
+    this->configuration->populateSynchronisation(&sync);
+#ifdef ROLLUPS
+    if (firstSync) Rollup::restart(this->configuration->getRollups(), currentTime());
+#endif
+}
+
+// Calibrate against a server that read its clock (serverSeconds and serverMs) on receiving a
+// message sent roundTripMs before its reply arrived, taking the two legs to be equally long.
+void SamplerBase::synchroniseRoundTrip(uint32_t serverSeconds, uint16_t serverMs, uint32_t roundTripMs) {
+    uint32_t ms = serverMs + roundTripMs / 2;
+    synchronise(serverSeconds + ms / 1000, ms % 1000);
+}
+
+template class BasicSampler<CallbackPolicy>;
+
 void Sampler::onTakeSample(SampleCallBack fnSample) {
-    this->cbTakeSample = fnSample;
+    this->policy.cbTakeSample = fnSample;
 }
 
 void Sampler::onTakeMeasurement(MeasurementCallBack fnMeasurement) {
-    this->cbTakeMeasurement = fnMeasurement;
+    this->policy.cbTakeMeasurement = fnMeasurement;
 }
 
 void Sampler::onTransmit(TransmitCallBack fnTransmit) {
-    this->cbTransmit = fnTransmit;
+    this->policy.cbTransmit = fnTransmit;
+}
+
+// Transmit callback that also receives the time of the first measurement and the delta in seconds
+// of each measurement from the one before. Needs nSamples + 2 * transmitFrequency + 2 data elements.
+void Sampler::onTimestampedTransmit(TimestampedTransmitCallBack fnTransmit) {
+    this->policy.cbTimestampedTransmit = fnTransmit;
+}
+
+void Sampler::onEvent(EventCallBack fnEvent) {
+    this->policy.cbEvent = fnEvent;
+}
+
+// Called at the start of each transmit wake, before the sample and measurement, e.g. to start
+// WiFi associating in the background.
+void Sampler::onStartRadio(StartRadioCallBack fnStartRadio) {
+    this->policy.cbStartRadio = fnStartRadio;
+}
+
+// Called on the radio wake that follows a wake where an alarm rule fired, with bit i set for
+// each rule i that has fired since the alarms were last cleared (Alarm::clear). -D ALARMS only.
+void Sampler::onAlert(AlertCallBack fnAlert) {
+    this->policy.cbAlert = fnAlert;
 }
 
-uint32_t Sampler::calculateSleepTime(uint16_t c) {
+#if defined(ESP32)
+// Wake on the next change of level on pin as well as on the timer.
+void SamplerBase::wakeOnChange(uint8_t pin) {
+    this->eventPin = pin;
+}
+#endif
+
+WakeCause SamplerBase::getWakeCause() {
+    return this->wakeCause;
+}
+
+uint32_t SamplerBase::calculateSleepTime(uint16_t c) {
     uint32_t sleepTime = 0;
     uint32_t cyclePos = (c -1) % this->y;
     if (cyclePos < (params.nSamples -1)) {
@@ -103,14 +500,19 @@ uint32_t Sampler::calculateSleepTime(uint16_t c) {
     return sleepTime;
 }
 
-bool Sampler::isTransmitDue(int32_t c) {
+bool SamplerBase::isTransmitDue(int32_t c) {
     return (c - (int32_t)(this->x - (this->d - 1))) % (int32_t)this->x == 0;
 }
 
-bool Sampler::isSampleDue(int32_t c) {
+bool SamplerBase::isSampleDue(int32_t c) {
     return ((c - 1) % (int32_t)this->y ) < (int32_t)params.nSamples;
 }
 
-bool Sampler::isMeasurementDue(int32_t c) {
+bool SamplerBase::isMeasurementDue(int32_t c) {
     return ((c - (int32_t)params.nSamples) % (int32_t)this->y) == 0;
 }
+
+uint8_t SamplerBase::dueFlags(int32_t c) {
+    return (isSampleDue(c) ? WAKE_SAMPLE : 0) | (isMeasurementDue(c) ? WAKE_MEASUREMENT : 0) |
+           (isTransmitDue(c) ? WAKE_TRANSMIT : 0);
+}
@@ -26,38 +26,237 @@
 
 #include <functional>
 #include "Configuration.h"
+#include "Espx.h"
+#include "Trace.h"
+#include "Rollup.h"
+#include "Alarm.h"
+
+// Default battery voltage change that forces an RF calibration on the next radio wake.
+#define RF_CAL_MILLIVOLT_CHANGE 200
 
 using SampleCallBack = std::function<uint16_t()>;
 using MeasurementCallBack = std::function<uint16_t(uint16_t*, uint32_t)>;
 using TransmitCallBack = std::function<void(uint16_t*, uint32_t)>;
+using EventCallBack = std::function<void(uint16_t)>;
+using TimestampedTransmitCallBack = std::function<void(uint16_t*, uint32_t, uint32_t, uint16_t*)>;
+using StartRadioCallBack = std::function<void()>;
+using AlertCallBack = std::function<void(uint8_t)>;
 
-class Sampler {
+// Scheduling, synchronisation and sleep, shared by every BasicSampler. The wake itself - which
+// callbacks run and how - is BasicSampler::loop.
+class SamplerBase {
 
-    private:
+    protected:
     Configuration* configuration;
     Parameters params;
     Synchronisation sync;
+    ActiveWindow window;
     unsigned long initialTime;
     uint32_t d, y, x;
-    float offset;
+    int32_t offset;
+    WakeCause wakeCause;
+    int16_t eventPin;
+    uint8_t calibrationInterval;
+    uint16_t calibrationMillivoltChange;
+    uint16_t batteryMillivolts;
+    uint32_t defaultTransmitOffset;
+    uint32_t sampleBudget, measurementBudget, transmitBudget;
+    uint16_t wakeCounter;
+    bool watching;
+    volatile bool overrun;
+    bool freshStart;
+#ifdef WAKE_TRACE
+    TraceRecord traceRecord;
+#endif
+    void trace(uint16_t counter, uint8_t flags, uint32_t nominalSleepTime, int32_t correctionTime);
+    void rollUp(uint16_t measurement);
+    void alarm(uint8_t source, uint16_t value);
+    bool isAlertDue();
+    bool isAlertWake();
+    uint8_t getFiredAlarms();
+    void alerted();
+    bool isRadioCalibrationDue();
+    uint32_t transmitSlot();
+    bool waitForSlot();
+    int32_t slotCorrection(uint32_t nominalSleepTime);
+    uint32_t windowDelay(uint64_t atMs);
+    bool waitForWindow();
     bool isTransmitDue(int32_t c);
     bool isSampleDue(int32_t c);
     bool isMeasurementDue(int32_t c);
+    uint8_t dueFlags(int32_t c);
+    void watch(uint16_t counter);
+    void abortWake();
+    static void awakeTimeExpired(void* sampler);
+    void sleepUntilNextWake(uint16_t counter, uint8_t flags);
     uint32_t calculateSleepTime(uint16_t counter);
+    uint32_t currentTime();
+    uint64_t wakeStartMs();
+    void recordTimestamp(uint16_t* data, uint32_t k);
+    bool isEventPending();
+    void finishEvent();
+    uint16_t beginWake();
+    uint32_t measurementIndex(uint16_t counter);
+    uint32_t measurementBaseTime(uint16_t* data);
+    void endWake(uint16_t counter);
+    void sleep(uint64_t usSleepTime, bool wakeWithWifi);
+
+    public:
+    SamplerBase(Configuration& config);
+    void setup();
+#if defined(ESP32)
+    void wakeOnChange(uint8_t pin);
+#endif
+    WakeCause getWakeCause();
+    void synchronise(uint32_t timeInSeconds);
+    void synchronise(uint32_t timeInSeconds, uint16_t ms);
+    void synchroniseRoundTrip(uint32_t serverSeconds, uint16_t serverMs, uint32_t roundTripMs);
+    void calibrateRadio(uint8_t everyNWakes, uint16_t millivoltChange = RF_CAL_MILLIVOLT_CHANGE);
+    void setBatteryVoltage(uint16_t millivolts);
+    void connectionFailed();
+    void slotTransmits(uint32_t transmitOffset);
+    void limitAwakeTime(uint32_t sampleMs, uint32_t measurementMs, uint32_t transmitMs);
+    void keepAwake();
+    static uint32_t slotFor(const char* id);
+    static uint64_t calibratedMicros(uint32_t msSleepTime, int32_t driftPpm);
+};
 
-    // Callbacks
+// The callbacks of a BasicSampler, resolved at compile time. Derive from SamplerPolicy and hide
+// the hooks you need; the defaults do nothing, so what they guard is compiled out. takeSample and
+// takeMeasurement return false for no value, and timestamps() is true to have measurement times
+// recorded for transmitTimestamped (nSamples + 2 * transmitFrequency + 2 data elements).
+// startRadio is called first thing on a transmit wake, to start the radio associating without
+// waiting, so it does so while the sample and measurement are taken. alert sends an alert for the
+// alarm rules that fired (bit i for rule i) from a radio wake of its own, with -D ALARMS.
+struct SamplerPolicy {
+    void startRadio() {}
+    void alert(uint8_t rules) {}
+    bool takeSample(uint16_t& sample) { return false; }
+    bool takeMeasurement(uint16_t* samples, uint32_t n, uint16_t& measurement) { return false; }
+    bool timestamps() { return false; }
+    void transmit(uint16_t* measurements, uint32_t n) {}
+    void transmitTimestamped(uint16_t* measurements, uint32_t n, uint32_t baseTime, uint16_t* deltas) {}
+    void event(uint16_t sample) {}
+};
+
+template <class Policy>
+class BasicSampler : public SamplerBase {
+
+    protected:
+    Policy policy;
+
+    public:
+    BasicSampler(Configuration& config) : SamplerBase(config) {}
+    BasicSampler(Configuration& config, const Policy& policy) : SamplerBase(config), policy(policy) {}
+    void loop();
+};
+
+template <class Policy>
+void BasicSampler<Policy>::loop() {
+    if (this->wakeCause == WAKE_CAUSE_EXTERNAL && this->isEventPending()) {
+        uint16_t sample = 0;
+        if (this->policy.takeSample(sample)) this->alarm(ALARM_SAMPLE, sample);
+        this->policy.event(sample);
+        this->finishEvent();
+        this->setup();
+        return;
+    }
+    if (this->isAlertWake()) {
+        this->policy.alert(this->getFiredAlarms());
+        this->alerted();
+        this->finishEvent();
+        this->setup();
+        return;
+    }
+    if ((this->freshStart && this->waitForSlot()) || this->waitForWindow()) {
+        this->setup();
+        return;
+    }
+    uint16_t counter = this->beginWake();
+    uint16_t* data = this->configuration->getData();
+    bool transmitDue = this->isTransmitDue(counter);
+    if (transmitDue) this->policy.startRadio();
+
+    if (this->isSampleDue(counter)) {
+        uint16_t sample;
+        if (this->policy.takeSample(sample)) {
+            data[(counter - 1) % this->y] = sample;
+            this->alarm(ALARM_SAMPLE, sample);
+        }
+    }
+    if (this->isMeasurementDue(counter)) {
+        uint32_t k = this->measurementIndex(counter);
+        uint16_t measurement;
+        if (this->policy.takeMeasurement(data, this->params.nSamples, measurement)) {
+            data[this->params.nSamples + k] = measurement;
+            this->rollUp(measurement);
+            this->alarm(ALARM_MEASUREMENT, measurement);
+        }
+        if (this->policy.timestamps()) this->recordTimestamp(data, k);
+    }
+    if (transmitDue) {
+        uint16_t* measurements = data + this->params.nSamples;
+        this->policy.transmit(measurements, this->params.transmitFrequency);
+        if (this->policy.timestamps()) {
+            this->policy.transmitTimestamped(measurements, this->params.transmitFrequency, this->measurementBaseTime(data),
+                                             measurements + this->params.transmitFrequency);
+        }
+        this->alerted();        // the transmit carries any alarms that fired on this wake.
+    }
+    this->endWake(counter);
+}
+
+// The callbacks as std::function, set at run time.
+struct CallbackPolicy : SamplerPolicy {
     SampleCallBack cbTakeSample;
     MeasurementCallBack cbTakeMeasurement;
     TransmitCallBack cbTransmit;
+    EventCallBack cbEvent;
+    TimestampedTransmitCallBack cbTimestampedTransmit;
+    StartRadioCallBack cbStartRadio;
+    AlertCallBack cbAlert;
+
+    void startRadio() {
+        if (this->cbStartRadio) this->cbStartRadio();
+    }
+    void alert(uint8_t rules) {
+        if (this->cbAlert) this->cbAlert(rules);
+    }
+    bool takeSample(uint16_t& sample) {
+        if (this->cbTakeSample) sample = this->cbTakeSample();
+        return (bool) this->cbTakeSample;
+    }
+    bool takeMeasurement(uint16_t* samples, uint32_t n, uint16_t& measurement) {
+        if (this->cbTakeMeasurement) measurement = this->cbTakeMeasurement(samples, n);
+        return (bool) this->cbTakeMeasurement;
+    }
+    bool timestamps() {
+        return (bool) this->cbTimestampedTransmit;
+    }
+    void transmit(uint16_t* measurements, uint32_t n) {
+        if (this->cbTransmit) this->cbTransmit(measurements, n);
+    }
+    void transmitTimestamped(uint16_t* measurements, uint32_t n, uint32_t baseTime, uint16_t* deltas) {
+        this->cbTimestampedTransmit(measurements, n, baseTime, deltas);
+    }
+    void event(uint16_t sample) {
+        if (this->cbEvent) this->cbEvent(sample);
+    }
+};
+
+extern template class BasicSampler<CallbackPolicy>;
+
+class Sampler : public BasicSampler<CallbackPolicy> {
 
     public:
-    Sampler(Configuration& config);
-    void setup();
-    void loop();
+    Sampler(Configuration& config) : BasicSampler<CallbackPolicy>(config) {}
     void onTakeSample(SampleCallBack fnSample);
     void onTakeMeasurement(MeasurementCallBack fnMeasurement);
     void onTransmit(TransmitCallBack fnTransmit);
-    void synchronise(uint32_t timeInSeconds);
+    void onTimestampedTransmit(TimestampedTransmitCallBack fnTransmit);
+    void onEvent(EventCallBack fnEvent);
+    void onStartRadio(StartRadioCallBack fnStartRadio);
+    void onAlert(AlertCallBack fnAlert);
 };
 
 #endif // SAMPLER_H
\ No newline at end of file
@@ -0,0 +1,89 @@
+#include <string.h>
+#include "Espx.h"
+
+#include "Trace.h"
+
+#ifdef WAKE_TRACE
+
+TraceRing Trace::ring;
+
+void Trace::begin() {
+  if (!Espx::rtcUserMemoryRead(TRACE_OFFSET, (uint32_t*) &ring, sizeof(ring)) ||
+      ring.magic != TRACE_MAGIC || ring.head >= TRACE_RING_SIZE || ring.count > TRACE_RING_SIZE) {
+    clear();
+  }
+}
+
+// Called every wake, so only the new record and the ring header are written to RTC memory.
+void Trace::write(const TraceRecord* record) {
+  if (ring.magic != TRACE_MAGIC) begin();
+  uint8_t index = ring.head;
+  ring.records[index] = *record;
+  ring.head = (index + 1) % TRACE_RING_SIZE;
+  if (ring.count < TRACE_RING_SIZE) ring.count++;
+  Espx::rtcUserMemoryWrite(TRACE_OFFSET + 1 + index * sizeof(TraceRecord) / 4, (uint32_t*) &ring.records[index], sizeof(TraceRecord));
+  Espx::rtcUserMemoryWrite(TRACE_OFFSET, (uint32_t*) &ring, sizeof(uint32_t));
+}
+
+uint8_t Trace::getCount() {
+  return ring.count;
+}
+
+bool Trace::populateRecord(uint8_t index, TraceRecord* record) {
+  if (index >= ring.count) return false;
+  uint8_t oldest = (ring.head + TRACE_RING_SIZE - ring.count) % TRACE_RING_SIZE;
+  *record = ring.records[(oldest + index) % TRACE_RING_SIZE];
+  return true;
+}
+
+// The records, oldest first, as hex of their (little endian) bytes - as many whole records as fit.
+size_t Trace::populateMsg(char* msg, size_t length) {
+  static const char digits[] = "0123456789abcdef";
+  TraceRecord record;
+  size_t nchars = 0;
+  if (length == 0) return 0;
+  uint8_t first = (ring.count * 2 * sizeof(TraceRecord) < length) ? 0 :
+                  ring.count - (length - 1) / (2 * sizeof(TraceRecord));
+  for (uint8_t i=first; i < ring.count; i++) {
+    populateRecord(i, &record);
+    const uint8_t* bytes = (const uint8_t*) &record;
+    for (size_t j=0; j < sizeof(record); j++) {
+      msg[nchars++] = digits[bytes[j] >> 4];
+      msg[nchars++] = digits[bytes[j] & 0x0F];
+    }
+  }
+  msg[nchars] = 0;
+  return nchars;
+}
+
+static int hexValue(char c) {
+  if (c >= '0' && c <= '9') return c - '0';
+  if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+  if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+  return -1;
+}
+
+// Decodes the output of populateMsg, returning the number of records.
+size_t Trace::fromMsg(const char* msg, TraceRecord* records, size_t maxRecords) {
+  size_t n = 0;
+  while (n < maxRecords) {
+    uint8_t* bytes = (uint8_t*) &records[n];
+    for (size_t j=0; j < sizeof(TraceRecord); j++) {
+      int high = hexValue(msg[0]);
+      int low = high < 0 ? -1 : hexValue(msg[1]);
+      if (low < 0) return n;
+      bytes[j] = (high << 4) | low;
+      msg += 2;
+    }
+    n++;
+  }
+  return n;
+}
+
+void Trace::clear() {
+  memset(&ring, 0, sizeof(ring));
+  ring.magic = TRACE_MAGIC;
+  Espx::rtcUserMemoryWrite(TRACE_OFFSET, (uint32_t*) &ring, sizeof(ring));
+}
+
+#endif // WAKE_TRACE
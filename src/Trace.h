@@ -0,0 +1,85 @@
+// MIT License
+
+// Low Power Sampler Trace - a record of the scheduling decision of each wake, held in RTC memory.
+// Copyright (c) 2021 Simon Chinnick
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "Configuration.h"
+
+// Flags: what was due on the wake, and how the next wake was asked for.
+#define TRACE_SAMPLE      WAKE_SAMPLE
+#define TRACE_MEASUREMENT WAKE_MEASUREMENT
+#define TRACE_TRANSMIT    WAKE_TRANSMIT
+#define TRACE_EVENT       0x08    // external wake - the rest of the interrupted sleep.
+#define TRACE_SLOT        0x10    // power on wait for the transmit slot, or wait for the active window.
+#define TRACE_RADIO       0x20    // next wake has the radio on.
+#define TRACE_RF_CAL      0x40    // ... with a full RF calibration.
+#define TRACE_OVERRUN     0x80    // cut short by the awake-time budget.
+
+// Compiled in only with -D WAKE_TRACE, which also sets aside the RTC memory for the ring.
+#ifdef WAKE_TRACE
+
+#define TRACE_MAGIC 0x7ACE
+// Ring lives in RTC user memory after the Log ring and transport statistics.
+#define TRACE_OFFSET (OTA_OFFSET + (sizeof(RtcData) + 3) / 4 + RTC_LOG_TRANSPORT_SIZE / 4)
+
+typedef struct {
+  uint16_t counter;
+  uint8_t  flags;
+  uint8_t  reserved;
+  uint32_t nominalSleepTime;  // ms the schedule called for.
+  int32_t  correctionTime;    // ms taken off it: offset from synchronise or the slot, plus time awake.
+  uint32_t sleepTime;         // ms asked of deepsleep, after drift calibration.
+} TraceRecord;
+
+typedef struct {
+  uint16_t magic;
+  uint8_t  head;
+  uint8_t  count;
+  TraceRecord records[TRACE_RING_SIZE];
+} TraceRing;
+
+static_assert(sizeof(TraceRecord) == 16, "TraceRecord is shipped as 16 bytes");
+static_assert(sizeof(TraceRing) == RTC_TRACE_SIZE, "TraceRing does not match RTC_TRACE_SIZE");
+static_assert(TRACE_OFFSET * 4 + sizeof(TraceRing) <= DNS_OFFSET * 4, "TraceRing does not fit in RTC memory");
+
+class Trace {
+
+    private:
+    static TraceRing ring;
+
+    public:
+    static void begin();
+    static void write(const TraceRecord* record);
+    static uint8_t getCount();
+    static bool populateRecord(uint8_t index, TraceRecord* record);
+    static size_t populateMsg(char* msg, size_t length);
+    static size_t fromMsg(const char* msg, TraceRecord* records, size_t maxRecords);
+    static void clear();
+};
+
+#endif // WAKE_TRACE
+
+#endif // TRACE_H
@@ -0,0 +1,301 @@
+#include <stdlib.h>
+#include <string.h>
+#include "Espx.h"
+#include <Arduino.h>
+
+#include "Transport.h"
+#include "Format.h"
+
+// =============== Transport ===============================================================
+
+bool Transport::loop() {
+  return false;
+}
+
+void Transport::disconnect() {
+}
+
+bool Transport::send(const uint8_t* payload, size_t length) {
+  BytesPayload bytes(payload, length);
+  return send(bytes);
+}
+
+void Transport::onReceive(ReceiveCallBack fnReceive) {
+  this->cbReceive = fnReceive;
+}
+
+// =============== MQTT ====================================================================
+
+MqttTransport::MqttTransport(PubSubClient& client, const char* server, uint16_t port, const char* clientId,
+                             const char* outTopic, const char* inTopic) {
+  this->client = &client;
+  this->server = server;
+  this->port = port;
+  this->clientId = clientId;
+  this->outTopic = outTopic;
+  this->inTopic = inTopic;
+  this->retainedPending = false;
+}
+
+TransportType MqttTransport::getType() {
+  return TRANSPORT_MQTT;
+}
+
+Delivery MqttTransport::getDelivery() {
+  return DELIVERY_ACKNOWLEDGED;
+}
+
+// The broker's address comes from the DNS cache. If that one fails it is looked up again before
+// the next attempt, as is one that could not be looked up at all.
+bool MqttTransport::connect() {
+  IPAddress address;
+  bool cached = false;
+  bool resolved = Espx::hostByName(this->server, address, &cached);
+  if (resolved) this->client->setServer(address, this->port);
+  uint32_t start = millis();
+  bool connected = resolved && this->client->connect(this->clientId);
+  while (!connected && millis() - start < MS_WAIT_TIME_FOR_MQTT) {
+    delay(MS_DELAY_FOR_MQTT_CONNECTION);
+    if (!resolved || cached) {
+      if (cached) Espx::forgetHost(this->server);
+      resolved = Espx::hostByName(this->server, address, &cached);
+      if (resolved) this->client->setServer(address, this->port);
+    }
+    connected = resolved && this->client->connect(this->clientId);
+  }
+  this->retainedPending = false;
+  if (connected && this->inTopic) {
+    this->client->setCallback([this](char* topic, uint8_t* payload, unsigned int length) {
+      this->retainedPending = false;
+      if (length > 0 && this->cbReceive) this->cbReceive(payload, length);
+    });
+    // The broker sends any retained config on subscribing, ahead of the empty (not retained)
+    // marker published after it, so receiving either means nothing more is coming.
+    this->retainedPending = this->client->subscribe(this->inTopic) &&
+                            this->client->publish(this->inTopic, (const uint8_t*) "", 0);
+  }
+  return connected;
+}
+
+// Written straight into the client, so the payload need not fit PubSubClient's buffer.
+bool MqttTransport::send(Payload& payload) {
+  if (!this->client->beginPublish(this->outTopic, payload.getLength(), false)) return false;
+  PayloadWriter writer(this->client);
+  payload.writeTo(writer);
+  return this->client->endPublish() && !writer.hasFailed();
+}
+
+// True until the retained config, or the end of retained marker, has arrived.
+bool MqttTransport::loop() {
+  return this->client->loop() && this->retainedPending;
+}
+
+void MqttTransport::disconnect() {
+  this->client->disconnect();
+}
+
+// =============== HTTP ====================================================================
+
+HttpTransport::HttpTransport(Client& client, const char* host, uint16_t port, const char* path) {
+  this->client = &client;
+  this->host = host;
+  this->port = port;
+  this->path = path;
+}
+
+TransportType HttpTransport::getType() {
+  return TRANSPORT_HTTP;
+}
+
+Delivery HttpTransport::getDelivery() {
+  return DELIVERY_ACKNOWLEDGED;
+}
+
+// Through the DNS cache, looking the host up again if its cached address fails.
+bool HttpTransport::connect() {
+  IPAddress address;
+  bool cached = false;
+  if (Espx::hostByName(this->host, address, &cached) && this->client->connect(address, this->port)) return true;
+  if (!cached) return false;
+  Espx::forgetHost(this->host);
+  return Espx::hostByName(this->host, address) && this->client->connect(address, this->port);
+}
+
+// POST the payload and wait for the status; a 2xx response body is passed to the receive callback.
+bool HttpTransport::send(Payload& payload) {
+  char header[HTTP_HEADER_SIZE];
+  size_t n = Format::text(header, sizeof(header), "POST ");
+  n += Format::text(header + n, sizeof(header) - n, this->path);
+  n += Format::text(header + n, sizeof(header) - n, " HTTP/1.1\r\nHost: ");
+  n += Format::text(header + n, sizeof(header) - n, this->host);
+  n += Format::text(header + n, sizeof(header) - n, "\r\nContent-Type: ");
+  n += Format::text(header + n, sizeof(header) - n, payload.isBinary() ? "application/octet-stream" : "application/json");
+  n += Format::text(header + n, sizeof(header) - n, "\r\nContent-Length: ");
+  n += Format::number(header + n, sizeof(header) - n, payload.getLength());
+  n += Format::text(header + n, sizeof(header) - n, "\r\nConnection: close\r\n\r\n");
+  if (n >= sizeof(header) - 1) return false;
+  if (this->client->write((const uint8_t*) header, n) != n) return false;
+  PayloadWriter writer(this->client);
+  payload.writeTo(writer);
+  if (writer.hasFailed()) return false;
+
+  uint32_t start = millis();
+  char line[HTTP_BODY_SIZE];
+  if (readLine(line, sizeof(line), start) == 0 || strncmp(line, "HTTP/1.", 7) != 0) return false;
+  int status = atoi(line + 9);
+  if (status < 200 || status > 299) return false;
+
+  size_t contentLength = 0;
+  while (readLine(line, sizeof(line), start) > 0) {
+    if (strncasecmp(line, "Content-Length:", 15) == 0) contentLength = atoi(line + 15);
+  }
+  if (contentLength > 0 && this->cbReceive) {
+    size_t i = 0;
+    int c;
+    while (i < contentLength && i < sizeof(line) - 1 && (c = readByte(start)) >= 0) line[i++] = (char) c;
+    line[i] = 0;
+    this->cbReceive((uint8_t*) line, i);
+  }
+  return true;
+}
+
+void HttpTransport::disconnect() {
+  this->client->stop();
+}
+
+int HttpTransport::readByte(uint32_t start) {
+  while (!this->client->available()) {
+    if (!this->client->connected() || millis() - start >= MS_WAIT_TIME_FOR_HTTP) return -1;
+    delay(1);
+  }
+  return this->client->read();
+}
+
+// Reads up to the next CRLF, which is dropped. Returns the length of the line.
+size_t HttpTransport::readLine(char* line, size_t length, uint32_t start) {
+  size_t i = 0;
+  int c;
+  while ((c = readByte(start)) >= 0 && c != '\n') {
+    if (c != '\r' && i < length - 1) line[i++] = (char) c;
+  }
+  line[i] = 0;
+  return i;
+}
+
+// =============== UDP =====================================================================
+
+UdpTransport::UdpTransport(UDP& udp, const char* host, uint16_t port) {
+  this->udp = &udp;
+  this->host = host;
+  this->port = port;
+}
+
+TransportType UdpTransport::getType() {
+  return TRANSPORT_UDP;
+}
+
+Delivery UdpTransport::getDelivery() {
+  return DELIVERY_BEST_EFFORT;
+}
+
+bool UdpTransport::connect() {
+  return true;
+}
+
+bool UdpTransport::send(Payload& payload) {
+  if (!this->udp->beginPacket(this->host, this->port)) return false;
+  PayloadWriter writer(this->udp);
+  payload.writeTo(writer);
+  return this->udp->endPacket() && !writer.hasFailed();
+}
+
+// =============== Selection ===============================================================
+
+TransportSelector::TransportSelector() {
+  this->nTransports = 0;
+  this->sentAt = 0;
+  memset(&this->stats, 0, sizeof(this->stats));
+  this->stats.magic = TRANSPORT_MAGIC;
+}
+
+void TransportSelector::begin() {
+  if (!Espx::rtcUserMemoryRead(TRANSPORT_OFFSET, (uint32_t*) &this->stats, sizeof(this->stats)) ||
+      this->stats.magic != TRANSPORT_MAGIC) {
+    memset(&this->stats, 0, sizeof(this->stats));
+    this->stats.magic = TRANSPORT_MAGIC;
+    Espx::rtcUserMemoryWrite(TRANSPORT_OFFSET, (uint32_t*) &this->stats, sizeof(this->stats));
+  }
+}
+
+bool TransportSelector::add(Transport* transport) {
+  if (this->nTransports >= MAX_TRANSPORTS) return false;
+  this->transports[this->nTransports++] = transport;
+  return true;
+}
+
+uint32_t TransportSelector::getCost(TransportType type) {
+  return (uint32_t) this->stats.latency[type].connectMs + this->stats.latency[type].sendMs;
+}
+
+// A transport that has never been measured costs nothing, so each is tried once.
+int8_t TransportSelector::cheapest(Delivery required, const bool* tried) {
+  int8_t best = -1;
+  for (uint8_t i=0; i < this->nTransports; i++) {
+    if (tried[i] || this->transports[i]->getDelivery() < required) continue;
+    if (best < 0 || getCost(this->transports[i]->getType()) < getCost(this->transports[best]->getType())) best = i;
+  }
+  return best;
+}
+
+Transport* TransportSelector::select(Delivery required) {
+  bool tried[MAX_TRANSPORTS] = {false};
+  int8_t i = cheapest(required, tried);
+  return (i < 0) ? NULL : this->transports[i];
+}
+
+// Returns the transport that delivered the payload, still connected so any response can be
+// received, or NULL if none could.
+Transport* TransportSelector::send(Payload& payload, Delivery required) {
+  bool tried[MAX_TRANSPORTS] = {false};
+  int8_t i;
+  while ((i = cheapest(required, tried)) >= 0) {
+    Transport* transport = this->transports[i];
+    tried[i] = true;
+    uint32_t start = millis();
+    bool connected = transport->connect();
+    uint32_t connectMs = millis() - start;
+    this->sentAt = millis();
+    bool sent = connected && transport->send(payload);
+    record(transport->getType(), sent ? connectMs : TRANSPORT_FAILURE_MS, millis() - start - connectMs);
+    if (sent) return transport;
+    transport->disconnect();
+  }
+  return NULL;
+}
+
+Transport* TransportSelector::send(const uint8_t* payload, size_t length, Delivery required) {
+  BytesPayload bytes(payload, length);
+  return send(bytes, required);
+}
+
+// A reply that carries the server's time can be taken back to the moment the payload was sent
+// (by HTTP, the reply arrives within send()).
+uint32_t TransportSelector::getSentAt() {
+  return this->sentAt;
+}
+
+// Smooth over the last few transmits. A failure costs TRANSPORT_FAILURE_MS to connect however
+// quickly it failed, so a refused connection does not make a transport the cheapest.
+void TransportSelector::record(TransportType type, uint32_t connectMs, uint32_t sendMs) {
+  TransportLatency* latency = &this->stats.latency[type];
+  if (connectMs > UINT16_MAX) connectMs = UINT16_MAX;
+  if (sendMs > UINT16_MAX) sendMs = UINT16_MAX;
+  bool measured = latency->connectMs != 0 || latency->sendMs != 0;
+  latency->connectMs = measured ? (3 * (uint32_t) latency->connectMs + connectMs) / 4 : connectMs;
+  latency->sendMs = measured ? (3 * (uint32_t) latency->sendMs + sendMs) / 4 : sendMs;
+  Espx::rtcUserMemoryWrite(TRANSPORT_OFFSET, (uint32_t*) &this->stats, sizeof(this->stats));
+}
+
+void TransportSelector::populateLatency(TransportType type, TransportLatency* latency) {
+  *latency = this->stats.latency[type];
+}
@@ -0,0 +1,181 @@
+// MIT License
+
+// Low Power Sampler Transport - MQTT, HTTP POST and UDP behind one interface.
+// Copyright (c) 2021 Simon Chinnick
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#ifndef TRANSPORT_H
+#define TRANSPORT_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <functional>
+#include "Espx.h"
+#include <PubSubClient.h>
+#include "Configuration.h"
+#include "Log.h"
+#include "Payload.h"
+
+#ifndef MS_WAIT_TIME_FOR_MQTT
+#define MS_WAIT_TIME_FOR_MQTT        10000
+#endif
+#ifndef MS_DELAY_FOR_MQTT_CONNECTION
+#define MS_DELAY_FOR_MQTT_CONNECTION   500
+#endif
+#ifndef MS_WAIT_TIME_FOR_HTTP
+#define MS_WAIT_TIME_FOR_HTTP         5000
+#endif
+#define HTTP_HEADER_SIZE 160
+#define HTTP_BODY_SIZE   256
+
+#define MAX_TRANSPORTS 3
+#define TRANSPORT_FAILURE_MS UINT16_MAX   // the connect time recorded for a failed attempt.
+#define TRANSPORT_MAGIC 0x7A5C
+// Latency statistics live in RTC user memory immediately after the Log ring.
+#define TRANSPORT_OFFSET (LOG_OFFSET + (sizeof(LogRing) + 3) / 4)
+
+enum TransportType {
+    TRANSPORT_UDP,
+    TRANSPORT_HTTP,
+    TRANSPORT_MQTT
+};
+
+enum Delivery {
+    DELIVERY_BEST_EFFORT,   // Sent, but nothing comes back to say it arrived.
+    DELIVERY_ACKNOWLEDGED   // The server has confirmed receipt.
+};
+
+typedef struct {
+  uint16_t connectMs;
+  uint16_t sendMs;
+} TransportLatency;
+
+typedef struct {
+  uint16_t magic;
+  uint16_t reserved;
+  TransportLatency latency[MAX_TRANSPORTS];   // indexed by TransportType, 0 if never measured.
+} TransportStats;
+
+static_assert((TRANSPORT_OFFSET - LOG_OFFSET) * 4 + sizeof(TransportStats) <= RTC_LOG_TRANSPORT_SIZE,
+              "TransportStats does not fit in RTC_LOG_TRANSPORT_SIZE");
+
+using ReceiveCallBack = std::function<void(uint8_t*, size_t)>;
+
+class Transport {
+
+    protected:
+    ReceiveCallBack cbReceive;
+
+    public:
+    virtual ~Transport() {}
+    virtual TransportType getType() = 0;
+    virtual Delivery getDelivery() = 0;
+    virtual bool connect() = 0;
+    virtual bool send(Payload& payload) = 0;
+    bool send(const uint8_t* payload, size_t length);
+    virtual bool loop();                // true while more messages may arrive.
+    virtual void disconnect();
+    void onReceive(ReceiveCallBack fnReceive);
+};
+
+class MqttTransport : public Transport {
+
+    private:
+    PubSubClient* client;
+    const char* server;
+    uint16_t port;
+    const char* clientId;
+    const char* outTopic;
+    const char* inTopic;
+    bool retainedPending;
+
+    public:
+    MqttTransport(PubSubClient& client, const char* server, uint16_t port, const char* clientId,
+                  const char* outTopic, const char* inTopic = NULL);
+    TransportType getType();
+    Delivery getDelivery();
+    bool connect();
+    using Transport::send;
+    bool send(Payload& payload);
+    bool loop();
+    void disconnect();
+};
+
+class HttpTransport : public Transport {
+
+    private:
+    Client* client;
+    const char* host;
+    uint16_t port;
+    const char* path;
+    int readByte(uint32_t start);
+    size_t readLine(char* line, size_t length, uint32_t start);
+
+    public:
+    HttpTransport(Client& client, const char* host, uint16_t port, const char* path = "/");
+    TransportType getType();
+    Delivery getDelivery();
+    bool connect();
+    using Transport::send;
+    bool send(Payload& payload);
+    void disconnect();
+};
+
+class UdpTransport : public Transport {
+
+    private:
+    UDP* udp;
+    const char* host;
+    uint16_t port;
+
+    public:
+    UdpTransport(UDP& udp, const char* host, uint16_t port);
+    TransportType getType();
+    Delivery getDelivery();
+    bool connect();
+    using Transport::send;
+    bool send(Payload& payload);
+};
+
+// Picks the transport with the lowest observed connect + send time that gives the delivery asked
+// for, falling back to the next cheapest if it fails.
+class TransportSelector {
+
+    private:
+    Transport* transports[MAX_TRANSPORTS];
+    uint8_t nTransports;
+    TransportStats stats;
+    uint32_t sentAt;
+    void record(TransportType type, uint32_t connectMs, uint32_t sendMs);
+    int8_t cheapest(Delivery required, const bool* tried);
+
+    public:
+    TransportSelector();
+    void begin();
+    bool add(Transport* transport);
+    uint32_t getCost(TransportType type);
+    Transport* select(Delivery required);
+    Transport* send(Payload& payload, Delivery required);
+    Transport* send(const uint8_t* payload, size_t length, Delivery required);
+    uint32_t getSentAt();               // millis() as the last payload started to go out.
+    void populateLatency(TransportType type, TransportLatency* latency);
+};
+
+#endif // TRANSPORT_H
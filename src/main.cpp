@@ -5,6 +5,14 @@
 #include "private.h"
 #include "Configuration.h"
 #include "Sampler.h"
+#include "Log.h"
+#include "Format.h"
+#include "Trace.h"
+#include "Rollup.h"
+#include "Alarm.h"
+#include "Payload.h"
+#include "Transport.h"
+#include "Ntp.h"
 
 #if defined(ESP8266)
 #define SENSOR_PIN D6
@@ -12,162 +20,261 @@
 #define SENSOR_PIN 34
 #endif
 #define MSG_SIZE 250
-#define NTP_PACKET_SIZE 48
+#if defined(ROLLUPS) && defined(ALARMS)
+#define BINARY_PAYLOAD_FORMAT 4       // first byte of a -D BINARY_PAYLOAD message: rollups, then alarms, follow the trace.
+#elif defined(ALARMS)
+#define BINARY_PAYLOAD_FORMAT 3       // first byte of a -D BINARY_PAYLOAD message: alarms follow the trace.
+#elif defined(ROLLUPS)
+#define BINARY_PAYLOAD_FORMAT 2       // first byte of a -D BINARY_PAYLOAD message: rollups follow the trace.
+#else
+#define BINARY_PAYLOAD_FORMAT 1       // first byte of a -D BINARY_PAYLOAD message.
+#endif
+#define BINARY_ALERT_FORMAT 16        // first byte of a -D BINARY_PAYLOAD alert (-D ALARMS).
 
 #define VERSION 104
-#define MS_DELAY_FOR_WIFI_CONNECTION   500
-#define MS_DELAY_FOR_MQTT_CONNECTION   500
-#define MS_DELAY_FOR_MQTT_RECEIVE      500
-#define MS_DELAY_FOR_NTP_RESPONSE      100
+#define MS_DELAY_FOR_WIFI_CONNECTION    50  // Association may be nearly done by the time it is waited for.
+#define MS_DELAY_FOR_MQTT_RECEIVE       50
+#define MS_DELAY_FOR_NTP_RESPONSE       10  // The reply is timed when it is read.
 #define MS_WAIT_TIME_FOR_MESSAGES    10000
 #define MS_WAIT_TIME_FOR_WIFI        10000
-#define MS_WAIT_TIME_FOR_MQTT        10000
+#define RF_CAL_INTERVAL                 24  // Radio wakes between full RF calibrations.
+#define DEFAULT_MEASUREMENT_INTERVAL 180000  // Default parameters - used first time round.
+#define DEFAULT_SAMPLE_INTERVAL       5000
+#define DEFAULT_N_SAMPLES                5
+#define DEFAULT_TRANSMIT_FREQUENCY       1
+#define MS_AWAKE_BUDGET_SAMPLE        1000  // Longest a wake may take before it is cut short.
+#define MS_AWAKE_BUDGET_MEASUREMENT   1000
+#define MS_AWAKE_BUDGET_TRANSMIT     (MS_WAIT_TIME_FOR_WIFI + MS_WAIT_TIME_FOR_MESSAGES + 5000)
+#ifndef NTP_QUERIES
+#define NTP_QUERIES                      1  // More take the reply with the least delay.
+#endif
+#ifndef ROLLUP_LOW_POWER_MILLIVOLTS
+#define ROLLUP_LOW_POWER_MILLIVOLTS   3000  // Below this only the daily rollups are sent (-D ROLLUPS).
+#endif
+#ifndef TRANSMIT_DELIVERY
+#define TRANSMIT_DELIVERY DELIVERY_ACKNOWLEDGED
+#endif
+
+static_assert(Configuration::fitsData(DEFAULT_N_SAMPLES, DEFAULT_TRANSMIT_FREQUENCY),
+              "The default schedule does not fit MAX_DATA_ELEMENTS in this build");
+
+enum LogCode {
+  LOG_WIFI_FAILED = 1,
+  LOG_NTP_DNS_FAILED,
+  LOG_NTP_NO_RESPONSE,
+  LOG_MQTT_FAILED,          // No longer written - the codes are stored, so keep the numbering.
+  LOG_PUBLISH_FAILED,
+  LOG_CONFIG_UPDATED,
+  LOG_UPDATE_FAILED,
+  LOG_UPDATE_NONE,
+  LOG_UPDATE_OK,
+  LOG_NTP_RECEIVED,
+  LOG_SAMPLE,
+  LOG_MEASUREMENT,
+  LOG_SERVER_TIME_RECEIVED
+};
 
 WiFiClient espClient;
 WiFiUDP udpClient;
+NtpClient ntp(udpClient);
 PubSubClient mqttClient(espClient);
+MqttTransport mqttTransport(mqttClient, MQTT_SERVER, MQTT_PORT, MQTT_CLIENT_ID, MQTT_OUT_TOPIC, MQTT_IN_TOPIC);
+#ifdef HTTP_SERVER
+WiFiClient httpClient;
+HttpTransport httpTransport(httpClient, HTTP_SERVER, HTTP_PORT, HTTP_PATH);
+#endif
+#ifdef UDP_SERVER
+WiFiUDP dataUdp;
+UdpTransport udpTransport(dataUdp, UDP_SERVER, UDP_PORT);
+#endif
+TransportSelector transports;
 Configuration config;
-Sampler sampler(config);
-char msg[MSG_SIZE];                   // buffer to hold outgoing debug/mqtt messages.
-byte NTPBuffer[NTP_PACKET_SIZE];      // buffer to hold incoming and outgoing ntp packets.
+
+uint16_t takeSample();
+uint16_t takeMeasurement(uint16_t * sample, uint32_t n);
+void transmit(uint16_t * measurement, uint32_t n, uint32_t baseTime, uint16_t * deltas);
+void startWifi();
+void alert(uint8_t rules);
+
+// The callbacks are bound at compile time, so there is no std::function to allocate or call through.
+struct Sensor : SamplerPolicy {
+  void startRadio() {
+    ::startWifi();
+  }
+#ifdef ALARMS
+  void alert(uint8_t rules) {
+    ::alert(rules);
+  }
+#endif
+  bool takeSample(uint16_t& sample) {
+    sample = ::takeSample();
+    return true;
+  }
+  bool takeMeasurement(uint16_t* samples, uint32_t n, uint16_t& measurement) {
+    measurement = ::takeMeasurement(samples, n);
+    return true;
+  }
+  bool timestamps() { return true; }
+  void transmitTimestamped(uint16_t* measurements, uint32_t n, uint32_t baseTime, uint16_t* deltas) {
+    ::transmit(measurements, n, baseTime, deltas);
+  }
+};
+BasicSampler<Sensor> sampler(config);
+char msg[MSG_SIZE];                   // buffer to hold the config acknowledgement.
 IPAddress timeServerIP;               // IP address of NTP server.
 uint16_t currentVersion = VERSION;
+bool configUpdated = false;           // a new config arrived and needs acknowledging.
+bool configUnchanged = false;         // the config received matches the one in RTC memory.
+bool wifiStarted = false;
+unsigned long wifiStartedAt;
 
-void ntpReceiveMsg(byte* ntpBuffer) {
-  unsigned long  NTPTime = 0 ;
-  NTPTime |= (unsigned long) (ntpBuffer[40] << 24);
-  NTPTime |= (unsigned long)(ntpBuffer[41] << 16);
-  NTPTime |= (unsigned long)(ntpBuffer[42] << 8); 
-  NTPTime |= (unsigned long) ntpBuffer[43]; 
-  sampler.synchronise(NTPTime); 
-  Serial.printf("NTP response received, time: %lu\n", NTPTime);
+// Synchronise to the best NTP reply, if there was one.
+bool ntpSynchronise() {
+  uint32_t seconds;
+  uint16_t ms;
+  if (!ntp.populateTime(&seconds, &ms)) return false;
+  sampler.synchronise(seconds, ms);
+  LOG_DEBUG(LOG_NTP_RECEIVED, seconds & 0xFFFF);
+  return true;
 }
 
-void mqttReceiveMsg(char* topic, uint8_t *payload, unsigned int length) {
-  Configuration updateConfig;
-  Serial.printf("\nMessage arrived on: %s:\n", topic);
+#ifdef SYNC_FROM_SERVER
+uint16_t transmitCounter = 0;         // counter of the transmit message a server time reply is for.
+bool serverTimeReceived = false;
+
+// The server's reply to a transmit message, taken on receiving it:
+//   {"time": <seconds since the epoch>, "ms": <milliseconds>, "counter": <counter of the message>}
+// False if the message is something else.
+bool serverTimeReceiveMsg(const char* json) {
+  uint32_t seconds, ms = 0, counter;
+  if (!Format::findUnsigned(json, "time", &seconds)) return false;
+  Format::findUnsigned(json, "ms", &ms);
+  if (Format::findUnsigned(json, "counter", &counter) && counter == transmitCounter && ms < 1000) {
+    sampler.synchroniseRoundTrip(seconds, ms, millis() - transports.getSentAt());
+    serverTimeReceived = true;
+    LOG_DEBUG(LOG_SERVER_TIME_RECEIVED, seconds & 0xFFFF);
+  }
+  return true;
+}
+#endif
+
+void configReceiveMsg(uint8_t *payload, size_t length) {
   char configJson[MAX_EXPECTED_CONFIG_STRING];
+  if (length >= MAX_EXPECTED_CONFIG_STRING) return;
   for (unsigned int i=0; i < length; i++) {
-    Serial.print((char) payload[i]);
     configJson[i] = (char) payload[i];
   }
   configJson[length] =0;
-  updateConfig.fromMemory();
-  updateConfig.fromJson(configJson);
-  if (!updateConfig.equivalentTo(config)) {
-    config.fromJson(configJson);
-    config.populateStatusMsg(msg, MSG_SIZE);
-    Serial.printf("\nUpdated - %s\n",msg);
+#ifdef SYNC_FROM_SERVER
+  if (serverTimeReceiveMsg(configJson)) return;
+#endif
+  if (config.stageJson(configJson)) {
+    configUpdated = true;
+    LOG_INFO(LOG_CONFIG_UPDATED, config.getStagedVersion());
+  } else {
+    configUnchanged = true;
   }
 }
 
-boolean setupWifi() {
-  Serial.printf("\nConnecting to: %s ..", WIFI_SSID);
+// Called by the Sampler at the start of a transmit wake. begin returns straight away, so WiFi
+// associates while the sample and measurement are taken.
+void startWifi() {
+  if (wifiStarted) return;
   WiFi.begin(WIFI_SSID,WIFI_PASSWORD);
+  wifiStarted = true;
+  wifiStartedAt = millis();
+}
 
-  int32_t waitUntil = millis() + MS_WAIT_TIME_FOR_WIFI; 
+boolean setupWifi() {
+  startWifi();
+
+  int32_t waitUntil = wifiStartedAt + MS_WAIT_TIME_FOR_WIFI; 
   boolean connected = WiFi.status() == WL_CONNECTED;
   while (millis() < waitUntil && !connected) {
     delay(MS_DELAY_FOR_WIFI_CONNECTION);
-    Serial.print(".");
     connected = WiFi.status() == WL_CONNECTED;
   }
-  if (connected) {
-    Serial.print("WiFi connected at: ");
-    Serial.println(WiFi.localIP());
-  }
+  if (!connected) LOG_ERROR(LOG_WIFI_FAILED, WiFi.status());
   return connected;
 }
 
 boolean setupNtp() {
   if (WiFi.status() != WL_CONNECTED) return false;
-  Serial.println("Starting UDP");
-  udpClient.begin(123);                          // Start listening for UDP messages on port 123
-
-  boolean ntpServerFound = WiFi.hostByName(NTP_SERVER_NAME, timeServerIP);
-  if(ntpServerFound) {  
-    memset(NTPBuffer, 0, NTP_PACKET_SIZE);       // set all bytes in the buffer to 0
-    NTPBuffer[0] = 0b11100011;                   // Initialize values needed to form NTP request: LI, Version, Mode
-    udpClient.beginPacket(timeServerIP, 123);    // send a packet requesting a timestamp:NTP requests are to port 123
-    udpClient.write(NTPBuffer, NTP_PACKET_SIZE);
-    udpClient.endPacket();    
-    Serial.println("NTP message sent");
+
+  boolean ntpServerFound = Espx::hostByName(NTP_SERVER_NAME, timeServerIP);
+  if(ntpServerFound) {
+    ntp.begin(timeServerIP, NTP_QUERIES);
   } else {
-    Serial.println("DNS lookup failed for NTP");
+    LOG_WARN(LOG_NTP_DNS_FAILED, 0);
   }
   return ntpServerFound;
 }
 
-boolean setupMqtt() {
-  if (WiFi.status() != WL_CONNECTED) return false;
-  mqttClient.setServer(MQTT_SERVER, MQTT_PORT);
-  // Loop until we're reconnected
-  int32_t waitUntil = millis() + MS_WAIT_TIME_FOR_MQTT; 
-  boolean connected = false;
-  while (millis() < waitUntil && !connected) {
-    Serial.print("Attempting MQTT connection...");
-    // Attempt to connect
-    connected = mqttClient.connect(MQTT_CLIENT_ID);
-    if (connected) {
-      Serial.println("connected");
-      mqttClient.setCallback(mqttReceiveMsg);
-      mqttClient.subscribe(MQTT_IN_TOPIC);
-    } else {
-      Serial.printf("failed, rc=%d try again in %d ms",mqttClient.state(),MS_DELAY_FOR_MQTT_CONNECTION);
-      delay(MS_DELAY_FOR_MQTT_CONNECTION);
-    }
-  }
-  return connected;
-}
-
 uint16_t takeSample() {
-  Serial.printf("\nTaking sample...... ");
-  return digitalRead(SENSOR_PIN);
+  uint16_t sample = digitalRead(SENSOR_PIN);
+  LOG_DEBUG(LOG_SAMPLE, sample);
+  return sample;
 }
 
 uint16_t takeMeasurement(uint16_t * sample, uint32_t n) {
-  Serial.printf("\nTaking measurement as mode... ");
   int sum = 0;
   for (unsigned int i=0; i < n; i++) sum += sample[i] > 0? 1: -1;
+  LOG_DEBUG(LOG_MEASUREMENT, sum);
   return (sum > 0)?1:0;
 }
 
-void waitForResponse(bool ntpRequired, bool mqttRequired) {
+// The server time comes after the retained config, so keep polling the transport for it.
+void waitForResponse(bool ntpRequired, bool serverTimeRequired, Transport* transport) {
   int32_t waitUntil = millis() + MS_WAIT_TIME_FOR_MESSAGES;
-  Serial.printf("\nCheck responses %s ",ntpRequired && mqttRequired? "" : (ntpRequired? "for NTP": "for MQTT"));
-  while(millis() < waitUntil && (ntpRequired || mqttRequired)) {
-    if (ntpRequired) {
-      if (udpClient.parsePacket() >= NTP_PACKET_SIZE) {
-        udpClient.read(NTPBuffer, NTP_PACKET_SIZE);
-        ntpReceiveMsg(NTPBuffer);
-        ntpRequired = false;
-      }
+  bool messagesExpected = transport != NULL;
+  serverTimeRequired = serverTimeRequired && transport != NULL;
+  while(millis() < waitUntil && (ntpRequired || messagesExpected || serverTimeRequired)) {
+    if (ntpRequired && ntp.poll()) {
+      ntpSynchronise();
+      ntpRequired = false;
     }
-    if (mqttRequired) mqttClient.loop();
-    if (ntpRequired || mqttRequired) {
-      Serial.printf("%c", ntpRequired && mqttRequired?'.':(ntpRequired?'n':'m'));
+    if (messagesExpected || serverTimeRequired) messagesExpected = transport->loop() && messagesExpected;
+#ifdef SYNC_FROM_SERVER
+    if (serverTimeReceived) serverTimeRequired = false;
+#endif
+    if (configUnchanged) messagesExpected = false;           // No more messages, but still wait for the time.
+    if (ntpRequired || messagesExpected || serverTimeRequired) {
       delay(ntpRequired?MS_DELAY_FOR_NTP_RESPONSE:MS_DELAY_FOR_MQTT_RECEIVE);
     }
   }
-  Serial.println("\nFinished waiting for responses.");
+  if (ntpRequired && !ntpSynchronise()) {   // A burst cut short may still have a reply.
+    LOG_WARN(LOG_NTP_NO_RESPONSE, 0);
+    Espx::forgetHost(NTP_SERVER_NAME);    // Try another server next time.
+  }
 }
 
+// Tell the backend which retained config is now in use. An HTTP response needs no ack.
+void acknowledgeConfig(Transport* transport) {
+  if (transport->getType() != TRANSPORT_MQTT) return;
+  size_t nchars = Format::text(msg, MSG_SIZE, "{\"ack\": ");
+  nchars += Format::number(msg + nchars, MSG_SIZE - nchars, config.getStagedVersion());
+  nchars += Format::text(msg + nchars, MSG_SIZE - nchars, "}");
+  if (!transport->send((uint8_t*) msg, nchars)) LOG_WARN(LOG_PUBLISH_FAILED, 1);
+}
+
+// The update server is asked for by name, not from the DNS cache: httpUpdate sends the host it
+// is given as the Host header, which virtual hosts and any proxy in front of the server need.
 void doUpdate() {
-  Serial.printf("\nPerforming update of firmware.\n");
   ESPhttpUpdate.rebootOnUpdate(false);
   t_httpUpdate_return ret = Espx::httpUpdate(espClient, UPDATE_SERVER, UPDATE_PORT, UPDATE_PATH);
   switch (ret) {
   case HTTP_UPDATE_FAILED:
-    Serial.printf("HTTP_UPDATE_FAILED Error (%d): %s\n", ESPhttpUpdate.getLastError(), ESPhttpUpdate.getLastErrorString().c_str());
+    LOG_ERROR(LOG_UPDATE_FAILED, ESPhttpUpdate.getLastError());
     config.setVersion(currentVersion);
     break;
   
   case HTTP_UPDATE_NO_UPDATES:
-    Serial.println("HTTP_UPDATE_NO_UPDATES");
+    LOG_WARN(LOG_UPDATE_NONE, config.getStagedVersion());
     break;
   
   case HTTP_UPDATE_OK:
-    Serial.println("HTTP_UPDATE_OK");
+    config.applyStaged();
+    LOG_INFO(LOG_UPDATE_OK, config.getVersion());
     config.save();
     ESP.restart();
     break;
@@ -175,55 +282,369 @@ void doUpdate() {
 }
 
 
-void transmit(uint16_t * measurement, uint32_t n) {
-  Serial.printf("\nCommunicating with base... ");
-  setupWifi();
-  bool ntpInitiated = setupNtp();
-  bool mqttConnected = setupMqtt();
+// The transmit message, written field by field straight into whichever transport sends it, so
+// it is not limited to MSG_SIZE. Text by default; -D BINARY_PAYLOAD packs the same fields,
+// little endian, as set out in the README.
+#ifdef ALARMS
+// The rules that fired, each with the reading it last fired on and the times it has fired.
+void writeAlarms(PayloadWriter& writer, uint8_t fired) {
+  uint16_t value;
+  uint8_t count;
+  uint8_t n = 0;
+  for (uint8_t i=0; i < ALARM_RULES; i++) n += (fired >> i) & 1;
+#ifdef BINARY_PAYLOAD
+  writer.u8(n);
+#endif
+  n = 0;
+  for (uint8_t i=0; i < ALARM_RULES; i++) {
+    if (!(fired & (1 << i)) || !Alarm::populateFired(config.getAlarms(), i, &value, &count)) continue;
+#ifdef BINARY_PAYLOAD
+    writer.u8(i);
+    writer.u16(value);
+    writer.u8(count);
+#else
+    if (n++ > 0) writer.text(",");
+    writer.number(i);
+    writer.text(":");
+    writer.number(value);
+    writer.text(":");
+    writer.number(count);
+#endif
+  }
+}
+
+// The short message sent from an alert wake.
+class AlertPayload : public Payload {
+
+  private:
+  uint8_t fired;
+  uint16_t millivolts;
+
+  public:
+  AlertPayload(uint8_t fired, uint16_t millivolts) {
+    this->fired = fired;
+    this->millivolts = millivolts;
+  }
+
+#ifdef BINARY_PAYLOAD
+  bool isBinary() { return true; }
+
+  void writeTo(PayloadWriter& writer) {
+    writer.u8(BINARY_ALERT_FORMAT);
+    writer.u16(config.getVersion());
+    writer.u16(this->millivolts);
+    writer.u16(config.getCounter());
+    writeAlarms(writer, this->fired);
+  }
+#else
+  void writeTo(PayloadWriter& writer) {
+    writer.text("firmware: ");
+    writer.number(config.getVersion());
+    writer.text(", alarms: [");
+    writeAlarms(writer, this->fired);
+    writer.text("], voltage: ");
+    writer.fixed(this->millivolts, 3);
+    writer.text(", counter: ");
+    writer.number(config.getCounter());
+  }
+#endif
+};
+#endif
+
+class MeasurementPayload : public Payload {
+
+  private:
+  uint16_t* measurement;
+  uint32_t n;
+  uint32_t baseTime;
+  uint16_t* deltas;
+  uint16_t millivolts;
+  Parameters params;
+  Synchronisation sync;
+  Overrun overrun;
+  uint8_t nLog;
+  uint8_t nTrace;
+  bool coarse;
+  uint8_t nHours;
+  uint8_t nDays;
+  uint8_t fired;
 
-  float battery = analogRead(A0) / 4096.0;
-  unsigned version = config.getVersion();
-  int nchars = snprintf (msg, MSG_SIZE, "firmware: %u, values:[", version);
-  nchars+= snprintf(msg+nchars, MSG_SIZE - nchars, "%hu", measurement[0]);
-  for (unsigned int i=1; i < n; i++) {
-    nchars+= snprintf(msg+nchars, MSG_SIZE - nchars, ",%hu", measurement[i]);
+#ifdef ROLLUPS
+  void writeRollups(PayloadWriter& writer, RollupTier tier, uint8_t count) {
+    RollupSummary summary;
+    uint32_t start;
+#ifdef BINARY_PAYLOAD
+    writer.u8(count);
+#endif
+    for (uint8_t i=0; i < count; i++) {
+      Rollup::populateSummary(config.getRollups(), tier, i, &summary, &start);
+#ifdef BINARY_PAYLOAD
+      writer.u32(start);
+      writer.u16(summary.min);
+      writer.u16(summary.max);
+      writer.u16(summary.mean);
+      writer.u16(summary.count);
+#else
+      if (i > 0) writer.text(",");
+      writer.number(start);
+      writer.text(":");
+      writer.number(summary.min);
+      writer.text(":");
+      writer.number(summary.max);
+      writer.text(":");
+      writer.number(summary.mean);
+      writer.text(":");
+      writer.number(summary.count);
+#endif
+    }
+  }
+#endif
+
+  public:
+  MeasurementPayload(uint16_t* measurement, uint32_t n, uint32_t baseTime, uint16_t* deltas, uint16_t millivolts) {
+    this->measurement = measurement;
+    this->n = n;
+    this->baseTime = baseTime;
+    this->deltas = deltas;
+    this->millivolts = millivolts;
+    config.populateParameters(&this->params);
+    config.populateSynchronisation(&this->sync);
+    config.populateOverrun(&this->overrun);
+    this->nLog = Log::getCount();
+#ifdef WAKE_TRACE
+    this->nTrace = Trace::getCount();
+#else
+    this->nTrace = 0;
+#endif
+    // On a low battery the raw measurements and hourly rollups stay behind; the daily ones go.
+    this->coarse = false;
+    this->nHours = this->nDays = 0;
+#ifdef ROLLUPS
+    this->coarse = millivolts < ROLLUP_LOW_POWER_MILLIVOLTS;
+    if (this->coarse) this->n = 0;
+    this->nHours = this->coarse ? 0 : Rollup::getCount(config.getRollups(), ROLLUP_HOUR);
+    this->nDays = Rollup::getCount(config.getRollups(), ROLLUP_DAY);
+#endif
+#ifdef ALARMS
+    this->fired = Alarm::getFired(config.getAlarms());
+#else
+    this->fired = 0;
+#endif
   }
-  nchars += snprintf(msg+nchars, MSG_SIZE - nchars,"], voltage: %f",  battery*3.3 );
-  Synchronisation sync; Parameters params;
-  config.populateSynchronisation(&sync);
-  config.populateParameters(&params);
-  snprintf(msg +nchars, MSG_SIZE - nchars, " counter: %hu, syncTime: %u, nominal: %u, factor: %f", 
-            params.counter, sync.syncTime, sync.nominalElapsed, sync.calibrationFactor);
-  if (mqttConnected) {
-    bool published = mqttClient.publish(MQTT_OUT_TOPIC, msg);
-    Serial.printf("Publish %s: %s", published?"succeeded":"failed", msg);
+
+  bool isCoarse() { return this->coarse; }
+
+#ifdef BINARY_PAYLOAD
+  bool isBinary() { return true; }
+
+  void writeTo(PayloadWriter& writer) {
+    writer.u8(BINARY_PAYLOAD_FORMAT);
+    writer.u16(config.getVersion());
+    writer.u16(this->millivolts);
+    writer.u16(this->params.counter);
+    writer.u32(this->sync.syncTime);
+    writer.u32(this->sync.nominalElapsed);
+    writer.u32((uint32_t) this->sync.driftPpm);
+    writer.u16(this->overrun.count);
+    writer.u8(this->overrun.flags);
+    writer.u32(this->baseTime);
+    writer.u16(this->n);
+    for (uint32_t i=0; i < this->n; i++) writer.u16(this->measurement[i]);
+    for (uint32_t i=0; i < this->n; i++) writer.u16(this->deltas[i]);
+    writer.u8(this->nLog);
+    for (uint8_t i=0; i < this->nLog; i++) {
+      LogRecord record;
+      Log::populateRecord(i, &record);
+      writer.u8(record.level);
+      writer.u8(record.code);
+      writer.u16(record.value);
+    }
+    writer.u8(this->nTrace);
+#ifdef WAKE_TRACE
+    for (uint8_t i=0; i < this->nTrace; i++) {
+      TraceRecord record;
+      Trace::populateRecord(i, &record);
+      writer.bytes((const uint8_t*) &record, sizeof(record));
+    }
+#endif
+#ifdef ROLLUPS
+    writeRollups(writer, ROLLUP_HOUR, this->nHours);
+    writeRollups(writer, ROLLUP_DAY, this->nDays);
+#endif
+#ifdef ALARMS
+    writeAlarms(writer, this->fired);
+#endif
+  }
+#else
+  void writeTo(PayloadWriter& writer) {
+    writer.text("firmware: ");
+    writer.number(config.getVersion());
+    writer.text(", values:[");
+    for (uint32_t i=0; i < this->n; i++) {
+      if (i > 0) writer.text(",");
+      writer.number(this->measurement[i]);
+    }
+    writer.text("], time: ");
+    writer.number(this->baseTime);
+    writer.text(", deltas:[");
+    for (uint32_t i=0; i < this->n; i++) {
+      if (i > 0) writer.text(",");
+      writer.number(this->deltas[i]);
+    }
+    writer.text("], voltage: ");
+    writer.fixed(this->millivolts, 3);
+    writer.text(" counter: ");
+    writer.number(this->params.counter);
+    writer.text(", syncTime: ");
+    writer.number(this->sync.syncTime);
+    writer.text(", nominal: ");
+    writer.number(this->sync.nominalElapsed);
+    writer.text(", drift: ");
+    writer.signedNumber(this->sync.driftPpm);
+    if (this->overrun.count > 0) {
+      writer.text(", overruns: ");
+      writer.number(this->overrun.count);
+      writer.text(", overrun: ");
+      writer.number(this->overrun.flags);
+    }
+    if (this->nLog > 0) {
+      writer.text(", log: [");
+      for (uint8_t i=0; i < this->nLog; i++) {
+        LogRecord record;
+        Log::populateRecord(i, &record);
+        if (i > 0) writer.text(",");
+        writer.number(record.level);
+        writer.text(":");
+        writer.number(record.code);
+        writer.text(":");
+        writer.number(record.value);
+      }
+      writer.text("]");
+    }
+#ifdef WAKE_TRACE
+    if (this->nTrace > 0) {
+      writer.text(", trace: ");
+      for (uint8_t i=0; i < this->nTrace; i++) {
+        TraceRecord record;
+        Trace::populateRecord(i, &record);
+        writer.hex((const uint8_t*) &record, sizeof(record));
+      }
+    }
+#endif
+#ifdef ROLLUPS
+    if (this->nHours > 0) {
+      writer.text(", hourly: [");
+      writeRollups(writer, ROLLUP_HOUR, this->nHours);
+      writer.text("]");
+    }
+    if (this->nDays > 0) {
+      writer.text(", daily: [");
+      writeRollups(writer, ROLLUP_DAY, this->nDays);
+      writer.text("]");
+    }
+#endif
+#ifdef ALARMS
+    if (this->fired) {
+      writer.text(", alarms: [");
+      writeAlarms(writer, this->fired);
+      writer.text("]");
+    }
+#endif
+  }
+#endif
+};
+
+void transmit(uint16_t * measurement, uint32_t n, uint32_t baseTime, uint16_t * deltas) {
+  bool wifiConnected = setupWifi();
+  bool ntpInitiated = false;
+#ifdef SYNC_FROM_SERVER
+  transmitCounter = config.getCounter();
+#endif
+
+  uint16_t millivolts = (uint32_t) analogRead(A0) * 3300 / 4096;
+  sampler.setBatteryVoltage(millivolts);
+  MeasurementPayload payload(measurement, n, baseTime, deltas, millivolts);
+  Transport* transport = wifiConnected ? transports.send(payload, TRANSMIT_DELIVERY) : NULL;
+  if (transport) {
+    if (transport->getDelivery() >= DELIVERY_ACKNOWLEDGED) {
+      Log::clear();
+      config.clearOverrun();
+#ifdef WAKE_TRACE
+      Trace::clear();
+#endif
+#ifdef ROLLUPS
+      if (!payload.isCoarse()) Rollup::clear(config.getRollups(), ROLLUP_HOUR);
+      Rollup::clear(config.getRollups(), ROLLUP_DAY);
+#endif
+#ifdef ALARMS
+      Alarm::clear(config.getAlarms());
+#endif
+    }
   } else {
-    Serial.println("Could not publish to mqtt");
+    LOG_ERROR(LOG_PUBLISH_FAILED, 0);
+    sampler.connectionFailed();
   }
-  waitForResponse(ntpInitiated, mqttConnected);
-  if (mqttConnected)  mqttClient.disconnect();
-  if (config.getVersion() > currentVersion) {
+  bool serverTimeExpected = false;
+#ifdef SYNC_FROM_SERVER
+  serverTimeExpected = transport && transport->getDelivery() >= DELIVERY_ACKNOWLEDGED;   // NTP only if UDP delivered.
+#endif
+  // Asked after the publish, so the publish does not add to the round trip.
+  if (wifiConnected && !serverTimeExpected) ntpInitiated = setupNtp();
+  waitForResponse(ntpInitiated, serverTimeExpected, transport);
+  if (transport && configUpdated) acknowledgeConfig(transport);
+  if (transport) transport->disconnect();
+  if (config.getStagedVersion() > currentVersion) {
+    sampler.keepAwake();
     doUpdate();
   }
 }
 
+#ifdef ALARMS
+// An alarm rule fired on the last wake. Send only the alarms, with no waiting for config or time.
+void alert(uint8_t rules) {
+  bool wifiConnected = setupWifi();
+  uint16_t millivolts = (uint32_t) analogRead(A0) * 3300 / 4096;
+  AlertPayload payload(rules, millivolts);
+  Transport* transport = wifiConnected ? transports.send(payload, TRANSMIT_DELIVERY) : NULL;
+  if (transport) {
+    if (transport->getDelivery() >= DELIVERY_ACKNOWLEDGED) Alarm::clear(config.getAlarms());
+    transport->disconnect();
+  } else {
+    LOG_ERROR(LOG_PUBLISH_FAILED, 2);
+  }
+}
+#endif
+
 // ===============  Arduino Pattern ===================================================
 void setup() {
   pinMode(LED_BUILTIN, OUTPUT);     // Switch off the LED
   digitalWrite(LED_BUILTIN,HIGH);
   pinMode(SENSOR_PIN, INPUT);
   pinMode(A0, INPUT);
+#ifdef LOG_SERIAL
   Serial.begin(115200);
-  config.setParameters(180000,5000,5,1);  // Default parameters - used first time round.
+#endif
+  Log::begin();
+#ifdef WAKE_TRACE
+  Trace::begin();
+#endif
+  transports.begin();
+  mqttTransport.onReceive(configReceiveMsg);
+  transports.add(&mqttTransport);
+#ifdef HTTP_SERVER
+  httpTransport.onReceive(configReceiveMsg);
+  transports.add(&httpTransport);
+#endif
+#ifdef UDP_SERVER
+  transports.add(&udpTransport);
+#endif
+  config.setParameters(DEFAULT_MEASUREMENT_INTERVAL, DEFAULT_SAMPLE_INTERVAL, DEFAULT_N_SAMPLES, DEFAULT_TRANSMIT_FREQUENCY);
   config.setVersion(VERSION);
-  boolean isFirstTime = !config.checkMemory();
-  Serial.printf("\nSetup: Configuration taken from %s.", !isFirstTime?"memory":"defaults");
+  config.useRtcMemoryInPlace();
   sampler.setup();
-  sampler.onTakeSample(takeSample);
-  sampler.onTakeMeasurement(takeMeasurement);
-  sampler.onTransmit(transmit);
-  config.populateStatusMsg(msg, MSG_SIZE);
-  Serial.println(msg);
+  sampler.calibrateRadio(RF_CAL_INTERVAL);
+  sampler.slotTransmits(Sampler::slotFor(MQTT_CLIENT_ID));
+  sampler.limitAwakeTime(MS_AWAKE_BUDGET_SAMPLE, MS_AWAKE_BUDGET_MEASUREMENT, MS_AWAKE_BUDGET_TRANSMIT);
   currentVersion = config.getVersion();
 }
 
@@ -0,0 +1,249 @@
+#define ESP8266
+#define Arduino_h
+#define ALARMS
+
+#include <gtest/gtest.h>
+#include "./fake/Esp.h"
+#include "../src/Espx.cpp"
+#include "../src/Format.cpp"
+#include "../src/Configuration.cpp"
+#include "../src/Sampler.cpp"
+#include "../src/Alarm.cpp"
+
+#define HOUR 3600
+
+class AlarmTest : public testing::Test {
+    protected:
+    Alarms alarms;
+
+    virtual void SetUp() {
+        memset(fakeRtc(), 0xDE, sizeof(fakeRtc()));
+        fakeResetInfo().reason = REASON_DEFAULT_RST;
+        fakeRtcTicks() = 0;
+        fakeTicks() = 0;
+        memset(&alarms, 0, sizeof(alarms));
+    }
+
+    virtual void TearDown() {
+        fakeResetInfo().reason = REASON_DEFAULT_RST;
+    }
+
+    void rule(uint8_t i, const char* text) {
+        ASSERT_TRUE(Alarm::parseRule(text, &alarms.rules[i])) << text;
+    }
+
+    void assertFired(uint8_t i, uint16_t value, uint8_t count) {
+        uint16_t firedValue;
+        uint8_t firedCount;
+        ASSERT_TRUE(Alarm::populateFired(&alarms, i, &firedValue, &firedCount));
+        ASSERT_EQ(value, firedValue);
+        ASSERT_EQ(count, firedCount);
+    }
+};
+
+TEST_F(AlarmTest, RulesFitAfterTheData) {
+    ASSERT_EQ(104, MAX_DATA_ELEMENTS);
+    ASSERT_EQ(RTC_HEADER_SIZE + MAX_DATA_ELEMENTS * 2, offsetof(RtcData, alarms));
+}
+
+TEST_F(AlarmTest, ScheduleMustFitTheSmallerDataArea) {
+    Configuration config;
+    Parameters params;
+    config.setParameters(60000, 1000, 5, 3);
+    config.fromJson("{transmitFrequency: 49}");
+    config.populateParameters(&params);
+    ASSERT_EQ(3, params.transmitFrequency);
+    config.fromJson("{transmitFrequency: 48, nSamples: 7}");
+    config.populateParameters(&params);
+    ASSERT_EQ(5, params.nSamples);
+    ASSERT_EQ(3, params.transmitFrequency);
+    config.fromJson("{transmitFrequency: 48, nSamples: 6}");
+    config.populateParameters(&params);
+    ASSERT_EQ(48, params.transmitFrequency);
+}
+
+TEST_F(AlarmTest, ParsesRules) {
+    AlarmRule parsed;
+    ASSERT_TRUE(Alarm::parseRule("m<300~20/600", &parsed));
+    ASSERT_EQ(ALARM_MEASUREMENT, parsed.source);
+    ASSERT_EQ(ALARM_BELOW, parsed.type);
+    ASSERT_EQ(300, parsed.level);
+    ASSERT_EQ(20, parsed.hysteresis);
+    ASSERT_EQ(600, parsed.holdOff);
+
+    ASSERT_TRUE(Alarm::parseRule(" s-50 ", &parsed));
+    ASSERT_EQ(ALARM_SAMPLE, parsed.source);
+    ASSERT_EQ(ALARM_DROP, parsed.type);
+    ASSERT_EQ(0, parsed.hysteresis);
+    ASSERT_EQ(ALARM_DEFAULT_HOLD_OFF, parsed.holdOff);
+
+    ASSERT_TRUE(Alarm::parseRule("", &parsed));
+    ASSERT_EQ(ALARM_NONE, parsed.type);
+
+    const char* bad[] = {"x<3", "m?3", "m<", "m<70000", "m<3~", "m<3 junk", "m>3/"};
+    for (const char* text : bad) {
+        parsed.type = ALARM_ABOVE;
+        ASSERT_FALSE(Alarm::parseRule(text, &parsed)) << text;
+        ASSERT_EQ(ALARM_ABOVE, parsed.type) << text;
+    }
+}
+
+TEST_F(AlarmTest, ThresholdRearmsPastHysteresis) {
+    rule(0, "m<300~20/0");
+    ASSERT_FALSE(Alarm::check(&alarms, ALARM_MEASUREMENT, 350, 0));
+    ASSERT_TRUE(Alarm::check(&alarms, ALARM_MEASUREMENT, 290, 10));
+    ASSERT_FALSE(Alarm::check(&alarms, ALARM_MEASUREMENT, 280, 20));
+    ASSERT_FALSE(Alarm::check(&alarms, ALARM_MEASUREMENT, 310, 30));
+    ASSERT_FALSE(Alarm::check(&alarms, ALARM_MEASUREMENT, 295, 40));
+    ASSERT_FALSE(Alarm::check(&alarms, ALARM_MEASUREMENT, 320, 50));
+    ASSERT_TRUE(Alarm::check(&alarms, ALARM_MEASUREMENT, 299, 60));
+    assertFired(0, 299, 2);
+    ASSERT_FALSE(Alarm::check(&alarms, ALARM_SAMPLE, 100, 70));
+}
+
+TEST_F(AlarmTest, RateOfChangeBetweenReadings) {
+    rule(0, "s-50~10/0");
+    rule(1, "s+100/0");
+    ASSERT_FALSE(Alarm::check(&alarms, ALARM_SAMPLE, 500, 0));
+    ASSERT_FALSE(Alarm::check(&alarms, ALARM_SAMPLE, 480, 0));
+    ASSERT_TRUE(Alarm::check(&alarms, ALARM_SAMPLE, 420, 0));
+    ASSERT_FALSE(Alarm::check(&alarms, ALARM_SAMPLE, 375, 0));     // still dropping by more than 40.
+    ASSERT_FALSE(Alarm::check(&alarms, ALARM_SAMPLE, 370, 0));
+    ASSERT_TRUE(Alarm::check(&alarms, ALARM_SAMPLE, 300, 0));
+    ASSERT_EQ(0x01, Alarm::getFired(&alarms));
+    ASSERT_TRUE(Alarm::check(&alarms, ALARM_SAMPLE, 400, 0));
+    ASSERT_EQ(0x03, Alarm::getFired(&alarms));
+    assertFired(0, 300, 2);
+    assertFired(1, 400, 1);
+}
+
+TEST_F(AlarmTest, StateChangeFiresOnEachTransition) {
+    rule(0, "s!1/0");
+    ASSERT_FALSE(Alarm::check(&alarms, ALARM_SAMPLE, 0, 0));
+    ASSERT_FALSE(Alarm::check(&alarms, ALARM_SAMPLE, 0, 0));
+    ASSERT_TRUE(Alarm::check(&alarms, ALARM_SAMPLE, 1, 0));
+    ASSERT_FALSE(Alarm::check(&alarms, ALARM_SAMPLE, 1, 0));
+    ASSERT_TRUE(Alarm::check(&alarms, ALARM_SAMPLE, 0, 0));
+    assertFired(0, 0, 2);
+}
+
+TEST_F(AlarmTest, HoldOffLimitsAlertsNotCounts) {
+    rule(0, "s!1/3600");
+    Alarm::check(&alarms, ALARM_SAMPLE, 0, 0);
+    ASSERT_TRUE(Alarm::check(&alarms, ALARM_SAMPLE, 1, 100));
+    ASSERT_TRUE(Alarm::isAlertDue(&alarms));
+    Alarm::alerted(&alarms, 100);
+    ASSERT_FALSE(Alarm::isAlertDue(&alarms));
+
+    for (uint32_t t=200; t < 3600; t += 100) ASSERT_FALSE(Alarm::check(&alarms, ALARM_SAMPLE, t / 100 % 2, t));
+    ASSERT_FALSE(Alarm::isAlertDue(&alarms));
+    assertFired(0, 1, 35);
+    ASSERT_TRUE(Alarm::check(&alarms, ALARM_SAMPLE, 0, 100 + HOUR));
+
+    Alarm::clear(&alarms);
+    ASSERT_EQ(0, Alarm::getFired(&alarms));
+    ASSERT_TRUE(Alarm::isAlertDue(&alarms));
+}
+
+TEST_F(AlarmTest, RulesFromJson) {
+    Configuration config;
+    Configuration other;
+    Alarms* alarms = config.getAlarms();
+    config.fromJson("{alarm0: \"m<300~20/600\", alarm1: 's!1', alarm2: 'm>1'}");
+    ASSERT_EQ(ALARM_BELOW, alarms->rules[0].type);
+    ASSERT_EQ(600, alarms->rules[0].holdOff);
+    ASSERT_EQ(ALARM_CHANGE, alarms->rules[1].type);
+    ASSERT_FALSE(config.equivalentTo(other));
+
+    alarms->states[0].fired = 3;
+    alarms->states[1].fired = 2;
+    config.fromJson("{alarm0: 'm<300~20/600', alarm1: 'm<'}");     // the same, and a bad one.
+    ASSERT_EQ(3, alarms->states[0].fired);
+    ASSERT_EQ(ALARM_CHANGE, alarms->rules[1].type);
+    config.fromJson("{alarm1: ''}");
+    ASSERT_EQ(ALARM_NONE, alarms->rules[1].type);
+    ASSERT_EQ(0, alarms->states[1].fired);
+}
+
+TEST_F(AlarmTest, StagedRulesAppliedWithTheRest) {
+    Configuration config;
+    Configuration update;
+    config.save();
+    update.fromMemory();
+    update.fromJson("{alarm1: 'm>500'}");
+    ASSERT_FALSE(update.equivalentTo(config));
+    config.stage(update);
+    ASSERT_EQ(ALARM_NONE, config.getAlarms()->rules[1].type);
+    config.applyStaged();
+    ASSERT_EQ(ALARM_ABOVE, config.getAlarms()->rules[1].type);
+    ASSERT_TRUE(update.equivalentTo(config));
+}
+
+TEST_F(AlarmTest, FiringRuleForcesARadioWakeToAlert) {
+    Configuration config;
+    Sampler sampler(config);
+    uint16_t sample = 500;
+    uint8_t alerted = 0;
+    bool transmitted = false;
+    config.setParameters(60000, 0, 1, 3);
+    config.fromJson("{alarm0: 's-50'}");
+    sampler.onTakeSample([&]() -> uint16_t { return sample; });
+    sampler.onTransmit([&](uint16_t* measurements, uint32_t n) { transmitted = true; });
+    sampler.onAlert([&](uint8_t rules) { alerted = rules; });
+    sampler.setup();
+
+    sampler.loop();
+    ASSERT_EQ(60000000, ESP.getSleepTime());
+    ASSERT_EQ(RF_DISABLED, ESP.getSleepMode());
+
+    // Dropping 100 fires the rule: a short radio wake in place of the sleep.
+    sample = 400;
+    fakeResetInfo().reason = REASON_DEEP_SLEEP_AWAKE;
+    fakeRtcTicks() = 60000000;
+    sampler.setup();
+    sampler.loop();
+    ASSERT_EQ(ALERT_SLEEP_MS * 1000, ESP.getSleepTime());
+    ASSERT_NE(RF_DISABLED, ESP.getSleepMode());
+    ASSERT_EQ(0, alerted);
+    ASSERT_EQ(3, config.getCounter());
+
+    // The alert wake sends it, then sleeps out the rest of the scheduled sleep, radio off.
+    fakeRtcTicks() += ALERT_SLEEP_MS * 1000 + 15000;
+    sampler.setup();
+    sampler.loop();
+    ASSERT_EQ(0x01, alerted);
+    ASSERT_FALSE(transmitted);
+    ASSERT_EQ(3, config.getCounter());
+    ASSERT_EQ(60000000 - ALERT_SLEEP_MS * 1000 - 15000, ESP.getSleepTime());
+    ASSERT_EQ(RF_DEFAULT, ESP.getSleepMode());
+
+    // Back on schedule; a rule firing on a transmit wake goes with the transmit.
+    alerted = 0;
+    sample = 300;
+    fakeRtcTicks() = 180000000;
+    sampler.setup();
+    sampler.loop();
+    ASSERT_TRUE(transmitted);
+    ASSERT_FALSE(Alarm::isAlertDue(config.getAlarms()));
+    ASSERT_EQ(60000000, ESP.getSleepTime());
+
+    fakeRtcTicks() = 240000000;
+    sampler.setup();
+    sampler.loop();
+    ASSERT_EQ(0, alerted);
+}
+
+TEST_F(AlarmTest, PowerOnForgetsStateButKeepsRules) {
+    Configuration config;
+    Sampler sampler(config);
+    config.fromJson("{alarm0: 's>5'}");
+    config.getAlarms()->states[0].fired = 4;
+    sampler.setup();
+    ASSERT_EQ(ALARM_ABOVE, config.getAlarms()->rules[0].type);
+    ASSERT_EQ(0, Alarm::getFired(config.getAlarms()));
+}
+
+int main(int argc, char** argv) {
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
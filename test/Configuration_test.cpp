@@ -4,6 +4,7 @@
 #include <gtest/gtest.h>
 #include "./fake/Esp.h"
 #include "../src/Espx.cpp"
+#include "../src/Format.cpp"
 #include "../src/Configuration.cpp"
 
 
@@ -21,7 +22,7 @@ TEST(ConfigurationTest, Construction) {
     ASSERT_EQ(params.transmitFrequency,0);
 
     config.populateSynchronisation(&sync);
-    ASSERT_FLOAT_EQ(sync.calibrationFactor, 1.0);
+    ASSERT_EQ(sync.driftPpm, 0);
 }
 
 TEST(ConfigurationTest, IncrementCounter) {
@@ -176,7 +177,7 @@ TEST(ConfigurationTest, LoadOneFromJSON) {
     config.fromJson("version: 7");
     config.populateStatusMsg(msg, 250);
     ASSERT_STRCASEEQ(
-        "Version: 7, counter: 1, measurementInterval: 3600000, sampleInterval: 1000, nSamples: 5, transmitFrequency: 3, calibration: 1.000000",
+        "Version: 7, counter: 2, measurementInterval: 3600000, sampleInterval: 1000, nSamples: 5, transmitFrequency: 3, calibration: 1.000000",
         msg);
 
     config.fromJson("transmitFrequency: 7");
@@ -204,6 +205,156 @@ TEST(ConfigurationTest, LoadOneFromJSON) {
         msg);
 }
 
+TEST(ConfigurationTest, JsonKeepsCalibration) {
+    Configuration config;
+    Synchronisation sync;
+
+    config.setParameters(3600000, 1000, 5, 3);
+    config.resetSynchronisation(121343565, -2500);
+    config.incrementElapsed(7200000);
+    config.fromJson("{ measurementInterval: 1800000, nSamples: 4 }");
+    config.populateSynchronisation(&sync);
+    ASSERT_EQ(121343565, sync.syncTime);
+    ASSERT_EQ(7200, sync.nominalElapsed);
+    ASSERT_EQ(-2500, sync.driftPpm);
+}
+
+TEST(ConfigurationTest, JsonKeepsDataStillValid) {
+    Configuration config;
+    uint16_t* data = config.getData();
+
+    config.setParameters(3600000, 1000, 3, 2);
+    config.incrementCounter();
+    data[0] = 17;
+    config.fromJson("{ sampleInterval: 2000, transmitOffset: 5000 }");
+    ASSERT_EQ(2, config.getCounter());
+    ASSERT_EQ(17, data[0]);
+
+    config.fromJson("{ measurementInterval: 1800000 }");
+    ASSERT_EQ(1, config.getCounter());
+    ASSERT_EQ(17, data[0]);
+
+    config.fromJson("{ transmitFrequency: 3 }");
+    ASSERT_EQ(0, data[0]);
+}
+
+TEST(ConfigurationTest, JsonRefusesScheduleThatOverrunsData) {
+    Configuration config;
+    Parameters params;
+    uint16_t* data = config.getData();
+
+    config.setParameters(3600000, 1000, 3, 2);
+    data[0] = 17;
+    config.fromJson("{ nSamples: 98, transmitFrequency: 13, sampleInterval: 2000 }");
+    config.populateParameters(&params);
+    ASSERT_EQ(3, params.nSamples);
+    ASSERT_EQ(2, params.transmitFrequency);
+    ASSERT_EQ(2000, params.sampleInterval);
+    ASSERT_EQ(17, data[0]);
+
+    config.fromJson("{ nSamples: 98, transmitFrequency: 12 }");      // 98 + 2 * 12 + 2 just fits.
+    config.populateParameters(&params);
+    ASSERT_EQ(98, params.nSamples);
+    ASSERT_EQ(12, params.transmitFrequency);
+    ASSERT_FALSE(Configuration::fitsData(65535, 65535));
+}
+
+TEST(ConfigurationTest, SetParametersRefusesScheduleThatOverrunsData) {
+    Configuration config;
+    Parameters params;
+    ASSERT_TRUE(config.setParameters(3600000, 1000, 3, 2));
+    config.incrementCounter();
+    ASSERT_FALSE(config.setParameters(60000, 2000, 98, 13));
+    config.populateParameters(&params);
+    ASSERT_EQ(3600000, params.measurementInterval);
+    ASSERT_EQ(1000, params.sampleInterval);
+    ASSERT_EQ(3, params.nSamples);
+    ASSERT_EQ(2, params.transmitFrequency);
+    ASSERT_EQ(2, params.counter);
+    ASSERT_TRUE(config.setParameters(60000, 2000, 98, 12));
+}
+
+TEST(ConfigurationTest, JsonIgnoresValuesTooLargeForTheirField) {
+    Configuration config;
+    Parameters params;
+    config.setParameters(3600000, 1000, 3, 2);
+    config.setVersion(4);
+    config.fromJson("{ nSamples: 65539, transmitFrequency: 65537, version: 65540, measurementInterval: 4294967296 }");
+    config.populateParameters(&params);
+    ASSERT_EQ(3, params.nSamples);
+    ASSERT_EQ(2, params.transmitFrequency);
+    ASSERT_EQ(4, params.currentVersion);
+    ASSERT_EQ(3600000, params.measurementInterval);
+}
+
+TEST(ConfigurationTest, StagedUpdateAppliedLater) {
+    Configuration config;
+    Configuration update;
+    Parameters params;
+
+    config.setParameters(3600000, 1000, 5, 3);
+    config.setVersion(4);
+    config.incrementCounter();
+    config.resetSynchronisation(121343565, 300);
+    config.save();
+    update.fromMemory();
+    update.fromJson("{ version: 5, sampleInterval: 2000 }");
+    config.stage(update);
+    ASSERT_EQ(4, config.getVersion());
+    ASSERT_EQ(5, config.getStagedVersion());
+    config.populateParameters(&params);
+    ASSERT_EQ(1000, params.sampleInterval);
+
+    config.incrementCounter();
+    ASSERT_TRUE(config.applyStaged());
+    ASSERT_FALSE(config.applyStaged());
+    config.populateParameters(&params);
+    ASSERT_EQ(5, params.currentVersion);
+    ASSERT_EQ(3, params.counter);
+    ASSERT_EQ(2000, params.sampleInterval);
+    ASSERT_EQ(5, params.nSamples);
+}
+
+TEST(ConfigurationTest, JsonStagedWithoutAWholeConfiguration) {
+    Configuration config;
+    Parameters params;
+    ActiveWindow window;
+
+    config.setParameters(3600000, 1000, 5, 3);
+    config.setVersion(4);
+    config.incrementCounter();
+    ASSERT_FALSE(config.stageJson("{ version: 4, nSamples: 5 }"));
+    ASSERT_FALSE(config.applyStaged());
+
+    ASSERT_TRUE(config.stageJson("{ version: 5, sampleInterval: 2000, startTimeOfDay: 3600 }"));
+    ASSERT_EQ(5, config.getStagedVersion());
+    config.populateParameters(&params);
+    ASSERT_EQ(4, params.currentVersion);
+    ASSERT_EQ(1000, params.sampleInterval);
+
+    ASSERT_TRUE(config.applyStaged());
+    config.populateParameters(&params);
+    ASSERT_EQ(5, params.currentVersion);
+    ASSERT_EQ(2, params.counter);
+    ASSERT_EQ(2000, params.sampleInterval);
+    config.populateActiveWindow(&window);
+    ASSERT_EQ(60, window.startMinute);
+    ASSERT_LT(sizeof(ConfigUpdate), 64);
+}
+
+TEST(ConfigurationTest, SetVersionOverridesStagedVersion) {
+    Configuration config;
+    Configuration update;
+
+    config.setVersion(4);
+    update.fromJson("{ version: 5 }");
+    config.stage(update);
+    config.setVersion(4);
+    ASSERT_EQ(4, config.getStagedVersion());
+    config.applyStaged();
+    ASSERT_EQ(4, config.getVersion());
+}
+
 TEST(ConfigurationTest, DontLoadCounterFromJSON) {
     Configuration config;
     char msg[250];
@@ -271,12 +422,12 @@ TEST(ConfigurationTest, ResetSynchronizationSetsMemberData) {
     Configuration config;
     Synchronisation sync;
     
-    config.resetSynchronisation(121343565, 1.0001);
+    config.resetSynchronisation(121343565, 100);
     config.populateSynchronisation(&sync);
 
     ASSERT_EQ(sync.syncTime, 121343565);
     ASSERT_EQ(sync.nominalElapsed, 0);
-    ASSERT_FLOAT_EQ(sync.calibrationFactor, 1.0001);
+    ASSERT_EQ(sync.driftPpm, 100);
 }
 
 TEST(ConfigurationTest, LoadConfigurationLoadsSynchronizationDataFromMemory) {
@@ -284,14 +435,14 @@ TEST(ConfigurationTest, LoadConfigurationLoadsSynchronizationDataFromMemory) {
     Configuration config;
     Configuration loadedConfiguration;
     Synchronisation sync;
-    loadedConfiguration.resetSynchronisation(0, 0.0);
-    config.resetSynchronisation(121343565, 1.0005);
+    loadedConfiguration.resetSynchronisation(0, 0);
+    config.resetSynchronisation(121343565, 500);
     config.incrementElapsed(1200000);
 
     loadedConfiguration.populateSynchronisation(&sync);
     ASSERT_EQ(sync.syncTime, 0);
     ASSERT_EQ(sync.nominalElapsed, 0);
-    ASSERT_FLOAT_EQ(sync.calibrationFactor, 0.0);
+    ASSERT_EQ(sync.driftPpm, 0);
 
     config.save();
 
@@ -303,7 +454,146 @@ TEST(ConfigurationTest, LoadConfigurationLoadsSynchronizationDataFromMemory) {
     loadedConfiguration.populateSynchronisation(&sync);
     ASSERT_EQ(sync.syncTime, 121343565);
     ASSERT_EQ(sync.nominalElapsed, 1200);
-    ASSERT_FLOAT_EQ(sync.calibrationFactor, 1.0005);
+    ASSERT_EQ(sync.driftPpm, 500);
+}
+
+TEST(ConfigurationTest, ResetSynchronizationClampsDrift) {
+    Configuration config;
+    Synchronisation sync;
+
+    config.resetSynchronisation(121343565, 2 * MAX_DRIFT_PPM);
+    config.populateSynchronisation(&sync);
+    ASSERT_EQ(sync.driftPpm, MAX_DRIFT_PPM);
+
+    config.resetSynchronisation(121343565, -2 * MAX_DRIFT_PPM);
+    config.populateSynchronisation(&sync);
+    ASSERT_EQ(sync.driftPpm, -MAX_DRIFT_PPM);
+}
+
+TEST(ConfigurationTest, ElapsedTimeCarriesMillisecondsAndOutlastsFiftyDays) {
+    Configuration config;
+    Synchronisation sync;
+
+    config.resetSynchronisation(121343565, 0);
+    config.incrementElapsed(600);
+    config.incrementElapsed(700);
+    config.populateSynchronisation(&sync);
+    ASSERT_EQ(1, sync.nominalElapsed);
+    ASSERT_EQ(300, sync.elapsedMs);
+
+    for (int i=0; i < 60 * 24; i++) config.incrementElapsed(3600000);
+    config.populateSynchronisation(&sync);
+    ASSERT_EQ(1 + 60 * 86400, sync.nominalElapsed);
+    ASSERT_EQ(300, sync.elapsedMs);
+}
+
+// RTC memory as the first firmware wrote it.
+typedef struct {
+    uint32_t crc32;
+    uint16_t currentVersion;
+    uint16_t counter;
+    uint32_t measurementInterval;
+    uint32_t sampleInterval;
+    uint16_t nSamples;
+    uint16_t transmitFrequency;
+    uint32_t startTimeOfDay;
+    uint32_t syncTime;
+    uint32_t elapsedSeconds;
+    float    calibrationFactor;
+    uint16_t data[160];
+} LegacyRtcData;
+
+static void writeLegacyMemory(float factor) {
+    LegacyRtcData legacy;
+    memset(&legacy, 0x5A, sizeof(legacy));
+    legacy.currentVersion = 3;
+    legacy.counter = 4;
+    legacy.measurementInterval = 180000;
+    legacy.sampleInterval = 5000;
+    legacy.nSamples = 5;
+    legacy.transmitFrequency = 2;
+    legacy.startTimeOfDay = 0;
+    legacy.syncTime = 121343565;
+    legacy.elapsedSeconds = 1200;
+    legacy.calibrationFactor = factor;
+    legacy.crc32 = Configuration::calculateCRC32((uint8_t*) &legacy.currentVersion, 16);
+    ESP.rtcUserMemoryWrite(OTA_OFFSET, (uint32_t*) &legacy, sizeof(legacy));
+}
+
+TEST(ConfigurationTest, LegacyFloatSynchronisationUpgradedOnLoad) {
+    Configuration loadedConfiguration;
+    Parameters params;
+    Synchronisation sync;
+    Wakeup wakeup;
+    writeLegacyMemory(0.9999f);
+
+    ASSERT_TRUE(loadedConfiguration.checkMemory());
+    ASSERT_TRUE(loadedConfiguration.fromMemory());
+    loadedConfiguration.populateParameters(&params);
+    ASSERT_EQ(3, params.currentVersion);
+    ASSERT_EQ(1, params.counter);
+    ASSERT_EQ(180000, params.measurementInterval);
+    ASSERT_EQ(5000, params.sampleInterval);
+    ASSERT_EQ(5, params.nSamples);
+    ASSERT_EQ(2, params.transmitFrequency);
+    ASSERT_EQ(NO_TRANSMIT_OFFSET, params.transmitOffset);
+    loadedConfiguration.populateSynchronisation(&sync);
+    ASSERT_EQ(0, sync.startTimeOfDay);
+    ASSERT_EQ(121343565, sync.syncTime);
+    ASSERT_EQ(1200, sync.nominalElapsed);
+    ASSERT_EQ(-100, sync.driftPpm);
+    loadedConfiguration.populateWakeup(&wakeup);
+    ASSERT_EQ(0, wakeup.sleepDuration);
+    ASSERT_EQ(0, loadedConfiguration.getData()[0]);
+
+    // Saved in the current layout, it loads as is.
+    loadedConfiguration.save();
+    Configuration reloaded;
+    ASSERT_TRUE(reloaded.fromMemory());
+    reloaded.populateSynchronisation(&sync);
+    ASSERT_EQ(-100, sync.driftPpm);
+    ASSERT_EQ(1200, sync.nominalElapsed);
+}
+
+TEST(ConfigurationTest, LegacyMemoryUpgradedInPlace) {
+    Configuration config;
+    Synchronisation sync;
+    writeLegacyMemory(1.0002f);
+
+    config.useRtcMemoryInPlace();
+    ASSERT_TRUE(config.checkMemory());
+    ASSERT_TRUE(config.fromMemory());
+    config.populateSynchronisation(&sync);
+    ASSERT_EQ(200, sync.driftPpm);
+    ASSERT_TRUE(config.checkMemory());
+
+    Configuration copy;
+    ASSERT_TRUE(copy.fromMemory());
+    ASSERT_TRUE(copy.equivalentTo(config));
+}
+
+TEST(ConfigurationTest, LegacyFactorClampedOnUpgrade) {
+    Configuration loadedConfiguration;
+    Synchronisation sync;
+    writeLegacyMemory(3.5f);
+
+    ASSERT_TRUE(loadedConfiguration.fromMemory());
+    loadedConfiguration.populateSynchronisation(&sync);
+    ASSERT_EQ(MAX_DRIFT_PPM, sync.driftPpm);
+    ASSERT_EQ(1200, sync.nominalElapsed);
+    ASSERT_EQ(0, sync.elapsedMs);
+}
+
+TEST(ConfigurationTest, CorruptLegacyMemoryIsNotUpgraded) {
+    Configuration config;
+    Synchronisation sync;
+    writeLegacyMemory(0.9999f);
+    fakeRtc()[OTA_OFFSET * 4 + 6] ^= 1;
+
+    ASSERT_FALSE(config.checkMemory());
+    ASSERT_FALSE(config.fromMemory());
+    config.populateSynchronisation(&sync);
+    ASSERT_NE(-100, sync.driftPpm);
 }
 
 TEST(ConfigurationTest, EquivalencyOnVersion) {
@@ -378,6 +668,132 @@ TEST(ConfigurationTest, EquivalencyIgnoresCounter) {
     ASSERT_TRUE(otherConfig.equivalentTo(config));
 }
 
+TEST(ConfigurationTest, TransmitOffsetFromJsonAffectsEquivalency) {
+    Configuration config;
+    Configuration otherConfig;
+    Parameters params;
+
+    config.setParameters(10000, 1000, 5, 1);
+    otherConfig.setParameters(10000, 1000, 5, 1);
+    config.populateParameters(&params);
+    ASSERT_EQ(NO_TRANSMIT_OFFSET, params.transmitOffset);
+
+    config.fromJson("{ transmitOffset: 7500 }");
+    config.populateParameters(&params);
+    ASSERT_EQ(7500, params.transmitOffset);
+    ASSERT_FALSE(config.equivalentTo(otherConfig));
+
+    otherConfig.fromJson("{ transmitOffset: 7500 }");
+    ASSERT_TRUE(config.equivalentTo(otherConfig));
+}
+
+TEST(ConfigurationTest, RtcDataSizedToPlatformRtcMemory) {
+    ASSERT_LE(OTA_OFFSET * 4 + sizeof(RtcData) + RTC_RESERVED_SIZE, sizeof(fakeRtc()));
+    ASSERT_GT(OTA_OFFSET * 4 + sizeof(RtcData) + RTC_RESERVED_SIZE + sizeof(uint32_t), sizeof(fakeRtc()));
+    ASSERT_EQ(0, sizeof(RtcData) % sizeof(uint32_t));
+    ASSERT_EQ(124, MAX_DATA_ELEMENTS);
+}
+
+TEST(ConfigurationTest, InPlaceFromMemoryUsesRtcWithoutCopying) {
+    Configuration savedConfig;
+    Configuration config;
+    savedConfig.setParameters(9000000, 15000, 5, 2);
+    savedConfig.getData()[3] = 33;
+    savedConfig.save();
+
+    ASSERT_TRUE(config.useRtcMemoryInPlace());
+    ASSERT_TRUE(config.checkMemory());
+    ASSERT_TRUE(config.fromMemory());
+    ASSERT_TRUE(config.equivalentTo(savedConfig));
+    ASSERT_EQ((uint16_t*) &fakeRtc()[OTA_OFFSET * 4 + RTC_HEADER_SIZE], config.getData());
+    ASSERT_EQ(33, config.getData()[3]);
+}
+
+TEST(ConfigurationTest, InPlaceChangesAreWrittenStraightToRtc) {
+    Configuration config;
+    Configuration restoredConfig;
+    config.setParameters(9000000, 15000, 5, 2);
+    config.useRtcMemoryInPlace();
+    config.save();
+
+    // A reset before the next save, e.g. a brownout mid-wake, still finds valid memory.
+    config.incrementCounter();
+    config.getData()[0] = 1234;
+    ASSERT_TRUE(restoredConfig.checkMemory());
+    ASSERT_TRUE(restoredConfig.fromMemory());
+    ASSERT_EQ(2, restoredConfig.getCounter());
+    ASSERT_EQ(1234, restoredConfig.getData()[0]);
+
+    config.fromJson("{ nSamples: 4 }");
+    config.resetCounter();
+    ASSERT_TRUE(restoredConfig.checkMemory());
+    ASSERT_TRUE(restoredConfig.fromMemory());
+    Parameters params;
+    restoredConfig.populateParameters(&params);
+    ASSERT_EQ(4, params.nSamples);
+}
+
+TEST(ConfigurationTest, InPlaceKeepsDefaultsWhenMemoryInvalid) {
+    Configuration config;
+    uint32_t BadNumber = 0xDEADDEAD;
+    ESP.rtcUserMemoryWrite(OTA_OFFSET, &BadNumber, 4);
+    config.setParameters(3600000, 1000, 5, 3);
+    config.useRtcMemoryInPlace();
+
+    ASSERT_FALSE(config.checkMemory());
+    ASSERT_FALSE(config.fromMemory());
+    Parameters params;
+    config.populateParameters(&params);
+    ASSERT_EQ(3600000, params.measurementInterval);
+    ASSERT_NE((uint16_t*) &fakeRtc()[OTA_OFFSET * 4 + RTC_HEADER_SIZE], config.getData());
+
+    config.save();
+    ASSERT_TRUE(config.checkMemory());
+    ASSERT_EQ((uint16_t*) &fakeRtc()[OTA_OFFSET * 4 + RTC_HEADER_SIZE], config.getData());
+}
+
+TEST(ConfigurationTest, InPlaceChecksCrcOnlyOnce) {
+    Configuration savedConfig;
+    Configuration config;
+    savedConfig.setParameters(9000000, 15000, 5, 2);
+    savedConfig.save();
+
+    config.useRtcMemoryInPlace();
+    ASSERT_TRUE(config.checkMemory());
+    uint32_t BadNumber = 0xDEADDEAD;
+    ESP.rtcUserMemoryWrite(OTA_OFFSET, &BadNumber, 4);
+    ASSERT_TRUE(config.checkMemory());
+    ASSERT_TRUE(config.fromMemory());
+}
+
+
+TEST(ConfigurationTest, ActiveWindowFromJson) {
+    Configuration config;
+    Configuration otherConfig;
+    ActiveWindow window;
+    Synchronisation sync;
+
+    config.populateActiveWindow(&window);
+    ASSERT_EQ(0, window.activeMinutes);
+    config.fromJson("{ startTimeOfDay: 25200, activeTime: 50400, utcOffset: -18000 }");
+    config.populateActiveWindow(&window);
+    ASSERT_EQ(420, window.startMinute);
+    ASSERT_EQ(840, window.activeMinutes);
+    ASSERT_EQ(-300, window.utcOffsetMinutes);
+    ASSERT_FALSE(config.equivalentTo(otherConfig));
+
+    // Held to the minute in startTimeOfDay, and kept when the next message leaves it out.
+    config.fromJson("{ utcOffset: 20700, nSamples: 2 }");
+    config.populateActiveWindow(&window);
+    ASSERT_EQ(420, window.startMinute);
+    ASSERT_EQ(345, window.utcOffsetMinutes);
+    config.populateSynchronisation(&sync);
+    ASSERT_NE(0, sync.startTimeOfDay);
+
+    config.fromJson("{ activeTime: 0 }");
+    config.populateActiveWindow(&window);
+    ASSERT_EQ(0, window.activeMinutes);
+}
 
 int main(int argc, char** argv) {
     testing::InitGoogleTest(&argc, argv);
@@ -0,0 +1,111 @@
+#define ESP8266
+#define Arduino_h
+
+#include <gtest/gtest.h>
+#include "./fake/Esp.h"
+#include "../src/Espx.cpp"
+#include "../src/Format.cpp"
+#include "../src/Configuration.cpp"
+
+#define TTL_US (DNS_TTL_SECONDS * 1000000ULL)
+
+class EspxDnsTest : public testing::Test {
+    protected:
+    virtual void SetUp() {
+        memset(fakeRtc(), 0xDE, sizeof(fakeRtc()));
+        fakeRtcTicks() = 0;
+        WiFi.reset();
+        WiFi.addHost("pool.ntp.org", IPAddress(10, 0, 0, 1));
+        WiFi.addHost("broker", IPAddress(10, 0, 0, 2));
+        WiFi.addHost("updates", IPAddress(10, 0, 0, 3));
+        WiFi.addHost("web", IPAddress(10, 0, 0, 4));
+    }
+
+    virtual void TearDown() {}
+};
+
+TEST_F(EspxDnsTest, CacheTakesTheEndOfRtcMemory) {
+    ASSERT_EQ(MAX_RTC_SIZE, DNS_OFFSET * 4 + sizeof(DnsCache));
+    ASSERT_LE(OTA_OFFSET * 4 + sizeof(RtcData) + RTC_LOG_TRANSPORT_SIZE + RTC_TRACE_SIZE, DNS_OFFSET * 4);
+}
+
+TEST_F(EspxDnsTest, LooksUpOnceWithinTtl) {
+    IPAddress address;
+    bool cached = true;
+    ASSERT_TRUE(Espx::hostByName("broker", address, &cached));
+    ASSERT_FALSE(cached);
+    ASSERT_EQ((uint32_t) IPAddress(10, 0, 0, 2), (uint32_t) address);
+
+    fakeRtcTicks() += TTL_US - 1000;
+    address = IPAddress();
+    ASSERT_TRUE(Espx::hostByName("broker", address, &cached));
+    ASSERT_TRUE(cached);
+    ASSERT_EQ((uint32_t) IPAddress(10, 0, 0, 2), (uint32_t) address);
+    ASSERT_EQ(1, WiFi.lookups);
+}
+
+TEST_F(EspxDnsTest, LooksUpAgainOnceExpired) {
+    IPAddress address;
+    bool cached;
+    Espx::hostByName("broker", address);
+    WiFi.addHost("broker", IPAddress(10, 0, 0, 9));
+    fakeRtcTicks() += TTL_US;
+    ASSERT_TRUE(Espx::hostByName("broker", address, &cached));
+    ASSERT_FALSE(cached);
+    ASSERT_EQ((uint32_t) IPAddress(10, 0, 0, 9), (uint32_t) address);
+    ASSERT_EQ(2, WiFi.lookups);
+}
+
+TEST_F(EspxDnsTest, ForgottenHostIsLookedUpAgain) {
+    IPAddress address;
+    bool cached;
+    Espx::hostByName("broker", address);
+    Espx::hostByName("updates", address);
+    Espx::forgetHost("broker");
+    ASSERT_TRUE(Espx::hostByName("broker", address, &cached));
+    ASSERT_FALSE(cached);
+    ASSERT_TRUE(Espx::hostByName("updates", address, &cached));
+    ASSERT_TRUE(cached);
+    ASSERT_EQ(3, WiFi.lookups);
+}
+
+TEST_F(EspxDnsTest, FailedLookupIsNotCached) {
+    IPAddress address;
+    ASSERT_FALSE(Espx::hostByName("nowhere.invalid", address));
+    ASSERT_FALSE(Espx::hostByName("nowhere.invalid", address));
+    ASSERT_EQ(2, WiFi.lookups);
+}
+
+TEST_F(EspxDnsTest, ReplacesOldestWhenFull) {
+    IPAddress address;
+    bool cached;
+    const char* hosts[] = {"pool.ntp.org", "broker", "updates"};
+    for (int i=0; i < DNS_CACHE_SIZE; i++) {
+        Espx::hostByName(hosts[i], address);
+        fakeRtcTicks() += 1000000;
+    }
+    Espx::hostByName("web", address);
+    ASSERT_TRUE(Espx::hostByName("broker", address, &cached));
+    ASSERT_TRUE(cached);
+    ASSERT_TRUE(Espx::hostByName("web", address, &cached));
+    ASSERT_TRUE(cached);
+    ASSERT_TRUE(Espx::hostByName("pool.ntp.org", address, &cached));
+    ASSERT_FALSE(cached);
+}
+
+TEST_F(EspxDnsTest, CacheDoesNotDisturbConfiguration) {
+    Configuration config;
+    config.setParameters(180000, 5000, 5, 1);
+    config.save();
+    IPAddress address;
+    Espx::hostByName("broker", address);
+    Espx::hostByName("web", address);
+    Configuration loaded;
+    ASSERT_TRUE(loaded.fromMemory());
+    ASSERT_TRUE(loaded.equivalentTo(config));
+}
+
+int main(int argc, char** argv) {
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -0,0 +1,88 @@
+#define ESP8266
+#define Arduino_h
+
+#include <gtest/gtest.h>
+#include "../src/Format.cpp"
+
+TEST(FormatTest, ParsesUnsigned) {
+    uint32_t value = 7;
+    ASSERT_TRUE(Format::parseUnsigned("3600000", &value));
+    ASSERT_EQ(3600000, value);
+    ASSERT_TRUE(Format::parseUnsigned(" +42}", &value));
+    ASSERT_EQ(42, value);
+    ASSERT_TRUE(Format::parseUnsigned("4294967295", &value));
+    ASSERT_EQ(4294967295UL, value);
+}
+
+TEST(FormatTest, RefusesUnsignedOverflow) {
+    uint32_t value = 7;
+    ASSERT_FALSE(Format::parseUnsigned("4294967296", &value));
+    ASSERT_FALSE(Format::parseUnsigned("4294967300", &value));
+    ASSERT_FALSE(Format::parseUnsigned("99999999999999999999", &value));
+    ASSERT_EQ(7, value);
+    ASSERT_TRUE(Format::parseUnsigned("00000000004294967295", &value));
+    ASSERT_EQ(4294967295UL, value);
+}
+
+TEST(FormatTest, LeavesValueWithoutDigits) {
+    uint32_t value = 7;
+    ASSERT_FALSE(Format::parseUnsigned("", &value));
+    ASSERT_FALSE(Format::parseUnsigned("abc", &value));
+    ASSERT_FALSE(Format::parseUnsigned("-5", &value));
+    ASSERT_EQ(7, value);
+}
+
+TEST(FormatTest, FindsUnsignedByKey) {
+    uint32_t value = 7;
+    ASSERT_TRUE(Format::findUnsigned("{\"time\": 1700000000, \"ms\": 250, \"counter\": 6}", "time", &value));
+    ASSERT_EQ(1700000000, value);
+    ASSERT_TRUE(Format::findUnsigned("{\"time\": 1700000000, \"ms\": 250, \"counter\": 6}", "ms", &value));
+    ASSERT_EQ(250, value);
+    ASSERT_TRUE(Format::findUnsigned("{syncTime: 5, time:12}", "time", &value));
+    ASSERT_EQ(12, value);
+    ASSERT_FALSE(Format::findUnsigned("{\"uptime\": 3, \"times\": 4}", "time", &value));
+    ASSERT_FALSE(Format::findUnsigned("{\"version\": 105}", "time", &value));
+    ASSERT_EQ(12, value);
+}
+
+TEST(FormatTest, FormatsNumbers) {
+    char msg[20];
+    ASSERT_EQ(1, Format::number(msg, sizeof(msg), 0));
+    ASSERT_STREQ("0", msg);
+    ASSERT_EQ(10, Format::number(msg, sizeof(msg), 4294967295UL));
+    ASSERT_STREQ("4294967295", msg);
+    ASSERT_EQ(7, Format::signedNumber(msg, sizeof(msg), -100899));
+    ASSERT_STREQ("-100899", msg);
+    ASSERT_EQ(11, Format::signedNumber(msg, sizeof(msg), INT32_MIN));
+    ASSERT_STREQ("-2147483648", msg);
+}
+
+TEST(FormatTest, FormatsFixedPoint) {
+    char msg[20];
+    Format::fixed(msg, sizeof(msg), 3300, 3);
+    ASSERT_STREQ("3.300", msg);
+    Format::fixed(msg, sizeof(msg), 899101, 6);
+    ASSERT_STREQ("0.899101", msg);
+    Format::fixed(msg, sizeof(msg), 1000000, 6);
+    ASSERT_STREQ("1.000000", msg);
+    Format::fixed(msg, sizeof(msg), -25, 2);
+    ASSERT_STREQ("-0.25", msg);
+    Format::fixed(msg, sizeof(msg), 12, 0);
+    ASSERT_STREQ("12", msg);
+}
+
+TEST(FormatTest, ChainsAndTruncatesSafely) {
+    char msg[12];
+    size_t n = Format::text(msg, sizeof(msg), "counter: ");
+    n += Format::number(msg + n, sizeof(msg) - n, 65535);
+    n += Format::text(msg + n, sizeof(msg) - n, ", more");
+    ASSERT_EQ(11, n);
+    ASSERT_STREQ("counter: 65", msg);
+    ASSERT_EQ(0, Format::text(msg + n, sizeof(msg) - n, "x"));
+    ASSERT_EQ(0, Format::fixed(msg, 0, 3300, 3));
+}
+
+int main(int argc, char** argv) {
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
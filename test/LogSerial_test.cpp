@@ -0,0 +1,44 @@
+#define ESP8266
+#define Arduino_h
+#define LOG_SERIAL
+
+#include <gtest/gtest.h>
+#include "./fake/Esp.h"
+#include "../src/Espx.cpp"
+#include "../src/Format.cpp"
+#include "../src/Configuration.cpp"
+#include "../src/Log.cpp"
+
+class LogSerialTest : public testing::Test {
+    protected:
+    virtual void SetUp() {
+        uint32_t BadNumber = 0xDEADDEAD;
+        ESP.rtcUserMemoryWrite(LOG_OFFSET, &BadNumber, 4);
+        Log::begin();
+    }
+
+    virtual void TearDown() {}
+};
+
+TEST_F(LogSerialTest, RecordsAreEchoedToUart) {
+    size_t before = Serial.written;
+    LOG_ERROR(12, 345);
+    ASSERT_EQ(strlen("\n[1] 12: 345"), Serial.written - before);
+
+    before = Serial.written;
+    LOG_WARN(2, 0);
+    ASSERT_GT(Serial.written, before);
+    ASSERT_EQ(2, Log::getCount());
+}
+
+TEST_F(LogSerialTest, LevelsCompiledOutAreNotEchoed) {
+    size_t before = Serial.written;
+    LOG_DEBUG(4, 0);
+    ASSERT_EQ(before, Serial.written);
+    ASSERT_EQ(0, Log::getCount());
+}
+
+int main(int argc, char** argv) {
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
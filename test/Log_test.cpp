@@ -0,0 +1,153 @@
+#define ESP8266
+#define Arduino_h
+
+#include <gtest/gtest.h>
+#include "./fake/Esp.h"
+#include "../src/Espx.cpp"
+#include "../src/Format.cpp"
+#include "../src/Configuration.cpp"
+#include "../src/Log.cpp"
+
+class LogTest : public testing::Test {
+    public:
+    static int evaluated;
+    static uint16_t sideEffect() {
+        LogTest::evaluated++;
+        return 1;
+    }
+
+    protected:
+    virtual void SetUp() {
+        uint32_t BadNumber = 0xDEADDEAD;
+        ESP.rtcUserMemoryWrite(LOG_OFFSET, &BadNumber, 4);
+        Log::begin();
+        LogTest::evaluated = 0;
+    }
+
+    virtual void TearDown() {}
+};
+
+int LogTest::evaluated;
+
+TEST_F(LogTest, RingFitsInRtcUserMemory) {
+    ASSERT_LE(LOG_OFFSET * 4 + sizeof(LogRing), sizeof(fakeRtc()));
+}
+
+TEST_F(LogTest, BeginStartsWithEmptyRingWhenMemoryInvalid) {
+    ASSERT_EQ(0, Log::getCount());
+    LogRecord record;
+    ASSERT_FALSE(Log::populateRecord(0, &record));
+}
+
+TEST_F(LogTest, WriteStoresRecordsOldestFirst) {
+    Log::write(LOG_LEVEL_ERROR, 7, 100);
+    Log::write(LOG_LEVEL_WARN, 8, 200);
+
+    LogRecord record;
+    ASSERT_EQ(2, Log::getCount());
+    ASSERT_TRUE(Log::populateRecord(0, &record));
+    ASSERT_EQ(LOG_LEVEL_ERROR, record.level);
+    ASSERT_EQ(7, record.code);
+    ASSERT_EQ(100, record.value);
+    ASSERT_TRUE(Log::populateRecord(1, &record));
+    ASSERT_EQ(LOG_LEVEL_WARN, record.level);
+    ASSERT_EQ(8, record.code);
+    ASSERT_EQ(200, record.value);
+}
+
+TEST_F(LogTest, WriteOverwritesOldestWhenFull) {
+    for (int i=1; i <= LOG_RING_SIZE + 2; i++) {
+        Log::write(LOG_LEVEL_ERROR, i, i * 10);
+    }
+
+    LogRecord record;
+    ASSERT_EQ(LOG_RING_SIZE, Log::getCount());
+    for (int i=0; i < LOG_RING_SIZE; i++) {
+        ASSERT_TRUE(Log::populateRecord(i, &record));
+        ASSERT_EQ(i + 3, record.code);
+        ASSERT_EQ((i + 3) * 10, record.value);
+    }
+}
+
+TEST_F(LogTest, RecordsSurviveDeepSleep) {
+    Log::write(LOG_LEVEL_ERROR, 1, 11);
+    Log::write(LOG_LEVEL_ERROR, 2, 22);
+
+    LogRing saved;
+    ESP.rtcUserMemoryRead(LOG_OFFSET, (uint32_t*) &saved, sizeof(saved));
+    ASSERT_EQ(LOG_MAGIC, saved.magic);
+    ASSERT_EQ(2, saved.count);
+    ASSERT_EQ(22, saved.records[1].value);
+
+    Log::begin();
+    LogRecord record;
+    ASSERT_EQ(2, Log::getCount());
+    ASSERT_TRUE(Log::populateRecord(1, &record));
+    ASSERT_EQ(2, record.code);
+}
+
+TEST_F(LogTest, LogWritesDoNotDisturbConfiguration) {
+    Configuration config;
+    Configuration savedConfig;
+    savedConfig.setParameters(9000000, 15000, 5, 2);
+    savedConfig.save();
+
+    for (int i=0; i < LOG_RING_SIZE * 2; i++) Log::write(LOG_LEVEL_ERROR, i, 0xFFFF);
+
+    ASSERT_TRUE(config.checkMemory());
+    ASSERT_TRUE(config.fromMemory());
+    ASSERT_TRUE(config.equivalentTo(savedConfig));
+}
+
+TEST_F(LogTest, DisabledLevelsAreCompiledOut) {
+    LOG_DEBUG(1, LogTest::sideEffect());
+    LOG_INFO(2, LogTest::sideEffect());
+    ASSERT_EQ(0, LogTest::evaluated);
+    ASSERT_EQ(0, Log::getCount());
+
+    LOG_WARN(3, LogTest::sideEffect());
+    LOG_ERROR(4, LogTest::sideEffect());
+    ASSERT_EQ(2, LogTest::evaluated);
+    ASSERT_EQ(2, Log::getCount());
+}
+
+TEST_F(LogTest, ClearEmptiesRing) {
+    Log::write(LOG_LEVEL_ERROR, 1, 1);
+    Log::clear();
+    ASSERT_EQ(0, Log::getCount());
+    Log::begin();
+    ASSERT_EQ(0, Log::getCount());
+}
+
+TEST_F(LogTest, PopulateMsg) {
+    char msg[50];
+    Log::populateMsg(msg, sizeof(msg));
+    ASSERT_STREQ("[]", msg);
+
+    Log::write(LOG_LEVEL_ERROR, 4, 5);
+    Log::write(LOG_LEVEL_WARN, 12, 65535);
+    size_t n = Log::populateMsg(msg, sizeof(msg));
+    ASSERT_STREQ("[1:4:5,2:12:65535]", msg);
+    ASSERT_EQ(strlen(msg), n);
+}
+
+TEST_F(LogTest, PopulateMsgTruncatesSafely) {
+    char msg[8];
+    Log::write(LOG_LEVEL_ERROR, 4, 5);
+    Log::write(LOG_LEVEL_WARN, 12, 65535);
+    Log::populateMsg(msg, sizeof(msg));
+    ASSERT_EQ(7, strlen(msg));
+}
+
+TEST_F(LogTest, LoggingDoesNotUseUart) {
+    size_t before = Serial.written;
+    LOG_ERROR(1, 0);
+    LOG_WARN(2, 0);
+    ASSERT_EQ(2, Log::getCount());
+    ASSERT_EQ(before, Serial.written);
+}
+
+int main(int argc, char** argv) {
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
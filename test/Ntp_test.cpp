@@ -0,0 +1,163 @@
+#define ESP8266
+#define Arduino_h
+
+#include <gtest/gtest.h>
+#include <functional>
+#include "./fake/Esp.h"
+#include "./fake/LoopbackServer.h"
+#include "../src/Espx.cpp"
+#include "../src/Format.cpp"
+#include "../src/Configuration.cpp"
+#include "../src/Ntp.cpp"
+
+#define SERVER_SECONDS (NTP_UNIX_OFFSET + 1612100000UL)
+
+class NtpTest : public testing::Test {
+    protected:
+    NtpLoopbackServer server;
+    WiFiUDP udp;
+
+    virtual void SetUp() {
+        memset(fakeRtc(), 0xDE, sizeof(fakeRtc()));
+        fakeTicks() = 1000;
+    }
+
+    virtual void TearDown() {}
+
+    // The NTP fraction for a whole number of ms.
+    static uint32_t fraction(uint32_t ms) {
+        return (((uint64_t) ms << 32) + 999) / 1000;
+    }
+
+    // Polls (in real time) until done, as the main loop would.
+    static bool pollUntil(NtpClient& ntp, std::function<bool()> done, int timeoutMs = 2000) {
+        for (int i=0; i < timeoutMs && !done(); i++) {
+            ntp.poll();
+            usleep(1000);
+        }
+        return done();
+    }
+
+    bool begin(NtpClient& ntp, uint8_t queries = 1) {
+        return ntp.begin(IPAddress(127, 0, 0, 1), queries, server.getPort());
+    }
+};
+
+TEST_F(NtpTest, RequestIsAClientPacketWithANonce) {
+    NtpClient ntp(udp, 0);
+    ASSERT_TRUE(begin(ntp));
+    ASSERT_TRUE(server.waitForCount(1));
+    std::string request = server.getMessage(0);
+    ASSERT_EQ(NTP_PACKET_SIZE, request.size());
+    ASSERT_EQ(0xE3, (uint8_t) request[0]);
+    ASSERT_NE(std::string(8, 0), request.substr(40, 8));
+}
+
+TEST_F(NtpTest, ServerTimeIsTransmitTimePlusHalfTheDelay) {
+    uint32_t seconds;
+    uint16_t ms;
+    NtpClient ntp(udp, 0);
+    server.addReply(SERVER_SECONDS, fraction(250), SERVER_SECONDS, fraction(500));
+    ASSERT_FALSE(ntp.populateTime(&seconds, &ms));
+    ASSERT_TRUE(begin(ntp));
+    ASSERT_TRUE(server.waitForCount(1));
+
+    // 350 ms there and back, 250 ms of which the server held the request.
+    fakeTicks() += 350;
+    ASSERT_TRUE(pollUntil(ntp, [&]() { return ntp.poll(); }));
+    ASSERT_EQ(100, ntp.getDelay());
+    ASSERT_TRUE(ntp.populateTime(&seconds, &ms));
+    ASSERT_EQ(1612100000, seconds);
+    ASSERT_EQ(550, ms);
+
+    fakeTicks() += 1500;
+    ASSERT_TRUE(ntp.populateTime(&seconds, &ms));
+    ASSERT_EQ(1612100002, seconds);
+    ASSERT_EQ(50, ms);
+}
+
+TEST_F(NtpTest, FractionIsKeptToTheMillisecond) {
+    uint32_t seconds;
+    uint16_t ms;
+    NtpClient ntp(udp, 0);
+    // 0.999... s received, 0.001 s (2^32 / 1000 rounded up) into the next second transmitted.
+    server.addReply(SERVER_SECONDS, 0xFFFFFFFF, SERVER_SECONDS + 1, 0x00418938);
+    ASSERT_TRUE(begin(ntp));
+    ASSERT_TRUE(server.waitForCount(1));
+    fakeTicks() += 1;
+    ASSERT_TRUE(pollUntil(ntp, [&]() { return ntp.poll(); }));
+    ASSERT_EQ(0, ntp.getDelay());           // held 2 ms of a 1 ms round trip: no less than 0.
+    ASSERT_TRUE(ntp.populateTime(&seconds, &ms));
+    ASSERT_EQ(1612100001, seconds);
+    ASSERT_EQ(1, ms);
+}
+
+TEST_F(NtpTest, IgnoresRepliesThatCannotBeTrusted) {
+    struct { uint8_t header; uint8_t stratum; bool echo; } replies[] = {
+        {0x23, 2, true},                // mode client, not server.
+        {0xE4, 2, true},                // LI unsynchronised.
+        {0x24, 0, true},                // stratum 0: kiss-o'-death.
+        {0x24, 2, false}                // originate is not our request's nonce.
+    };
+    for (auto& reply : replies) {
+        NtpLoopbackServer untrusted;
+        WiFiUDP socket;
+        NtpClient ntp(socket, 0);
+        uint32_t seconds;
+        uint16_t ms;
+        untrusted.setHeader(reply.header, reply.stratum, reply.echo);
+        untrusted.addReply(SERVER_SECONDS, 0, SERVER_SECONDS, 0);
+        ASSERT_TRUE(ntp.begin(IPAddress(127, 0, 0, 1), 1, untrusted.getPort()));
+        ASSERT_TRUE(untrusted.waitForCount(1));
+        ASSERT_FALSE(pollUntil(ntp, [&]() { return ntp.poll(); }, 50)) << (int) reply.header;
+        ASSERT_FALSE(ntp.populateTime(&seconds, &ms));
+    }
+}
+
+TEST_F(NtpTest, BurstKeepsTheReplyWithLeastDelay) {
+    uint32_t seconds;
+    uint16_t ms;
+    NtpClient ntp(udp, 0);
+    server.addReply(SERVER_SECONDS, 0, SERVER_SECONDS, fraction(20));
+    server.addReply(SERVER_SECONDS + 1, 0, SERVER_SECONDS + 1, fraction(90));
+    server.addReply(SERVER_SECONDS + 2, 0, SERVER_SECONDS + 2, fraction(50));
+    ASSERT_TRUE(begin(ntp, 3));
+
+    // Each round trip is 100 ms, so the delays are 80, 10 and 50 ms.
+    for (size_t i=1; i <= 3; i++) {
+        ASSERT_TRUE(server.waitForCount(i));
+        fakeTicks() += 100;
+        if (i < 3) {
+            ASSERT_TRUE(pollUntil(ntp, [&]() { return server.getCount() > i; }));
+        }
+    }
+    ASSERT_TRUE(pollUntil(ntp, [&]() { return ntp.poll(); }));
+    ASSERT_EQ(10, ntp.getDelay());
+    ASSERT_TRUE(ntp.populateTime(&seconds, &ms));
+    ASSERT_EQ(1612100001, seconds);
+    ASSERT_EQ(195, ms);
+}
+
+TEST_F(NtpTest, LostReplyMovesOnToTheNextQuery) {
+    uint32_t seconds;
+    uint16_t ms;
+    NtpClient ntp(udp, 0);
+    ASSERT_TRUE(begin(ntp, 2));
+    ASSERT_TRUE(server.waitForCount(1));
+    ASSERT_FALSE(ntp.poll());
+
+    server.addReply(SERVER_SECONDS, 0, SERVER_SECONDS, 0);
+    fakeTicks() += NTP_QUERY_TIMEOUT_MS + 1;
+    ASSERT_FALSE(ntp.poll());
+    ASSERT_TRUE(server.waitForCount(2));
+    fakeTicks() += 40;
+    ASSERT_TRUE(pollUntil(ntp, [&]() { return ntp.poll(); }));
+    ASSERT_TRUE(ntp.populateTime(&seconds, &ms));
+    ASSERT_EQ(1612100000, seconds);
+    ASSERT_EQ(20, ms);
+}
+
+int main(int argc, char** argv) {
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
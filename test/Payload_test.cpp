@@ -0,0 +1,99 @@
+#define ESP8266
+#define Arduino_h
+
+#include <gtest/gtest.h>
+#include <string>
+#include "./fake/Esp.h"
+#include "../src/Format.cpp"
+#include "../src/Payload.cpp"
+
+// Collects what is written, taking at most limit bytes.
+class StringPrint : public Print {
+    public:
+    std::string written;
+    size_t limit = SIZE_MAX;
+
+    size_t write(const uint8_t* buf, size_t size) {
+        if (size > limit - written.size()) size = limit - written.size();
+        written.append((const char*) buf, size);
+        return size;
+    }
+};
+
+class FieldsPayload : public Payload {
+    public:
+    void writeTo(PayloadWriter& writer) {
+        writer.text("counter: ");
+        writer.number(4294967295UL);
+        writer.text(", drift: ");
+        writer.signedNumber(-1500);
+        writer.text(", voltage: ");
+        writer.fixed(3300, 3);
+        writer.text(", trace: ");
+        const uint8_t trace[] = {0x00, 0x9F, 0xE0};
+        writer.hex(trace, sizeof(trace));
+    }
+};
+
+class BinaryPayload : public Payload {
+    public:
+    void writeTo(PayloadWriter& writer) {
+        writer.u8(1);
+        writer.u16(0x1234);
+        writer.u32(0xDEADBEEF);
+    }
+    bool isBinary() { return true; }
+};
+
+TEST(PayloadTest, CountsWithoutPrint) {
+    FieldsPayload payload;
+    PayloadWriter writer;
+    payload.writeTo(writer);
+    ASSERT_EQ(strlen("counter: 4294967295, drift: -1500, voltage: 3.300, trace: 009fe0"), writer.getLength());
+    ASSERT_EQ(writer.getLength(), payload.getLength());
+    ASSERT_FALSE(payload.isBinary());
+}
+
+TEST(PayloadTest, WritesTextFields) {
+    FieldsPayload payload;
+    StringPrint out;
+    PayloadWriter writer(&out);
+    payload.writeTo(writer);
+    ASSERT_EQ("counter: 4294967295, drift: -1500, voltage: 3.300, trace: 009fe0", out.written);
+    ASSERT_FALSE(writer.hasFailed());
+}
+
+TEST(PayloadTest, WritesBinaryLittleEndian) {
+    BinaryPayload payload;
+    StringPrint out;
+    PayloadWriter writer(&out);
+    payload.writeTo(writer);
+    ASSERT_EQ(std::string("\x01\x34\x12\xEF\xBE\xAD\xDE", 7), out.written);
+    ASSERT_EQ(7, payload.getLength());
+    ASSERT_TRUE(payload.isBinary());
+}
+
+TEST(PayloadTest, StopsWritingOnceThePrintFails) {
+    FieldsPayload payload;
+    StringPrint out;
+    out.limit = 12;
+    PayloadWriter writer(&out);
+    payload.writeTo(writer);
+    ASSERT_TRUE(writer.hasFailed());
+    ASSERT_EQ("counter: 429", out.written);
+    ASSERT_EQ(payload.getLength(), writer.getLength());
+}
+
+TEST(PayloadTest, BytesPayloadWritesItsBuffer) {
+    const uint8_t bytes[] = {'{', 0, '}'};
+    BytesPayload payload(bytes, sizeof(bytes));
+    StringPrint out;
+    PayloadWriter writer(&out);
+    payload.writeTo(writer);
+    ASSERT_EQ(std::string("{\0}", 3), out.written);
+}
+
+int main(int argc, char** argv) {
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -0,0 +1,198 @@
+#define ESP8266
+#define Arduino_h
+#define ROLLUPS
+
+#include <gtest/gtest.h>
+#include "./fake/Esp.h"
+#include "../src/Espx.cpp"
+#include "../src/Format.cpp"
+#include "../src/Configuration.cpp"
+#include "../src/Sampler.cpp"
+#include "../src/Rollup.cpp"
+
+#define DAY_START 1612051200UL          // a UTC midnight.
+#define HOUR ROLLUP_HOUR_SECONDS
+#define DAY ROLLUP_DAY_SECONDS
+
+class RollupTest : public testing::Test {
+    protected:
+    Rollups rollups;
+
+    virtual void SetUp() {
+        memset(fakeRtc(), 0xDE, sizeof(fakeRtc()));
+        fakeResetInfo().reason = REASON_DEFAULT_RST;
+        fakeTicks() = 0;
+        memset(&rollups, 0, sizeof(rollups));
+    }
+
+    virtual void TearDown() {}
+
+    void assertSummary(RollupTier tier, uint8_t index, uint32_t start, uint16_t min, uint16_t max, uint16_t mean, uint16_t count) {
+        RollupSummary summary;
+        uint32_t summaryStart;
+        ASSERT_TRUE(Rollup::populateSummary(&rollups, tier, index, &summary, &summaryStart));
+        ASSERT_EQ(start, summaryStart);
+        ASSERT_EQ(min, summary.min);
+        ASSERT_EQ(max, summary.max);
+        ASSERT_EQ(mean, summary.mean);
+        ASSERT_EQ(count, summary.count);
+    }
+};
+
+TEST_F(RollupTest, TiersComeOutOfTheDataArea) {
+    ASSERT_EQ(32 + 8 * (6 + 7), sizeof(Rollups));
+    ASSERT_EQ(56, MAX_DATA_ELEMENTS);
+    ASSERT_EQ(offsetof(RtcData, data) + MAX_DATA_ELEMENTS * sizeof(uint16_t), offsetof(RtcData, rollups));
+    ASSERT_LE(OTA_OFFSET * 4 + sizeof(RtcData) + RTC_RESERVED_SIZE, MAX_RTC_SIZE);
+}
+
+TEST_F(RollupTest, HourClosesIntoSummary) {
+    Rollup::add(&rollups, 10, DAY_START + 60);
+    Rollup::add(&rollups, 30, DAY_START + 1800);
+    Rollup::add(&rollups, 21, DAY_START + HOUR - 1);
+    ASSERT_EQ(0, Rollup::getCount(&rollups, ROLLUP_HOUR));
+
+    Rollup::add(&rollups, 5, DAY_START + HOUR);
+    ASSERT_EQ(1, Rollup::getCount(&rollups, ROLLUP_HOUR));
+    ASSERT_EQ(0, Rollup::getCount(&rollups, ROLLUP_DAY));
+    assertSummary(ROLLUP_HOUR, 0, DAY_START, 10, 30, 20, 3);
+    RollupSummary summary;
+    uint32_t start;
+    ASSERT_FALSE(Rollup::populateSummary(&rollups, ROLLUP_HOUR, 1, &summary, &start));
+}
+
+TEST_F(RollupTest, HoursRollIntoDays) {
+    for (uint32_t t=0; t < DAY; t += 15 * 60) Rollup::add(&rollups, t < DAY / 2 ? 100 : 300, DAY_START + t);
+    ASSERT_EQ(0, Rollup::getCount(&rollups, ROLLUP_DAY));
+    Rollup::add(&rollups, 7, DAY_START + DAY + 60);
+
+    ASSERT_EQ(1, Rollup::getCount(&rollups, ROLLUP_DAY));
+    assertSummary(ROLLUP_DAY, 0, DAY_START, 100, 300, 200, 96);
+    ASSERT_EQ(ROLLUP_HOURS, Rollup::getCount(&rollups, ROLLUP_HOUR));
+    assertSummary(ROLLUP_HOUR, ROLLUP_HOURS - 1, DAY_START + DAY - HOUR, 300, 300, 300, 4);
+    assertSummary(ROLLUP_HOUR, 0, DAY_START + DAY - ROLLUP_HOURS * HOUR, 300, 300, 300, 4);
+}
+
+TEST_F(RollupTest, GapsAreHeldAsEmptyPeriods) {
+    Rollup::add(&rollups, 50, DAY_START);
+    Rollup::add(&rollups, 60, DAY_START + 3 * HOUR + 10);
+    ASSERT_EQ(3, Rollup::getCount(&rollups, ROLLUP_HOUR));
+    assertSummary(ROLLUP_HOUR, 0, DAY_START, 50, 50, 50, 1);
+    assertSummary(ROLLUP_HOUR, 1, DAY_START + HOUR, 0, 0, 0, 0);
+    assertSummary(ROLLUP_HOUR, 2, DAY_START + 2 * HOUR, 0, 0, 0, 0);
+
+    // A link down for days, or the jump from time since boot to synchronised time, is bounded by the rings.
+    Rollup::add(&rollups, 70, DAY_START + 30 * DAY);
+    ASSERT_EQ(ROLLUP_HOURS, Rollup::getCount(&rollups, ROLLUP_HOUR));
+    ASSERT_EQ(ROLLUP_DAYS, Rollup::getCount(&rollups, ROLLUP_DAY));
+    assertSummary(ROLLUP_HOUR, ROLLUP_HOURS - 1, DAY_START + 30 * DAY - HOUR, 0, 0, 0, 0);
+    assertSummary(ROLLUP_DAY, 0, DAY_START + (30 - ROLLUP_DAYS) * DAY, 0, 0, 0, 0);
+}
+
+TEST_F(RollupTest, FirstDayIsKeptUntilTheRingIsFull) {
+    Rollup::add(&rollups, 50, DAY_START);
+    Rollup::add(&rollups, 60, DAY_START + 2 * DAY);
+    ASSERT_EQ(2, Rollup::getCount(&rollups, ROLLUP_DAY));
+    assertSummary(ROLLUP_DAY, 0, DAY_START, 50, 50, 50, 1);
+    assertSummary(ROLLUP_DAY, 1, DAY_START + DAY, 0, 0, 0, 0);
+}
+
+TEST_F(RollupTest, TimeGoingBackKeepsToTheOpenHour) {
+    Rollup::add(&rollups, 10, DAY_START + 2 * HOUR);
+    Rollup::add(&rollups, 20, DAY_START + HOUR);
+    Rollup::add(&rollups, 0, DAY_START + 3 * HOUR);
+    ASSERT_EQ(1, Rollup::getCount(&rollups, ROLLUP_HOUR));
+    assertSummary(ROLLUP_HOUR, 0, DAY_START + 2 * HOUR, 10, 20, 15, 2);
+}
+
+TEST_F(RollupTest, ClearDropsOnlyTheClosedSummariesOfATier) {
+    for (uint32_t h=0; h < 26; h++) Rollup::add(&rollups, h, DAY_START + h * HOUR);
+    Rollup::clear(&rollups, ROLLUP_DAY);
+    ASSERT_EQ(0, Rollup::getCount(&rollups, ROLLUP_DAY));
+    ASSERT_EQ(ROLLUP_HOURS, Rollup::getCount(&rollups, ROLLUP_HOUR));
+
+    Rollup::clear(&rollups, ROLLUP_HOUR);
+    Rollup::add(&rollups, 99, DAY_START + 26 * HOUR);
+    ASSERT_EQ(1, Rollup::getCount(&rollups, ROLLUP_HOUR));
+    assertSummary(ROLLUP_HOUR, 0, DAY_START + 25 * HOUR, 25, 25, 25, 1);
+}
+
+TEST_F(RollupTest, SamplerRollsUpEachMeasurement) {
+    Configuration config;
+    Sampler sampler(config);
+    config.setParameters(600000, 0, 1, 1);
+    config.resetSynchronisation(DAY_START, 0);
+    memset(config.getRollups(), 0, sizeof(Rollups));
+    config.save();
+    sampler.setup();
+    uint16_t value = 0;
+    sampler.onTakeSample([&]() -> uint16_t { return value += 10; });
+    sampler.onTakeMeasurement([](uint16_t* samples, uint32_t n) -> uint16_t { return samples[0]; });
+    sampler.onTransmit([](uint16_t* measurements, uint32_t n) {});
+    for (int i=0; i < 7; i++) sampler.loop();
+
+    rollups = *config.getRollups();
+    ASSERT_EQ(1, Rollup::getCount(&rollups, ROLLUP_HOUR));
+    assertSummary(ROLLUP_HOUR, 0, DAY_START, 10, 60, 35, 6);
+    ASSERT_EQ(1, config.getRollups()->hour.count);
+}
+
+TEST_F(RollupTest, FirstSynchroniseRestartsTheOpenHour) {
+    Configuration config;
+    Sampler sampler(config);
+    config.setParameters(600000, 0, 1, 2);
+    memset(config.getRollups(), 0, sizeof(Rollups));
+    config.save();
+    sampler.setup();
+    uint16_t value = 0;
+    sampler.onTakeSample([&]() -> uint16_t { return value += 10; });
+    sampler.onTakeMeasurement([](uint16_t* samples, uint32_t n) -> uint16_t { return samples[0]; });
+    sampler.onTransmit([&](uint16_t* measurements, uint32_t n) {
+        if (value == 20) sampler.synchronise(DAY_START + 1800);
+    });
+    for (int i=0; i < 2; i++) sampler.loop();
+    rollups = *config.getRollups();
+    ASSERT_EQ(0, Rollup::getCount(&rollups, ROLLUP_HOUR));
+    ASSERT_EQ(0, Rollup::getCount(&rollups, ROLLUP_DAY));
+    ASSERT_EQ(DAY_START, rollups.hourStart);
+
+    for (int i=0; i < 4; i++) sampler.loop();
+    rollups = *config.getRollups();
+    ASSERT_EQ(1, Rollup::getCount(&rollups, ROLLUP_HOUR));
+    ASSERT_EQ(0, Rollup::getCount(&rollups, ROLLUP_DAY));
+    assertSummary(ROLLUP_HOUR, 0, DAY_START, 10, 40, 25, 4);
+}
+
+TEST_F(RollupTest, PowerOnClearsTheTiers) {
+    Configuration config;
+    Sampler sampler(config);
+    memset(config.getRollups(), 0xAB, sizeof(Rollups));
+    sampler.setup();
+    ASSERT_EQ(0, Rollup::getCount(config.getRollups(), ROLLUP_HOUR));
+    ASSERT_EQ(0, config.getRollups()->hourStart);
+}
+
+TEST_F(RollupTest, ScheduleMustFitTheSmallerDataArea) {
+    Configuration config;
+    Configuration update;
+    Parameters params;
+    config.setParameters(60000, 1000, 5, 3);
+    config.fromJson("{nSamples: 49}");
+    config.populateParameters(&params);
+    ASSERT_EQ(5, params.nSamples);
+    config.fromJson("{nSamples: 48}");
+    config.populateParameters(&params);
+    ASSERT_EQ(48, params.nSamples);
+
+    ASSERT_FALSE(update.setParameters(60000, 1000, 20, 20));
+    ASSERT_TRUE(config.stageJson("{nSamples: 20, transmitFrequency: 20}"));
+    config.applyStaged();
+    config.populateParameters(&params);
+    ASSERT_EQ(48, params.nSamples);
+    ASSERT_EQ(3, params.transmitFrequency);
+}
+
+int main(int argc, char** argv) {
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
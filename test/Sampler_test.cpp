@@ -2,8 +2,10 @@
 #define Arduino_h
 
 #include <gtest/gtest.h>
+#include <math.h>
 #include "./fake/Esp.h"
 #include "../src/Espx.cpp"
+#include "../src/Format.cpp"
 #include "../src/Configuration.cpp"
 #include "../src/Sampler.cpp"
 
@@ -112,11 +114,11 @@ class SamplerNtpSyncTest: public testing::Test {
     static Sampler *sampler;
 
     static void transmit(uint16_t* measurements, uint32_t nMeasurements) {
-        ticks += SamplerNtpSyncTest::presyncMillis;
+        fakeTicks() += SamplerNtpSyncTest::presyncMillis;
         if (SamplerNtpSyncTest::doSync) {
             SamplerNtpSyncTest::sampler->synchronise(SamplerNtpSyncTest::syncTimeSeconds);
         }
-        ticks += SamplerNtpSyncTest::postsyncMillis;
+        fakeTicks() += SamplerNtpSyncTest::postsyncMillis;
     }
 
 
@@ -131,6 +133,115 @@ class SamplerNtpSyncTest: public testing::Test {
 
 };
 
+class EventSampler : public Sampler {
+    public:
+    EventSampler(Configuration& config) : Sampler(config) {}
+    void external() { this->wakeCause = WAKE_CAUSE_EXTERNAL; }
+};
+
+class SamplerEventTest: public testing::Test {
+
+    public:
+    static bool eventCalled;
+    static uint16_t eventSample;
+
+    static void event(uint16_t sample) {
+        SamplerEventTest::eventCalled = true;
+        SamplerEventTest::eventSample = sample;
+    }
+
+    protected:
+    virtual void SetUp() {
+        uint32_t BadNumber = 0xDEADDEAD;
+        ESP.rtcUserMemoryWrite(OTA_OFFSET, &BadNumber, 4);
+        fakeResetInfo().reason = REASON_DEFAULT_RST;
+        fakeRtcTicks() = 0;
+        fakeTicks() = 0;
+        SamplerEventTest::eventCalled = false;
+        SamplerTest::transmitCalled = false;
+        SamplerTest::returnedSample = 7;
+    }
+
+    virtual void TearDown() {
+        fakeResetInfo().reason = REASON_DEFAULT_RST;
+    }
+
+    void wake(uint32_t reason, uint64_t rtcMicros) {
+        fakeResetInfo().reason = reason;
+        fakeRtcTicks() = rtcMicros;
+    }
+
+    // Only the ESP32 reports a GPIO wake, so the fake ESP8266 wakes on the timer and the cause is set.
+    void wakeExternally(EventSampler& sampler, uint64_t rtcMicros) {
+        wake(REASON_DEEP_SLEEP_AWAKE, rtcMicros);
+        sampler.setup();
+        sampler.external();
+    }
+};
+
+class SamplerTimestampTest: public testing::Test {
+
+    public:
+    static bool transmitCalled;
+    static uint32_t baseTime;
+    static uint16_t deltas[MAX_DATA_ELEMENTS];
+    static uint16_t measurements[MAX_DATA_ELEMENTS];
+
+    static void transmit(uint16_t* measurements, uint32_t n, uint32_t baseTime, uint16_t* deltas) {
+        SamplerTimestampTest::transmitCalled = true;
+        SamplerTimestampTest::baseTime = baseTime;
+        memcpy(SamplerTimestampTest::measurements, measurements, n * sizeof(uint16_t));
+        memcpy(SamplerTimestampTest::deltas, deltas, n * sizeof(uint16_t));
+    }
+
+    protected:
+    virtual void SetUp() {
+        uint32_t BadNumber = 0xDEADDEAD;
+        ESP.rtcUserMemoryWrite(OTA_OFFSET, &BadNumber, 4);
+        SamplerTimestampTest::transmitCalled = false;
+        fakeTicks() = 0;
+    }
+
+    virtual void TearDown() {}
+};
+
+class SamplerRadioTest: public testing::Test {
+
+    public:
+    static Sampler* sampler;
+    static uint16_t millivolts;
+    static bool connected;
+
+    static void transmit(uint16_t* measurements, uint32_t n) {
+        if (!SamplerRadioTest::connected) SamplerRadioTest::sampler->connectionFailed();
+        SamplerRadioTest::sampler->setBatteryVoltage(SamplerRadioTest::millivolts);
+    }
+
+    protected:
+    virtual void SetUp() {
+        uint32_t BadNumber = 0xDEADDEAD;
+        ESP.rtcUserMemoryWrite(OTA_OFFSET, &BadNumber, 4);
+        SamplerRadioTest::millivolts = 4000;
+        SamplerRadioTest::connected = true;
+        fakeTicks() = 0;
+    }
+
+    virtual void TearDown() {}
+
+    // One wake from reset, as on the device: everything not in RTC memory starts afresh.
+    RFMode wake(uint16_t transmitFrequency, uint8_t calibrationInterval) {
+        Configuration config;
+        Sampler sampler(config);
+        config.setParameters(10000, 0, 1, transmitFrequency);
+        SamplerRadioTest::sampler = &sampler;
+        sampler.setup();
+        sampler.onTransmit(&SamplerRadioTest::transmit);
+        sampler.calibrateRadio(calibrationInterval);
+        sampler.loop();
+        return ESP.getSleepMode();
+    }
+};
+
 uint16_t SamplerTest::samplesReceived[MAX_DATA_ELEMENTS];
 uint16_t SamplerTest::_nSamples;
 uint16_t SamplerTest::measurementsReceived[MAX_DATA_ELEMENTS];
@@ -145,6 +256,15 @@ unsigned long SamplerNtpSyncTest::postsyncMillis;
 uint32_t SamplerNtpSyncTest::syncTimeSeconds;
 Sampler* SamplerNtpSyncTest::sampler;
 bool SamplerNtpSyncTest::doSync;
+bool SamplerEventTest::eventCalled;
+bool SamplerTimestampTest::transmitCalled;
+uint32_t SamplerTimestampTest::baseTime;
+uint16_t SamplerTimestampTest::deltas[MAX_DATA_ELEMENTS];
+uint16_t SamplerTimestampTest::measurements[MAX_DATA_ELEMENTS];
+uint16_t SamplerEventTest::eventSample;
+Sampler* SamplerRadioTest::sampler;
+uint16_t SamplerRadioTest::millivolts;
+bool SamplerRadioTest::connected;
 
 TEST_F(SamplerTest, SetupLoadValidConfigFromMemory) {
     Configuration config;
@@ -249,6 +369,24 @@ TEST_F(SamplerTest, LoopSleepsForAppropriateAmountOfTime2) {
     }
 }
 
+TEST_F(SamplerTest, LoopSleepsForAppropriateAmountOfTimeInPlace) {
+    Configuration config;
+    Sampler sampler(config);
+    config.setParameters(3600000,1000,5,3);
+    config.useRtcMemoryInPlace();
+    sampler.setup();
+
+    for (int c=1; c < 20; c++) {
+        for (int i=0; i < 4; i++) {
+            sampler.loop();
+            ASSERT_EQ(ESP.getSleepTime(), (uint64_t) 1000000);
+        }
+        sampler.loop();
+        ASSERT_EQ(ESP.getSleepTime(), (uint64_t) 3596000000);
+    }
+    ASSERT_EQ((uint16_t*) &fakeRtc()[OTA_OFFSET * 4 + RTC_HEADER_SIZE], config.getData());
+}
+
 TEST_F(SamplerTest, LoopSleepsForAppropriateAmountOfTime3) {
     Configuration config;
     Sampler sampler(config);
@@ -560,10 +698,10 @@ TEST_F(SamplerTest, LoopAccountsForProcessingTimeInSleepTime) {
     ASSERT_EQ(ESP.getSleepTime(), (uint64_t) 60000000);
     ASSERT_EQ(ESP.getSleepMode(), RF_DEFAULT);
 
-    ticks = 123;
+    fakeTicks() = 123;
     sampler.setup();
 
-    ticks = 10123;
+    fakeTicks() = 10123;
     sampler.loop();
     ASSERT_EQ(ESP.getSleepTime(), (uint64_t) 50000000);
     ASSERT_EQ(ESP.getSleepMode(), RF_DEFAULT);
@@ -579,16 +717,16 @@ TEST_F(SamplerTest, LoopSleepsForNoTimeForExcessiveProcessingTime) {
     ASSERT_EQ(ESP.getSleepTime(), (uint64_t) 60000000);
     ASSERT_EQ(ESP.getSleepMode(), RF_DEFAULT);
 
-    ticks = 123;
+    fakeTicks() = 123;
     sampler.setup();
 
-    ticks = 60123;
+    fakeTicks() = 60123;
     sampler.loop();
     ASSERT_EQ(ESP.getSleepTime(), (uint64_t) 0);
     ASSERT_EQ(ESP.getSleepMode(), RF_DEFAULT);
 
     sampler.setup();
-    ticks = 121123;
+    fakeTicks() = 121123;
     sampler.loop();
     ASSERT_EQ(ESP.getSleepTime(), (uint64_t) 0);
     ASSERT_EQ(ESP.getSleepMode(), RF_DEFAULT);
@@ -804,7 +942,7 @@ TEST_F(SamplerNtpSyncTest, SamplerConstructionInitialisesSyncronisation) {
     config.populateSynchronisation(&sync);
     ASSERT_EQ(sync.syncTime, 0);
     ASSERT_EQ(sync.nominalElapsed, 0);
-    ASSERT_FLOAT_EQ(sync.calibrationFactor, 1.000);
+    ASSERT_EQ(sync.driftPpm, 0);
 }
 
 
@@ -818,14 +956,14 @@ TEST_F(SamplerNtpSyncTest, RtcClockLagsBehindSyncedTime) {
 
     sampler.loop();
     config.populateSynchronisation(&sync);
-    ASSERT_FLOAT_EQ(sync.calibrationFactor, 1.0);
+    ASSERT_EQ(sync.driftPpm, 0);
     ASSERT_EQ(sync.syncTime,1612100000);
     ASSERT_EQ(sync.nominalElapsed, 200);
     ASSERT_EQ(ESP.getSleepTime(), (uint64_t) 200000000);
 
     sampler.loop();
     config.populateSynchronisation(&sync);
-    ASSERT_FLOAT_EQ(sync.calibrationFactor, 1.0);
+    ASSERT_EQ(sync.driftPpm, 0);
     ASSERT_EQ(sync.syncTime,1612100000);
     ASSERT_EQ(sync.nominalElapsed, 400);
     ASSERT_EQ(ESP.getSleepTime(), (uint64_t) 200000000);
@@ -833,29 +971,68 @@ TEST_F(SamplerNtpSyncTest, RtcClockLagsBehindSyncedTime) {
     sampler.synchronise(1612100440);
     sampler.loop();
     config.populateSynchronisation(&sync);
-    ASSERT_FLOAT_EQ(sync.calibrationFactor, 0.90909090909);
+    ASSERT_EQ(sync.driftPpm, -90909);
     ASSERT_EQ(sync.syncTime,1612100440);
     ASSERT_EQ(sync.nominalElapsed, 160);
     //Assert sleeptime is 160 seconds*0.909090...
-    ASSERT_EQ(ESP.getSleepTime(), (uint64_t) 145455000);
+    ASSERT_EQ(ESP.getSleepTime(), (uint64_t) 145454560);
 
     sampler.loop();
     config.populateSynchronisation(&sync);
-    ASSERT_FLOAT_EQ(sync.calibrationFactor, 0.90909090909);
+    ASSERT_EQ(sync.driftPpm, -90909);
     ASSERT_EQ(sync.syncTime,1612100440);
     ASSERT_EQ(sync.nominalElapsed, 360);
     //Assert next sleep time is 200 * 0.909090909
-    ASSERT_EQ(ESP.getSleepTime(), (uint64_t) 181818000);
+    ASSERT_EQ(ESP.getSleepTime(), (uint64_t) 181818200);
 
     sampler.synchronise(1612100804);
     sampler.loop();
     config.populateSynchronisation(&sync);
-    ASSERT_FLOAT_EQ(sync.calibrationFactor, 0.89910089910);
+    ASSERT_EQ(sync.driftPpm, -100899);
     ASSERT_EQ(sync.syncTime,1612100804);
     ASSERT_EQ(sync.nominalElapsed, 196);
     //Assert sleeptime is 200 - 4 seconds*0.900090...
-    ASSERT_EQ(ESP.getSleepTime(), (uint64_t) 176224000);
+    ASSERT_EQ(ESP.getSleepTime(), (uint64_t) 176223796);
+
+}
+
+TEST_F(SamplerNtpSyncTest, RoundTripAddsHalfTheRoundTripToServerTime) {
+    Configuration config;
+    Sampler sampler(config);
+    Synchronisation sync;
+    config.setParameters(200000,0,1,1);
+    sampler.setup();
+
+    sampler.synchroniseRoundTrip(1612100000, 200, 400);
+    config.populateSynchronisation(&sync);
+    ASSERT_EQ(sync.syncTime, 1612100000);
+    ASSERT_EQ(sync.nominalElapsed, 0);
+    ASSERT_EQ(sync.elapsedMs, 400);
+
+    sampler.synchroniseRoundTrip(1612100000, 999, 3002);
+    config.populateSynchronisation(&sync);
+    ASSERT_EQ(sync.syncTime, 1612100002);
+    ASSERT_EQ(sync.nominalElapsed, 0);
+    ASSERT_EQ(sync.elapsedMs, 500);
+}
 
+TEST_F(SamplerNtpSyncTest, MillisecondsMeasureDriftBelowOneSecond) {
+    Configuration config;
+    Sampler sampler(config);
+    Synchronisation sync;
+    config.setParameters(200000,0,1,1);
+    sampler.setup();
+    sampler.synchronise(1612100000, 0);
+    sampler.loop();
+    sampler.loop();
+
+    // 400 s nominal, 400.4 s by the server: whole seconds alone would see no drift.
+    sampler.synchronise(1612100400, 400);
+    config.populateSynchronisation(&sync);
+    ASSERT_EQ(sync.syncTime, 1612100400);
+    ASSERT_EQ(sync.nominalElapsed, 0);
+    ASSERT_EQ(sync.elapsedMs, 400);
+    ASSERT_EQ(sync.driftPpm, -999);
 }
 
 TEST_F(SamplerNtpSyncTest, RtcClockRunsAheadOfSyncedTime) {
@@ -868,14 +1045,14 @@ TEST_F(SamplerNtpSyncTest, RtcClockRunsAheadOfSyncedTime) {
 
     sampler.loop();
     config.populateSynchronisation(&sync);
-    ASSERT_FLOAT_EQ(sync.calibrationFactor, 1.0);
+    ASSERT_EQ(sync.driftPpm, 0);
     ASSERT_EQ(sync.syncTime,1612100000);
     ASSERT_EQ(sync.nominalElapsed, 200);
     ASSERT_EQ(ESP.getSleepTime(), (uint64_t) 200000000);
 
     sampler.loop();
     config.populateSynchronisation(&sync);
-    ASSERT_FLOAT_EQ(sync.calibrationFactor, 1.0);
+    ASSERT_EQ(sync.driftPpm, 0);
     ASSERT_EQ(sync.syncTime,1612100000);
     ASSERT_EQ(sync.nominalElapsed, 400);
     ASSERT_EQ(ESP.getSleepTime(), (uint64_t) 200000000);
@@ -883,28 +1060,28 @@ TEST_F(SamplerNtpSyncTest, RtcClockRunsAheadOfSyncedTime) {
     sampler.synchronise(1612100360);
     sampler.loop();
     config.populateSynchronisation(&sync);
-    ASSERT_FLOAT_EQ(sync.calibrationFactor, 1.11111111);
+    ASSERT_EQ(sync.driftPpm, 111111);
     ASSERT_EQ(sync.syncTime,1612100360);
     ASSERT_EQ(sync.nominalElapsed, 240);
     //Assert sleeptime is 200 + 40 seconds*1.1111111...
-    ASSERT_EQ(ESP.getSleepTime(), (uint64_t) 266667000);
+    ASSERT_EQ(ESP.getSleepTime(), (uint64_t) 266666640);
 
     sampler.loop();
     config.populateSynchronisation(&sync);
-    ASSERT_FLOAT_EQ(sync.calibrationFactor, 1.11111111);
+    ASSERT_EQ(sync.driftPpm, 111111);
     ASSERT_EQ(sync.syncTime,1612100360);
     ASSERT_EQ(sync.nominalElapsed, 440);
     //Assert next sleep time is 200 * 0.909090909
-    ASSERT_EQ(ESP.getSleepTime(), (uint64_t) 222222000);
+    ASSERT_EQ(ESP.getSleepTime(), (uint64_t) 222222200);
 
     sampler.synchronise(1612100796);
     sampler.loop();
     config.populateSynchronisation(&sync);
-    ASSERT_FLOAT_EQ(sync.calibrationFactor, 1.1213047910);
+    ASSERT_EQ(sync.driftPpm, 121305);
     ASSERT_EQ(sync.syncTime,1612100796);
     ASSERT_EQ(sync.nominalElapsed, 204);
     //Assert sleeptime is 200 + 4 seconds*1.12233445566...
-    ASSERT_EQ(ESP.getSleepTime(), (uint64_t) 228746000);
+    ASSERT_EQ(ESP.getSleepTime(), (uint64_t) 228746220);
 }
 
 
@@ -913,54 +1090,54 @@ TEST_F(SamplerNtpSyncTest, RtcClockRunsAheadOfSyncedTimeWithProcessingTime) {
     Sampler sampler(config);
     Synchronisation sync;
     config.setParameters(200000,0,1,1);
-    ticks = 123;
+    fakeTicks() = 123;
     sampler.setup();
     sampler.synchronise(1612100000);
 
-    ticks = 2123;
+    fakeTicks() = 2123;
     sampler.loop();
     config.populateSynchronisation(&sync);
-    ASSERT_FLOAT_EQ(sync.calibrationFactor, 1.0);
+    ASSERT_EQ(sync.driftPpm, 0);
     ASSERT_EQ(sync.syncTime,1612100000);
     ASSERT_EQ(sync.nominalElapsed, 200);
     ASSERT_EQ(ESP.getSleepTime(), (uint64_t) 198000000);
 
-    ticks = 4123;
+    fakeTicks() = 4123;
     sampler.loop();
     config.populateSynchronisation(&sync);
-    ASSERT_FLOAT_EQ(sync.calibrationFactor, 1.0);
+    ASSERT_EQ(sync.driftPpm, 0);
     ASSERT_EQ(sync.syncTime,1612100000);
     ASSERT_EQ(sync.nominalElapsed, 400);
     ASSERT_EQ(ESP.getSleepTime(), (uint64_t) 198000000);
 
-    ticks = 6123;
+    fakeTicks() = 6123;
     sampler.synchronise(1612100362);
     sampler.loop();
     config.populateSynchronisation(&sync);
-    ASSERT_FLOAT_EQ(sync.calibrationFactor, 1.11111111);
+    ASSERT_EQ(sync.driftPpm, 111111);
     ASSERT_EQ(sync.syncTime,1612100360);
     ASSERT_EQ(sync.nominalElapsed, 240);
     //Assert sleeptime is 200 + 40 -2 seconds*1.1111111...
-    ASSERT_EQ(ESP.getSleepTime(), (uint64_t) 264444000);
+    ASSERT_EQ(ESP.getSleepTime(), (uint64_t) 264444418);
 
-    ticks = 8123;
+    fakeTicks() = 8123;
     sampler.loop();
     config.populateSynchronisation(&sync);
-    ASSERT_FLOAT_EQ(sync.calibrationFactor, 1.11111111);
+    ASSERT_EQ(sync.driftPpm, 111111);
     ASSERT_EQ(sync.syncTime,1612100360);
     ASSERT_EQ(sync.nominalElapsed, 440);
     //Assert next sleep time is 200 -2 * 1.111111111
-    ASSERT_EQ(ESP.getSleepTime(), (uint64_t) 220000000);
+    ASSERT_EQ(ESP.getSleepTime(), (uint64_t) 219999978);
 
-    ticks = 10123;
+    fakeTicks() = 10123;
     sampler.synchronise(1612100798);
     sampler.loop();
     config.populateSynchronisation(&sync);
-    ASSERT_FLOAT_EQ(sync.calibrationFactor, 1.1213047910);
+    ASSERT_EQ(sync.driftPpm, 121305);
     ASSERT_EQ(sync.syncTime,1612100796);
     ASSERT_EQ(sync.nominalElapsed, 204);
     //Assert sleeptime is 200 + 4 -2  seconds*1.1213047910...
-    ASSERT_EQ(ESP.getSleepTime(), (uint64_t) 226504000);
+    ASSERT_EQ(ESP.getSleepTime(), (uint64_t) 226503610);
 }
 
 
@@ -977,7 +1154,7 @@ TEST_F(SamplerNtpSyncTest, RtcClockRunsAheadOfSyncedTimeLoop) {
     sampler.onTransmit(&SamplerNtpSyncTest::transmit);
     uint32_t time = 3825000000;
     for (int i=1; i <= 120; i++) {
-        ticks=0;
+        fakeTicks()=0;
         sampler.setup();
         SamplerNtpSyncTest::presyncMillis = 4000;
         SamplerNtpSyncTest::postsyncMillis = 6000;
@@ -1001,7 +1178,7 @@ TEST_F(SamplerNtpSyncTest, RtcClockRunsBehindSyncedTimeLoop) {
     sampler.onTransmit(&SamplerNtpSyncTest::transmit);
     uint32_t time = 3825000000;
     for (int i=1; i <= 120; i++) {
-        ticks=0;
+        fakeTicks()=0;
         sampler.setup();
         SamplerNtpSyncTest::presyncMillis = 4000;
         SamplerNtpSyncTest::postsyncMillis = 6000;
@@ -1029,32 +1206,32 @@ TEST_F(SamplerNtpSyncTest, RtcClockRunsAheadOfSyncedTimeByMoreThanInterval) {
 
     uint32_t time = 3825000000;
     for (int i=1; i <= 2; i++) {
-        ticks=0;
+        fakeTicks()=0;
         sampler.setup();
         SamplerNtpSyncTest::syncTimeSeconds = time + 2;
         sampler.loop();
         time += millis() /1000UL;
         time += (uint32_t)((unsigned long)round(ESP.getSleepTime() * 0.9) /1000000UL);
     }
-    ASSERT_EQ(time, 3825000020);
+    ASSERT_EQ(time, 3825000019);
     config.populateSynchronisation(&sync);
-    ASSERT_FLOAT_EQ(sync.calibrationFactor, 1.111111111);
+    ASSERT_EQ(sync.driftPpm, 111111);
 
     SamplerNtpSyncTest::doSync = false;
     for (int i=1; i <= 12; i++) {
-        ticks=0;
+        fakeTicks()=0;
         sampler.setup();
         SamplerNtpSyncTest::syncTimeSeconds = time + 2;
         sampler.loop();
         time += millis() /1000UL;
         time += (uint32_t)((unsigned long)round(ESP.getSleepTime() * 1.111111111) /1000000UL);
     }
-    ASSERT_EQ(time, 3825000152);
+    ASSERT_EQ(time, 3825000151);
     config.populateSynchronisation(&sync);
-    ASSERT_FLOAT_EQ(sync.calibrationFactor, 1.111111111);
+    ASSERT_EQ(sync.driftPpm, 111111);
 
     SamplerNtpSyncTest::doSync = true;
-    ticks=0;
+    fakeTicks()=0;
     sampler.setup();
     SamplerNtpSyncTest::syncTimeSeconds = time + 2;
     sampler.loop();
@@ -1063,9 +1240,9 @@ TEST_F(SamplerNtpSyncTest, RtcClockRunsAheadOfSyncedTimeByMoreThanInterval) {
 
     config.populateSynchronisation(&sync);
     ASSERT_EQ(sync.nominalElapsed,0);
-    ASSERT_EQ(time, 3825000157);
+    ASSERT_EQ(time, 3825000156);
 
-    ticks=0;
+    fakeTicks()=0;
     sampler.setup();
     SamplerNtpSyncTest::syncTimeSeconds = time + 2;
     sampler.loop();
@@ -1075,7 +1252,51 @@ TEST_F(SamplerNtpSyncTest, RtcClockRunsAheadOfSyncedTimeByMoreThanInterval) {
     config.populateSynchronisation(&sync);
 
     ASSERT_EQ(sync.nominalElapsed,10);
-    ASSERT_EQ(time, 3825000167);
+    ASSERT_EQ(time, 3825000166);
+}
+
+TEST_F(SamplerNtpSyncTest, SubSecondIntervalCalibratesWithoutTruncation) {
+    Configuration config;
+    Sampler sampler(config);
+    Synchronisation sync;
+    config.setParameters(1500,0,1,1);
+    SamplerNtpSyncTest::presyncMillis = 200;
+    SamplerNtpSyncTest::postsyncMillis = 100;
+    SamplerNtpSyncTest::sampler = &sampler;
+    sampler.onTransmit(&SamplerNtpSyncTest::transmit);
+
+    // RTC runs 1% slow; synchronise once every 1000 wakes (~25 minutes).
+    uint64_t timeMs = 3825000000000ULL;
+    for (int i=0; i <= 2000; i++) {
+        fakeTicks()=0;
+        sampler.setup();
+        SamplerNtpSyncTest::doSync = (i % 1000 == 0);
+        SamplerNtpSyncTest::syncTimeSeconds = (uint32_t) ((timeMs + 200) / 1000);
+        sampler.loop();
+        timeMs += millis();
+        timeMs += ESP.getSleepTime() * 101 / 100000;
+    }
+    config.populateSynchronisation(&sync);
+    ASSERT_NEAR(sync.driftPpm, -9901, 1000);
+}
+
+TEST_F(SamplerNtpSyncTest, DriftMeasuredAfterFiftyDaysUnsynchronised) {
+    Configuration config;
+    Sampler sampler(config);
+    Synchronisation sync;
+    config.setParameters(3600000,0,1,1);
+    sampler.setup();
+    sampler.synchronise(1612100000);
+    sampler.loop();
+    for (int i=1; i < 60 * 24; i++) config.incrementElapsed(3600000);
+    config.save();
+
+    // 60 days nominal, 60 days and 5184 s by the server: 1000 ppm slow.
+    sampler.setup();
+    sampler.synchronise(1612100000 + 60 * 86400 + 5184);
+    config.populateSynchronisation(&sync);
+    ASSERT_EQ(1612100000 + 60 * 86400 + 5184, sync.syncTime);
+    ASSERT_EQ(-999, sync.driftPpm);
 }
 
 TEST_F(SamplerNtpSyncTest, CheckCasting) {
@@ -1086,6 +1307,727 @@ TEST_F(SamplerNtpSyncTest, CheckCasting) {
     ASSERT_FALSE(sleepTime == 0);
 }
 
+TEST_F(SamplerEventTest, ExternalWakeSamplesAndSleepsOutRemainder) {
+    Configuration config;
+    EventSampler sampler(config);
+    config.setParameters(60000,0,1,2);
+    sampler.onTakeSample(&SamplerTest::takeSample);
+    sampler.onTransmit(&SamplerTest::transmit);
+    sampler.onEvent(&SamplerEventTest::event);
+    sampler.setup();
+
+    sampler.loop();
+    ASSERT_EQ(ESP.getSleepTime(), (uint64_t) 60000000);
+    ASSERT_EQ(ESP.getSleepMode(), RF_DEFAULT);
+    ASSERT_EQ(2, config.getCounter());
+    ASSERT_FALSE(SamplerEventTest::eventCalled);
+
+    wakeExternally(sampler, 20000000);
+    ASSERT_EQ(WAKE_CAUSE_EXTERNAL, sampler.getWakeCause());
+    SamplerTest::returnedSample = 3;
+    sampler.loop();
+    ASSERT_TRUE(SamplerEventTest::eventCalled);
+    ASSERT_EQ(3, SamplerEventTest::eventSample);
+    ASSERT_TRANSMIT_NOT_CALLED();
+    ASSERT_EQ(2, config.getCounter());
+    ASSERT_EQ(ESP.getSleepTime(), (uint64_t) 40000000);
+    ASSERT_EQ(ESP.getSleepMode(), RF_DEFAULT);
+
+    wake(REASON_DEEP_SLEEP_AWAKE, 60000000);
+    sampler.setup();
+    ASSERT_EQ(WAKE_CAUSE_TIMER, sampler.getWakeCause());
+    sampler.loop();
+    ASSERT_TRANSMIT1_CALLED(0);
+    ASSERT_EQ(3, config.getCounter());
+    ASSERT_EQ(ESP.getSleepTime(), (uint64_t) 60000000);
+    ASSERT_EQ(ESP.getSleepMode(), RF_DISABLED);
+}
+
+TEST_F(SamplerEventTest, ExternalWakeAccountsForEventProcessingTime) {
+    Configuration config;
+    EventSampler sampler(config);
+    config.setParameters(60000,0,1,1);
+    sampler.onEvent([](uint16_t sample) { fakeRtcTicks() += 5000000; });
+    sampler.setup();
+    sampler.loop();
+
+    wakeExternally(sampler, 50000000);
+    sampler.loop();
+    ASSERT_EQ(ESP.getSleepTime(), (uint64_t) 5000000);
+}
+
+TEST_F(SamplerEventTest, ExternalWakeWhenScheduledWakeIsDueRunsNormalCycle) {
+    Configuration config;
+    EventSampler sampler(config);
+    config.setParameters(60000,0,1,1);
+    sampler.onTransmit(&SamplerTest::transmit);
+    sampler.onEvent(&SamplerEventTest::event);
+    sampler.setup();
+    sampler.loop();
+    SamplerTest::transmitCalled = false;
+
+    wakeExternally(sampler, 60000000);
+    sampler.loop();
+    ASSERT_FALSE(SamplerEventTest::eventCalled);
+    ASSERT_TRUE(SamplerTest::transmitCalled);
+    ASSERT_EQ(3, config.getCounter());
+    ASSERT_EQ(ESP.getSleepTime(), (uint64_t) 60000000);
+}
+
+TEST_F(SamplerEventTest, ExternalWakeHandlesRtcTimerWrap) {
+    Configuration config;
+    EventSampler sampler(config);
+    config.setParameters(3600000,1000,5,3);
+    sampler.onEvent(&SamplerEventTest::event);
+    fakeRtcTicks() = 0xFFFFFFFFULL - 10000000ULL;
+    sampler.setup();
+    for (int i=0; i < 5; i++) sampler.loop();
+    ASSERT_EQ(ESP.getSleepTime(), (uint64_t) 3596000000);
+
+    wakeExternally(sampler, 0xFFFFFFFFULL - 10000000ULL + 1000000000ULL);
+    sampler.loop();
+    ASSERT_TRUE(SamplerEventTest::eventCalled);
+    ASSERT_EQ(6, config.getCounter());
+    ASSERT_EQ(ESP.getSleepTime(), (uint64_t) 2596000000);
+    ASSERT_EQ(ESP.getSleepMode(), RF_DISABLED);
+}
+
+TEST_F(SamplerEventTest, ResetWhileAwakeOnEsp8266IsNotAnEvent) {
+    Configuration config;
+    Sampler sampler(config);
+    config.setParameters(60000,0,1,2);
+    sampler.onEvent(&SamplerEventTest::event);
+    sampler.setup();
+    sampler.loop();
+
+    wake(REASON_EXT_SYS_RST, 0);
+    sampler.setup();
+    ASSERT_EQ(WAKE_CAUSE_RESET, sampler.getWakeCause());
+    sampler.loop();
+    ASSERT_FALSE(SamplerEventTest::eventCalled);
+}
+
+TEST_F(SamplerEventTest, PowerOnResetRunsNormalCycle) {
+    Configuration config;
+    Sampler sampler(config);
+    config.setParameters(60000,0,1,1);
+    sampler.onEvent(&SamplerEventTest::event);
+    sampler.setup();
+    ASSERT_EQ(WAKE_CAUSE_RESET, sampler.getWakeCause());
+    sampler.loop();
+    ASSERT_FALSE(SamplerEventTest::eventCalled);
+    ASSERT_EQ(2, config.getCounter());
+}
+
+TEST_F(SamplerTimestampTest, TransmitReceivesTimeOfEachMeasurement) {
+    Configuration config;
+    Sampler sampler(config);
+    config.setParameters(60000,0,1,3);
+    sampler.onTimestampedTransmit(&SamplerTimestampTest::transmit);
+    sampler.setup();
+    sampler.synchronise(1612100000);
+    sampler.setup();
+
+    sampler.loop();
+    sampler.loop();
+    ASSERT_FALSE(SamplerTimestampTest::transmitCalled);
+    sampler.loop();
+    ASSERT_TRUE(SamplerTimestampTest::transmitCalled);
+    ASSERT_EQ(1612100000, SamplerTimestampTest::baseTime);
+    ASSERT_EQ(0, SamplerTimestampTest::deltas[0]);
+    ASSERT_EQ(60, SamplerTimestampTest::deltas[1]);
+    ASSERT_EQ(60, SamplerTimestampTest::deltas[2]);
+
+    SamplerTimestampTest::transmitCalled = false;
+    sampler.loop();
+    sampler.loop();
+    sampler.loop();
+    ASSERT_TRUE(SamplerTimestampTest::transmitCalled);
+    ASSERT_EQ(1612100180, SamplerTimestampTest::baseTime);
+    ASSERT_EQ(60, SamplerTimestampTest::deltas[2]);
+}
+
+TEST_F(SamplerTimestampTest, TimestampsFollowSamplesWithMeasurementsAndProcessingTime) {
+    Configuration config;
+    Sampler sampler(config);
+    config.setParameters(3600000,5000,3,2);
+    sampler.onTakeSample(&SamplerTest::takeSample);
+    sampler.onTakeMeasurement(&SamplerTest::takeMeasurement);
+    sampler.onTimestampedTransmit(&SamplerTimestampTest::transmit);
+    sampler.setup();
+    sampler.synchronise(1612100000);
+
+    SamplerTest::returnedMeasurement = 5;
+    for (int i=0; i < 3; i++) {
+        fakeTicks() = 0;
+        sampler.setup();
+        fakeTicks() = 2500;
+        sampler.loop();
+    }
+    SamplerTest::returnedMeasurement = 6;
+    for (int i=0; i < 3; i++) {
+        fakeTicks() = 0;
+        sampler.setup();
+        fakeTicks() = 2500;
+        sampler.loop();
+    }
+    ASSERT_TRUE(SamplerTimestampTest::transmitCalled);
+    ASSERT_EQ(5, SamplerTimestampTest::measurements[0]);
+    ASSERT_EQ(6, SamplerTimestampTest::measurements[1]);
+    ASSERT_EQ(1612100012, SamplerTimestampTest::baseTime);
+    ASSERT_EQ(0, SamplerTimestampTest::deltas[0]);
+    ASSERT_EQ(3600, SamplerTimestampTest::deltas[1]);
+}
+
+TEST_F(SamplerTimestampTest, LongGapsSaturateDelta) {
+    Configuration config;
+    Sampler sampler(config);
+    config.setParameters(3600000,0,1,2);
+    sampler.onTimestampedTransmit(&SamplerTimestampTest::transmit);
+    sampler.setup();
+    sampler.synchronise(1612100000);
+    sampler.setup();
+    sampler.loop();
+    config.incrementElapsed(70000000);
+    config.save();
+    sampler.setup();
+    sampler.loop();
+    ASSERT_TRUE(SamplerTimestampTest::transmitCalled);
+    ASSERT_EQ(65535, SamplerTimestampTest::deltas[1]);
+}
+
+TEST_F(SamplerRadioTest, CalibratesEveryNthRadioWake) {
+    for (int i=0; i < 3; i++) {
+        ASSERT_EQ(RF_NO_CAL, wake(1, 4));
+        ASSERT_EQ(RF_NO_CAL, wake(1, 4));
+        ASSERT_EQ(RF_NO_CAL, wake(1, 4));
+        ASSERT_EQ(RF_CAL, wake(1, 4));
+    }
+}
+
+TEST_F(SamplerRadioTest, OnlyRadioWakesCount) {
+    for (int i=0; i < 2; i++) {
+        ASSERT_EQ(RF_NO_CAL, wake(2, 2));
+        ASSERT_EQ(RF_DISABLED, wake(2, 2));
+        ASSERT_EQ(RF_CAL, wake(2, 2));
+        ASSERT_EQ(RF_DISABLED, wake(2, 2));
+    }
+}
+
+TEST_F(SamplerRadioTest, BatteryVoltageChangeForcesCalibration) {
+    ASSERT_EQ(RF_NO_CAL, wake(1, 10));
+    SamplerRadioTest::millivolts = 3850;
+    ASSERT_EQ(RF_NO_CAL, wake(1, 10));
+    SamplerRadioTest::millivolts = 3790;
+    ASSERT_EQ(RF_CAL, wake(1, 10));
+    // Now measured from the voltage at that calibration.
+    SamplerRadioTest::millivolts = 3650;
+    ASSERT_EQ(RF_NO_CAL, wake(1, 10));
+    SamplerRadioTest::millivolts = 4000;
+    ASSERT_EQ(RF_CAL, wake(1, 10));
+
+    Configuration config;
+    Radio radio;
+    ASSERT_TRUE(config.fromMemory());
+    config.populateRadio(&radio);
+    ASSERT_EQ(4000, radio.calibrationMillivolts);
+    ASSERT_EQ(0, radio.wakesSinceCalibration);
+}
+
+TEST_F(SamplerRadioTest, ConnectionFailureForcesCalibration) {
+    ASSERT_EQ(RF_NO_CAL, wake(1, 10));
+    SamplerRadioTest::connected = false;
+    ASSERT_EQ(RF_CAL, wake(1, 10));
+    ASSERT_EQ(RF_CAL, wake(1, 10));
+    SamplerRadioTest::connected = true;
+    ASSERT_EQ(RF_NO_CAL, wake(1, 10));
+}
+
+TEST_F(SamplerRadioTest, DefaultModeWithoutPolicy) {
+    ASSERT_EQ(RF_DEFAULT, wake(2, 0));
+    ASSERT_EQ(RF_DISABLED, wake(2, 0));
+    ASSERT_EQ(RF_DEFAULT, wake(2, 0));
+}
+
+TEST_F(SamplerTest, SlotForIsDeterministicPerDevice) {
+    ASSERT_EQ(Sampler::slotFor("sensor1"), Sampler::slotFor("sensor1"));
+    ASSERT_NE(Sampler::slotFor("sensor1"), Sampler::slotFor("sensor2"));
+    ASSERT_EQ(2166136261UL, Sampler::slotFor(""));
+}
+
+TEST_F(SamplerTest, FirstTransmitAfterPowerOnWaitsForSlot) {
+    Configuration config;
+    Sampler sampler(config);
+    config.setParameters(10000,0,1,1);
+    sampler.onTransmit(&SamplerTest::transmit);
+    sampler.slotTransmits(4000);
+    SamplerTest::transmitCalled = false;
+    fakeTicks() = 0;
+    sampler.setup();
+
+    sampler.loop();
+    ASSERT_TRANSMIT_NOT_CALLED();
+    ASSERT_EQ(1, config.getCounter());
+    ASSERT_EQ(ESP.getSleepTime(), (uint64_t) 4000000);
+    for (int i=0; i < 3; i++) {
+        sampler.loop();
+        ASSERT_TRUE(SamplerTest::transmitCalled);
+        SamplerTest::transmitCalled = false;
+        ASSERT_EQ(ESP.getSleepTime(), (uint64_t) 10000000);
+    }
+}
+
+TEST_F(SamplerTest, PowerOnSlotWaitAllowsForWakesBeforeTransmit) {
+    Configuration config;
+    Sampler sampler(config);
+    config.setParameters(60000,5000,3,2);
+    sampler.slotTransmits(30000);
+    fakeTicks() = 0;
+    sampler.setup();
+
+    // The first transmit wake is 70s after the first sample wake, so wait 80s to land it at 150s.
+    const uint32_t expected[] = {80000, 5000, 5000, 50000, 5000, 5000, 50000, 5000};
+    for (int i=0; i < 8; i++) {
+        sampler.loop();
+        ASSERT_EQ(ESP.getSleepTime(), (uint64_t) expected[i] * 1000) << "wake " << i + 1;
+    }
+}
+
+TEST_F(SamplerTest, AssignedOffsetConvergesAndKeepsSampleSpacing) {
+    Configuration config;
+    Sampler sampler(config);
+    config.setParameters(60000,5000,3,2);
+    sampler.onTakeSample(&SamplerTest::takeSample);
+    sampler.onTakeMeasurement(&SamplerTest::takeMeasurement);
+    sampler.onTransmit(&SamplerTest::transmit);
+    fakeTicks() = 0;
+    sampler.setup();
+    for (int i=0; i < 6; i++) sampler.loop();
+    config.fromJson("{transmitOffset: 30000}");
+    config.save();
+    sampler.setup();
+
+    // The transmit wake starts 190s in, 40s late for the slot, corrected by at most half of the 50s sleep.
+    const uint32_t expected[] = {5000, 5000, 50000, 5000, 5000, 25000,
+                                 5000, 5000, 50000, 5000, 5000, 35000,
+                                 5000, 5000, 50000, 5000, 5000, 50000};
+    for (int i=0; i < 18; i++) {
+        sampler.loop();
+        ASSERT_EQ(ESP.getSleepTime(), (uint64_t) expected[i] * 1000) << "wake " << i + 7;
+    }
+}
+
+TEST_F(SamplerTest, ServerAssignedTransmitOffsetTakesPrecedence) {
+    Configuration config;
+    Sampler sampler(config);
+    config.setParameters(10000,0,1,1);
+    config.fromJson("{transmitOffset: 5000}");
+    sampler.onTransmit(&SamplerTest::transmit);
+    sampler.slotTransmits(4000);
+    fakeTicks() = 0;
+    sampler.setup();
+
+    sampler.loop();
+    ASSERT_EQ(ESP.getSleepTime(), (uint64_t) 5000000);
+    sampler.loop();
+    ASSERT_EQ(ESP.getSleepTime(), (uint64_t) 10000000);
+}
+
+TEST_F(SamplerTest, NoSlottingLeavesScheduleAlone) {
+    Configuration config;
+    Sampler sampler(config);
+    config.setParameters(10000,0,1,1);
+    sampler.onTransmit(&SamplerTest::transmit);
+    fakeTicks() = 0;
+    sampler.setup();
+
+    sampler.loop();
+    ASSERT_EQ(ESP.getSleepTime(), (uint64_t) 10000000);
+}
+
+TEST_F(SamplerTest, ConfigStagedOnTransmitAppliesFromTheNextWake) {
+    Configuration config;
+    Sampler sampler(config);
+    Synchronisation sync;
+    config.setParameters(60000,5000,3,1);
+    config.resetSynchronisation(1700000000, 2000);
+    config.save();
+    sampler.onTakeSample(&SamplerTest::takeSample);
+    sampler.onTransmit([&](uint16_t* measurements, uint32_t n) {
+        Configuration update;
+        update.fromMemory();
+        update.fromJson("{measurementInterval: 30000, sampleInterval: 2000}");
+        config.stage(update);
+    });
+    fakeTicks() = 0;
+    sampler.setup();
+
+    const uint32_t expected[] = {5000, 5000, 50000, 2000, 2000, 26000};
+    for (int i=0; i < 6; i++) {
+        sampler.loop();
+        ASSERT_EQ(ESP.getSleepTime(), Sampler::calibratedMicros(expected[i], 2000)) << "wake " << i + 1;
+    }
+    config.populateSynchronisation(&sync);
+    ASSERT_EQ(1700000000, sync.syncTime);
+    ASSERT_EQ(2000, sync.driftPpm);
+    ASSERT_EQ(60 + 30, sync.nominalElapsed);
+}
+
+TEST_F(SamplerTest, RadioStartedOnlyOnTransmitWakes) {
+    Configuration config;
+    Sampler sampler(config);
+    int started = 0;
+    config.setParameters(60000,5000,3,1);
+    sampler.onTakeSample([&]() -> uint16_t {
+        SamplerTest::sampleCalled = started > 0;
+        return 1;
+    });
+    sampler.onTransmit(&SamplerTest::transmit);
+    sampler.onStartRadio([&]() { started++; });
+    SamplerTest::transmitCalled = false;
+    sampler.setup();
+
+    for (int i=0; i < 2; i++) sampler.loop();
+    ASSERT_EQ(0, started);
+    ASSERT_TRANSMIT_NOT_CALLED();
+    sampler.loop();
+    ASSERT_EQ(1, started);
+    ASSERT_TAKE_SAMPLE_CALLED();        // the radio was started before the sample was taken.
+    ASSERT_TRUE(SamplerTest::transmitCalled);
+}
+
+TEST_F(SamplerTest, EarlyRadioOverlapsAssociationWithSampling) {
+    Configuration config;
+    Sampler sampler(config);
+    config.setParameters(60000,5000,1,1);
+    sampler.onTakeSample([]() -> uint16_t {
+        fakeTicks() += 400;
+        return 1;
+    });
+    sampler.onTakeMeasurement(&SamplerTest::takeMeasurement);
+    sampler.onTransmit([](uint16_t* measurements, uint32_t n) {
+        WiFi.begin("ssid", "password");
+        while (WiFi.status() != WL_CONNECTED) delay(50);
+    });
+
+    WiFi.reset();
+    WiFi.associationMs = 1200;
+    fakeTicks() = 0;
+    sampler.setup();
+    sampler.loop();
+    ASSERT_EQ(400 + 1200, fakeTicks());
+
+    sampler.onStartRadio([]() { WiFi.begin("ssid", "password"); });
+    WiFi.reset();
+    WiFi.associationMs = 1200;
+    fakeTicks() = 0;
+    sampler.setup();
+    sampler.loop();
+    ASSERT_EQ(1200, fakeTicks());
+    WiFi.reset();
+}
+
+TEST_F(SamplerTest, HungTransmitIsAbortedAtItsBudget) {
+    Configuration config;
+    Sampler sampler(config);
+    config.setParameters(60000,5000,3,2);
+    sampler.onTakeSample(&SamplerTest::takeSample);
+    sampler.onTakeMeasurement(&SamplerTest::takeMeasurement);
+    sampler.onTransmit([](uint16_t* measurements, uint32_t n) {
+        for (int i=0; i < 300; i++) delay(100);     // WiFi never associates.
+    });
+    sampler.limitAwakeTime(100, 200, 5000);
+    fakeTicks() = 0;
+    sampler.setup();
+    for (int i=0; i < 5; i++) sampler.loop();
+    fakeTicks() = 0;
+    sampler.setup();
+
+    sampler.loop();
+    ASSERT_EQ(ESP.getSleepTime(), (uint64_t) 45000000);
+    Overrun overrun;
+    Configuration saved;
+    ASSERT_TRUE(saved.fromMemory());
+    saved.populateOverrun(&overrun);
+    ASSERT_EQ(1, overrun.count);
+    ASSERT_EQ(WAKE_SAMPLE | WAKE_MEASUREMENT | WAKE_TRANSMIT, overrun.flags);
+    ASSERT_EQ(7, saved.getCounter());
+    ASSERT_EQ(0, fakeTimerYields());            // slept from the watchdog without yielding.
+
+    fakeTicks() = 0;
+    sampler.setup();
+    sampler.loop();
+    ASSERT_EQ(ESP.getSleepTime(), (uint64_t) 5000000);
+    ASSERT_EQ(8, config.getCounter());
+}
+
+TEST_F(SamplerTest, SlowSampleOverrunsSampleBudget) {
+    Configuration config;
+    Sampler sampler(config);
+    config.setParameters(60000,5000,3,2);
+    sampler.onTakeSample([]() -> uint16_t {
+        delay(500);                 // the watchdog can only run once the sample yields.
+        return 1;
+    });
+    sampler.limitAwakeTime(100, 1000, 5000);
+    fakeTicks() = 0;
+    sampler.setup();
+
+    sampler.loop();
+    ASSERT_EQ(ESP.getSleepTime(), (uint64_t) 4500000);
+    Overrun overrun;
+    config.populateOverrun(&overrun);
+    ASSERT_EQ(1, overrun.count);
+    ASSERT_EQ(WAKE_SAMPLE, overrun.flags);
+
+    // A measurement wake has the larger budget.
+    fakeTicks() = 0;
+    sampler.setup();
+    sampler.loop();
+    fakeTicks() = 0;
+    sampler.setup();
+    sampler.loop();
+    ASSERT_EQ(ESP.getSleepTime(), (uint64_t) 49500000);
+    config.populateOverrun(&overrun);
+    ASSERT_EQ(2, overrun.count);
+    config.clearOverrun();
+    config.populateOverrun(&overrun);
+    ASSERT_EQ(0, overrun.count);
+}
+
+TEST_F(SamplerTest, WakeWithinBudgetIsNotAborted) {
+    Configuration config;
+    Sampler sampler(config);
+    config.setParameters(10000,0,1,1);
+    sampler.onTransmit([](uint16_t* measurements, uint32_t n) {
+        delay(900);
+    });
+    sampler.limitAwakeTime(100, 100, 1000);
+    fakeTicks() = 0;
+    sampler.setup();
+
+    sampler.loop();
+    ASSERT_EQ(ESP.getSleepTime(), (uint64_t) 9100000);
+    fakeTicks() += 5000;                  // long after the wake - the watchdog was stopped.
+    yield();
+    ASSERT_EQ(ESP.getSleepTime(), (uint64_t) 9100000);
+    Overrun overrun;
+    config.populateOverrun(&overrun);
+    ASSERT_EQ(0, overrun.count);
+}
+
+TEST_F(SamplerTest, KeepAwakeLiftsTheBudget) {
+    Configuration config;
+    Sampler sampler(config);
+    config.setParameters(10000,0,1,1);
+    sampler.onTransmit([&sampler](uint16_t* measurements, uint32_t n) {
+        sampler.keepAwake();
+        delay(3000);                // an OTA update.
+    });
+    sampler.limitAwakeTime(100, 100, 1000);
+    fakeTicks() = 0;
+    sampler.setup();
+
+    sampler.loop();
+    ASSERT_EQ(ESP.getSleepTime(), (uint64_t) 7000000);
+    Overrun overrun;
+    config.populateOverrun(&overrun);
+    ASSERT_EQ(0, overrun.count);
+}
+
+// What a wake did, to compare a BasicSampler policy with the std::function callbacks.
+typedef struct {
+    uint16_t samples;
+    uint16_t transmitted[4];
+    uint32_t baseTime;
+    uint16_t deltas[4];
+    uint64_t sleepTime;
+} WakeRecord;
+
+static WakeRecord* wakeRecord;
+
+static uint16_t recordSample() {
+    fakeTicks() += 3;
+    return ++wakeRecord->samples;
+}
+static uint16_t sumSamples(uint16_t* samples, uint32_t n) {
+    uint16_t sum = 0;
+    for (uint32_t i=0; i < n; i++) sum += samples[i];
+    return sum;
+}
+static void recordTransmit(uint16_t* measurements, uint32_t n, uint32_t baseTime, uint16_t* deltas) {
+    memcpy(wakeRecord->transmitted, measurements, n * sizeof(uint16_t));
+    memcpy(wakeRecord->deltas, deltas, n * sizeof(uint16_t));
+    wakeRecord->baseTime = baseTime;
+    fakeTicks() += 1200;
+}
+
+struct RecordingPolicy : SamplerPolicy {
+    bool takeSample(uint16_t& sample) {
+        sample = recordSample();
+        return true;
+    }
+    bool takeMeasurement(uint16_t* samples, uint32_t n, uint16_t& measurement) {
+        measurement = sumSamples(samples, n);
+        return true;
+    }
+    bool timestamps() { return true; }
+    void transmitTimestamped(uint16_t* measurements, uint32_t n, uint32_t baseTime, uint16_t* deltas) {
+        recordTransmit(measurements, n, baseTime, deltas);
+    }
+};
+
+template <class S>
+static void runWakes(S& sampler, Configuration& config, WakeRecord* records, int n) {
+    config.setParameters(60000,5000,3,2);
+    fakeTicks() = 0;
+    sampler.setup();
+    for (int i=0; i < n; i++) {
+        wakeRecord = &records[i];
+        if (i > 0) records[i].samples = records[i - 1].samples;
+        sampler.loop();
+        records[i].sleepTime = ESP.getSleepTime();
+    }
+}
+
+TEST_F(SamplerTest, PolicyRunsTheSameWakesAsCallbacks) {
+    WakeRecord expected[14], actual[14];
+    memset(expected, 0, sizeof(expected));
+    memset(actual, 0, sizeof(actual));
+    {
+        Configuration config;
+        Sampler sampler(config);
+        sampler.onTakeSample(recordSample);
+        sampler.onTakeMeasurement(sumSamples);
+        sampler.onTimestampedTransmit(recordTransmit);
+        runWakes(sampler, config, expected, 14);
+    }
+    uint32_t BadNumber = 0xDEADDEAD;
+    ESP.rtcUserMemoryWrite(OTA_OFFSET, &BadNumber, 4);
+    {
+        Configuration config;
+        BasicSampler<RecordingPolicy> sampler(config);
+        runWakes(sampler, config, actual, 14);
+    }
+    ASSERT_EQ(6, expected[5].samples);
+    ASSERT_EQ(6, expected[5].transmitted[0]);
+    ASSERT_EQ(15, expected[5].transmitted[1]);
+    ASSERT_EQ(0, memcmp(expected, actual, sizeof(expected)));
+}
+
+TEST_F(SamplerTest, DefaultPolicyKeepsTheSchedule) {
+    Configuration config;
+    BasicSampler<SamplerPolicy> sampler(config);
+    config.setParameters(60000,5000,3,2);
+    fakeTicks() = 0;
+    sampler.setup();
+
+    const uint32_t expected[] = {5000, 5000, 50000, 5000, 5000, 50000};
+    for (int i=0; i < 6; i++) {
+        sampler.loop();
+        ASSERT_EQ(ESP.getSleepTime(), (uint64_t) expected[i] * 1000) << "wake " << i + 1;
+    }
+    ASSERT_LT(sizeof(sampler), sizeof(Sampler));
+}
+
+#define UTC_MIDNIGHT 1612051200UL
+#define HOUR_MS 3600000ULL
+
+// Open 07:00 to 21:00 local time, an hour ahead of UTC: 06:00 to 20:00 UTC.
+#define WINDOW_CONFIG "{startTimeOfDay: 25200, activeTime: 50400, utcOffset: 3600}"
+
+TEST_F(SamplerTest, QuietHoursSleepStraightToTheWindow) {
+    Configuration config;
+    Sampler sampler(config);
+    int samples = 0;
+    config.setParameters(600000, 0, 1, 1);
+    config.fromJson(WINDOW_CONFIG);
+    config.resetSynchronisation(UTC_MIDNIGHT + 19 * 3600 + 50 * 60, 0);
+    sampler.setup();
+    sampler.onTakeSample([&]() -> uint16_t { return ++samples; });
+    sampler.onTransmit([](uint16_t* measurements, uint32_t n) {});
+
+    // 19:50 UTC runs as usual, then sleeps on past the closing at 20:00, as far as it can.
+    sampler.loop();
+    ASSERT_EQ(1, samples);
+    ASSERT_EQ(HOUR_MS * 1000, ESP.getSleepTime());
+    ASSERT_EQ(RF_DISABLED, ESP.getSleepMode());
+    uint16_t counter = config.getCounter();
+
+    // 20:50 to 04:50: an hour at a time, doing nothing else.
+    for (int i=0; i < 9; i++) {
+        sampler.loop();
+        ASSERT_EQ(HOUR_MS * 1000, ESP.getSleepTime());
+        ASSERT_EQ(RF_DISABLED, ESP.getSleepMode());
+    }
+    ASSERT_EQ(1, samples);
+    ASSERT_EQ(counter, config.getCounter());
+
+    // 05:50: the rest of the way, with the radio for the transmit at the opening.
+    sampler.loop();
+    ASSERT_EQ(600000000, ESP.getSleepTime());
+    ASSERT_EQ(RF_DEFAULT, ESP.getSleepMode());
+    sampler.loop();
+    ASSERT_EQ(2, samples);
+    ASSERT_EQ(counter + 1, config.getCounter());
+    ASSERT_EQ(600000000, ESP.getSleepTime());
+}
+
+TEST_F(SamplerTest, WindowCanRunPastMidnight) {
+    Configuration config;
+    Sampler sampler(config);
+    int samples = 0;
+    config.setParameters(600000, 0, 1, 1);
+    config.fromJson("{startTimeOfDay: 79200, activeTime: 14400}");     // 22:00 to 02:00 UTC.
+    config.resetSynchronisation(UTC_MIDNIGHT + 3600, 0);
+    sampler.setup();
+    sampler.onTakeSample([&]() -> uint16_t { return ++samples; });
+    sampler.loop();
+    ASSERT_EQ(1, samples);
+    ASSERT_EQ(600000000, ESP.getSleepTime());
+
+    config.resetSynchronisation(UTC_MIDNIGHT + 3 * 3600, 0);
+    config.save();
+    sampler.setup();
+    sampler.loop();
+    ASSERT_EQ(1, samples);
+    ASSERT_EQ(HOUR_MS * 1000, ESP.getSleepTime());
+}
+
+TEST_F(SamplerTest, ResyncMovesTheWaitForTheWindow) {
+    Configuration config;
+    Sampler sampler(config);
+    config.setParameters(600000, 0, 1, 1);
+    config.fromJson(WINDOW_CONFIG);
+    config.resetSynchronisation(UTC_MIDNIGHT + 4 * 3600, 0);
+    sampler.setup();
+    sampler.loop();
+    ASSERT_EQ(HOUR_MS * 1000, ESP.getSleepTime());
+
+    // The RTC ran slow, so the window is 30 minutes away, not an hour, and the RTC is corrected.
+    Synchronisation sync;
+    sampler.synchronise(UTC_MIDNIGHT + 5 * 3600 + 1800);
+    config.save();
+    config.populateSynchronisation(&sync);
+    ASSERT_LT(sync.driftPpm, 0);
+    sampler.setup();
+    sampler.loop();
+    ASSERT_EQ(Sampler::calibratedMicros(1800000, sync.driftPpm), ESP.getSleepTime());
+}
+
+TEST_F(SamplerTest, NoWindowUntilSynchronised) {
+    Configuration config;
+    Sampler sampler(config);
+    int samples = 0;
+    config.setParameters(600000, 0, 1, 1);
+    config.fromJson("{startTimeOfDay: 79200, activeTime: 3600}");
+    sampler.setup();
+    sampler.onTakeSample([&]() -> uint16_t { return ++samples; });
+    sampler.loop();
+    ASSERT_EQ(1, samples);
+    ASSERT_EQ(600000000, ESP.getSleepTime());
+}
+
 int main(int argc, char** argv) {
     testing::InitGoogleTest(&argc, argv);
     return RUN_ALL_TESTS();
@@ -0,0 +1,157 @@
+#define ESP8266
+#define Arduino_h
+#define WAKE_TRACE
+
+#include <gtest/gtest.h>
+#include "./fake/Esp.h"
+#include "../src/Espx.cpp"
+#include "../src/Format.cpp"
+#include "../src/Configuration.cpp"
+#include "../src/Log.cpp"
+#include "../src/Sampler.cpp"
+#include "../src/Trace.cpp"
+#include "../sim/TraceReplay.h"
+
+#define TRACE_CONFIG "{measurementInterval: 60000, sampleInterval: 5000, nSamples: 3, transmitFrequency: 2}"
+
+class TraceTest : public testing::Test {
+    protected:
+    virtual void SetUp() {
+        memset(fakeRtc(), 0xDE, sizeof(fakeRtc()));
+        fakeResetInfo().reason = REASON_DEFAULT_RST;
+        fakeTicks() = 0;
+        Trace::begin();
+    }
+
+    virtual void TearDown() {}
+
+    // Runs wakes of the TRACE_CONFIG schedule, each awake for awakeMs.
+    void run(int wakes, unsigned long awakeMs, int32_t driftPpm = 0) {
+        Configuration config;
+        Sampler sampler(config);
+        config.setParameters(180000, 5000, 5, 1);
+        config.fromJson(TRACE_CONFIG);
+        config.resetSynchronisation(0, driftPpm);
+        config.save();
+        sampler.setup();
+        sampler.onTransmit([](uint16_t* measurements, uint32_t n) {});
+        for (int i=0; i < wakes; i++) {
+            fakeTicks() += awakeMs;
+            sampler.loop();
+        }
+    }
+
+    TraceRecord record(uint16_t counter, uint8_t flags, uint32_t nominal, int32_t correction, uint32_t sleep) {
+        TraceRecord record = {counter, flags, 0, nominal, correction, sleep};
+        return record;
+    }
+};
+
+TEST_F(TraceTest, RingFitsAfterLogAndTransportStats) {
+    ASSERT_LE(TRACE_OFFSET * 4 + sizeof(TraceRing), DNS_OFFSET * 4);
+    ASSERT_GE((TRACE_OFFSET - LOG_OFFSET) * 4, sizeof(LogRing) + 16);
+    ASSERT_EQ(90, MAX_DATA_ELEMENTS);
+}
+
+TEST_F(TraceTest, SamplerRecordsEachWake) {
+    run(6, 20);
+    TraceRecord trace;
+    ASSERT_EQ(4, Trace::getCount());
+
+    ASSERT_TRUE(Trace::populateRecord(0, &trace));
+    ASSERT_EQ(3, trace.counter);
+    ASSERT_EQ(TRACE_SAMPLE | TRACE_MEASUREMENT, trace.flags);
+    ASSERT_EQ(50000, trace.nominalSleepTime);
+    ASSERT_EQ(20, trace.correctionTime);
+    ASSERT_EQ(49980, trace.sleepTime);
+
+    ASSERT_TRUE(Trace::populateRecord(2, &trace));
+    ASSERT_EQ(5, trace.counter);
+    ASSERT_EQ(TRACE_SAMPLE | TRACE_RADIO, trace.flags);
+    ASSERT_EQ(5000, trace.nominalSleepTime);
+
+    ASSERT_TRUE(Trace::populateRecord(3, &trace));
+    ASSERT_EQ(6, trace.counter);
+    ASSERT_EQ(TRACE_SAMPLE | TRACE_MEASUREMENT | TRACE_TRANSMIT, trace.flags);
+    ASSERT_FALSE(Trace::populateRecord(4, &trace));
+}
+
+TEST_F(TraceTest, SurvivesDeepSleep) {
+    run(2, 10);
+    TraceRing ring;
+    TraceRecord trace;
+    memcpy(&ring, fakeRtc() + TRACE_OFFSET * 4, sizeof(ring));
+    ASSERT_EQ(TRACE_MAGIC, ring.magic);
+    ASSERT_EQ(2, ring.count);
+    Trace::populateRecord(1, &trace);
+    ASSERT_EQ(0, memcmp(&trace, &ring.records[1], sizeof(trace)));
+}
+
+TEST_F(TraceTest, MsgRoundTrips) {
+    TraceRecord written[3] = {record(1, TRACE_SAMPLE, 5000, 12, 4988),
+                              record(2, TRACE_SAMPLE | TRACE_RADIO | TRACE_RF_CAL, 50000, -1500, 51500),
+                              record(65535, TRACE_EVENT, 3600000, 0, 3600000)};
+    for (int i=0; i < 3; i++) Trace::write(&written[i]);
+    char msg[200];
+    ASSERT_EQ(3 * 32, Trace::populateMsg(msg, sizeof(msg)));
+    ASSERT_EQ(3 * 32, strlen(msg));
+
+    TraceRecord read[4];
+    ASSERT_EQ(3, Trace::fromMsg(msg, read, 4));
+    ASSERT_EQ(0, memcmp(written, read, sizeof(written)));
+}
+
+TEST_F(TraceTest, MsgKeepsNewestWholeRecordsThatFit) {
+    for (uint16_t i=1; i <= 4; i++) {
+        TraceRecord written = record(i, 0, 1000, 0, 1000);
+        Trace::write(&written);
+    }
+    char msg[80];
+    ASSERT_EQ(64, Trace::populateMsg(msg, sizeof(msg)));
+    TraceRecord read[4];
+    ASSERT_EQ(2, Trace::fromMsg(msg, read, 4));
+    ASSERT_EQ(3, read[0].counter);
+    ASSERT_EQ(4, read[1].counter);
+}
+
+TEST_F(TraceTest, ReplayReproducesRecordedWakes) {
+    run(6, 35, -25000);
+    TraceRecord recorded, replayed;
+    uint8_t n = Trace::getCount();
+    TraceRecord records[TRACE_RING_SIZE];
+    for (uint8_t i=0; i < n; i++) Trace::populateRecord(i, &records[i]);
+
+    for (uint8_t i=0; i < n; i++) {
+        recorded = records[i];
+        ASSERT_TRUE(replayWake(TRACE_CONFIG, -25000, &recorded, &replayed));
+        ASSERT_TRUE(sameDecision(&recorded, &replayed)) << "counter " << recorded.counter;
+    }
+}
+
+TEST_F(TraceTest, ReplayReproducesNegativeCorrection) {
+    TraceRecord recorded = record(3, TRACE_SAMPLE | TRACE_MEASUREMENT, 50000, -4000, 54000);
+    TraceRecord replayed;
+    ASSERT_TRUE(replayWake(TRACE_CONFIG, 0, &recorded, &replayed));
+    ASSERT_TRUE(sameDecision(&recorded, &replayed));
+}
+
+TEST_F(TraceTest, ReplayShowsChangedSchedule) {
+    run(3, 10);
+    TraceRecord recorded, replayed;
+    Trace::populateRecord(2, &recorded);
+    ASSERT_TRUE(replayWake("{measurementInterval: 90000, sampleInterval: 5000, nSamples: 3, transmitFrequency: 2}",
+                           0, &recorded, &replayed));
+    ASSERT_FALSE(sameDecision(&recorded, &replayed));
+    ASSERT_EQ(80000, replayed.nominalSleepTime);
+}
+
+TEST_F(TraceTest, EventWakesAreNotReplayed) {
+    TraceRecord recorded = record(2, TRACE_EVENT, 40000, 0, 40000);
+    TraceRecord replayed;
+    ASSERT_FALSE(replayWake(TRACE_CONFIG, 0, &recorded, &replayed));
+}
+
+int main(int argc, char** argv) {
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
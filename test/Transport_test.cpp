@@ -0,0 +1,452 @@
+#define ESP8266
+#define Arduino_h
+
+#include <gtest/gtest.h>
+#include <string>
+#include "./fake/Esp.h"
+#include "./fake/PubSubClient.h"
+#include "./fake/LoopbackServer.h"
+#include "../src/Espx.cpp"
+#include "../src/Format.cpp"
+#include "../src/Payload.cpp"
+#include "../src/Configuration.cpp"
+#include "../src/Log.cpp"
+#include "../src/Transport.cpp"
+
+#define LOOPBACK "127.0.0.1"
+
+// A transport that takes a set (simulated) time to connect and send.
+class FakeTransport : public Transport {
+    public:
+    TransportType type;
+    Delivery delivery;
+    unsigned long connectMs;
+    unsigned long sendMs;
+    bool fails = false;
+    int sent = 0;
+
+    FakeTransport(TransportType type, Delivery delivery, unsigned long connectMs, unsigned long sendMs)
+        : type(type), delivery(delivery), connectMs(connectMs), sendMs(sendMs) {}
+    TransportType getType() { return type; }
+    Delivery getDelivery() { return delivery; }
+    bool connect() {
+        fakeTicks() += connectMs;
+        return !fails;
+    }
+    bool send(Payload& payload) {
+        fakeTicks() += sendMs;
+        sent++;
+        return true;
+    }
+};
+
+class TransportTest : public testing::Test {
+    public:
+    static std::string received;
+
+    static void receive(uint8_t* payload, size_t length) {
+        TransportTest::received = std::string((char*) payload, length);
+    }
+
+    protected:
+    virtual void SetUp() {
+        memset(fakeRtc(), 0xDE, sizeof(fakeRtc()));
+        TransportTest::received = "";
+        fakeTicks() = 0;
+        WiFi.reset();
+    }
+
+    virtual void TearDown() {}
+
+    bool sendString(Transport& transport, const char* payload) {
+        return transport.connect() && transport.send((const uint8_t*) payload, strlen(payload));
+    }
+};
+
+std::string TransportTest::received;
+
+// Measurements as text, longer than MSG_SIZE and PubSubClient's packet buffer.
+class LargePayload : public Payload {
+    public:
+    void writeTo(PayloadWriter& writer) {
+        writer.text("values:[");
+        for (uint32_t i=0; i < 200; i++) {
+            if (i > 0) writer.text(",");
+            writer.number(60000 + i);
+        }
+        writer.text("]");
+    }
+
+    std::string expected() {
+        std::string s = "values:[";
+        for (uint32_t i=0; i < 200; i++) s += (i > 0 ? "," : "") + std::to_string(60000 + i);
+        return s + "]";
+    }
+};
+
+class BinaryPayload : public Payload {
+    public:
+    void writeTo(PayloadWriter& writer) {
+        for (uint16_t i=0; i < 300; i++) writer.u16(i);
+    }
+    bool isBinary() { return true; }
+
+    std::string expected() {
+        std::string s;
+        for (uint16_t i=0; i < 300; i++) s += std::string(1, (char) (i & 0xFF)) + (char) (i >> 8);
+        return s;
+    }
+};
+
+TEST_F(TransportTest, StatsFitInRtcUserMemory) {
+    ASSERT_LE(TRANSPORT_OFFSET * 4 + sizeof(TransportStats), sizeof(fakeRtc()));
+}
+
+TEST_F(TransportTest, UdpTransportSendsDatagram) {
+    UdpLoopbackServer server;
+    WiFiUDP udp;
+    UdpTransport transport(udp, LOOPBACK, server.getPort());
+
+    ASSERT_EQ(DELIVERY_BEST_EFFORT, transport.getDelivery());
+    ASSERT_TRUE(sendString(transport, "{\"values\":[1,0,1]}"));
+    ASSERT_TRUE(server.waitForCount(1));
+    ASSERT_EQ("{\"values\":[1,0,1]}", server.getMessage(0));
+}
+
+TEST_F(TransportTest, HttpTransportPostsPayload) {
+    HttpLoopbackServer server(200, "{\"version\": 105}");
+    WiFiClient client;
+    HttpTransport transport(client, LOOPBACK, server.getPort(), "/sensor1");
+    transport.onReceive(TransportTest::receive);
+
+    ASSERT_EQ(DELIVERY_ACKNOWLEDGED, transport.getDelivery());
+    ASSERT_TRUE(sendString(transport, "{\"values\":[1,0,1]}"));
+    transport.disconnect();
+    ASSERT_EQ(1, server.getCount());
+    ASSERT_EQ("{\"values\":[1,0,1]}", server.getMessage(0));
+    ASSERT_EQ("/sensor1", server.getPath());
+    ASSERT_EQ("{\"version\": 105}", TransportTest::received);
+}
+
+TEST_F(TransportTest, HttpTransportFailsOnErrorStatus) {
+    HttpLoopbackServer server(503);
+    WiFiClient client;
+    HttpTransport transport(client, LOOPBACK, server.getPort());
+
+    ASSERT_FALSE(sendString(transport, "{}"));
+}
+
+TEST_F(TransportTest, HttpTransportFailsWithoutServer) {
+    uint16_t port;
+    {
+        HttpLoopbackServer server;
+        port = server.getPort();
+    }
+    WiFiClient client;
+    HttpTransport transport(client, LOOPBACK, port);
+
+    ASSERT_FALSE(transport.connect());
+}
+
+TEST_F(TransportTest, MqttTransportPublishesAndReceivesConfig) {
+    MqttLoopbackBroker broker("sensor1/config", "{\"version\": 105}");
+    WiFiClient client;
+    PubSubClient mqttClient(client);
+    MqttTransport transport(mqttClient, LOOPBACK, broker.getPort(), "sensor1", "sensor1/status", "sensor1/config");
+    transport.onReceive(TransportTest::receive);
+
+    ASSERT_EQ(DELIVERY_ACKNOWLEDGED, transport.getDelivery());
+    ASSERT_TRUE(sendString(transport, "{\"values\":[1,0,1]}"));
+    ASSERT_TRUE(broker.waitForCount(1));
+    ASSERT_EQ("{\"values\":[1,0,1]}", broker.getMessage(0));
+
+    for (int i=0; i < 200 && TransportTest::received.empty(); i++) {
+        transport.loop();
+        usleep(1000);
+    }
+    ASSERT_EQ("{\"version\": 105}", TransportTest::received);
+    transport.disconnect();
+    ASSERT_FALSE(transport.loop());
+}
+
+TEST_F(TransportTest, MqttTransportStopsWaitingOnceRetainedConfigArrives) {
+    MqttLoopbackBroker broker("sensor1/config", "{\"version\": 105}");
+    WiFiClient client;
+    PubSubClient mqttClient(client);
+    MqttTransport transport(mqttClient, LOOPBACK, broker.getPort(), "sensor1", "sensor1/status", "sensor1/config");
+    transport.onReceive(TransportTest::receive);
+    ASSERT_TRUE(sendString(transport, "{}"));
+
+    int polls = 0;
+    while (polls < 200 && transport.loop()) {
+        polls++;
+        usleep(1000);
+    }
+    ASSERT_LT(polls, 200);
+    ASSERT_EQ("{\"version\": 105}", TransportTest::received);
+    transport.disconnect();
+}
+
+TEST_F(TransportTest, MqttTransportStopsWaitingAtEndOfRetainedMarker) {
+    MqttLoopbackBroker broker;
+    WiFiClient client;
+    PubSubClient mqttClient(client);
+    MqttTransport transport(mqttClient, LOOPBACK, broker.getPort(), "sensor1", "sensor1/status", "sensor1/config");
+    transport.onReceive(TransportTest::receive);
+    ASSERT_TRUE(sendString(transport, "{}"));
+
+    int polls = 0;
+    while (polls < 200 && transport.loop()) {
+        polls++;
+        usleep(1000);
+    }
+    ASSERT_LT(polls, 200);
+    ASSERT_TRUE(TransportTest::received.empty());
+    ASSERT_TRUE(broker.waitForCount(1));
+    ASSERT_EQ(1, broker.getCount());
+    transport.disconnect();
+}
+
+TEST_F(TransportTest, MqttTransportWithoutInTopicExpectsNothing) {
+    MqttLoopbackBroker broker;
+    WiFiClient client;
+    PubSubClient mqttClient(client);
+    MqttTransport transport(mqttClient, LOOPBACK, broker.getPort(), "sensor1", "sensor1/status");
+    ASSERT_TRUE(sendString(transport, "{}"));
+    ASSERT_FALSE(transport.loop());
+    transport.disconnect();
+}
+
+TEST_F(TransportTest, UdpTransportStreamsLargePayload) {
+    UdpLoopbackServer server;
+    WiFiUDP udp;
+    UdpTransport transport(udp, LOOPBACK, server.getPort());
+    LargePayload payload;
+
+    ASSERT_TRUE(transport.connect() && transport.send(payload));
+    ASSERT_TRUE(server.waitForCount(1));
+    ASSERT_EQ(payload.expected(), server.getMessage(0));
+}
+
+TEST_F(TransportTest, HttpTransportStreamsBinaryPayload) {
+    HttpLoopbackServer server;
+    WiFiClient client;
+    HttpTransport transport(client, LOOPBACK, server.getPort());
+    BinaryPayload payload;
+
+    ASSERT_TRUE(transport.connect() && transport.send(payload));
+    transport.disconnect();
+    ASSERT_EQ(1, server.getCount());
+    ASSERT_EQ(payload.expected(), server.getMessage(0));
+}
+
+TEST_F(TransportTest, MqttTransportStreamsPayloadLargerThanPacketBuffer) {
+    MqttLoopbackBroker broker;
+    WiFiClient client;
+    PubSubClient mqttClient(client);
+    MqttTransport transport(mqttClient, LOOPBACK, broker.getPort(), "sensor1", "sensor1/status");
+    LargePayload large;
+    BinaryPayload binary;
+
+    ASSERT_GT(large.getLength(), MQTT_MAX_PACKET_SIZE);
+    ASSERT_TRUE(transport.connect());
+    ASSERT_TRUE(transport.send(large));
+    ASSERT_TRUE(transport.send(binary));
+    ASSERT_TRUE(broker.waitForCount(2));
+    ASSERT_EQ(large.expected(), broker.getMessage(0));
+    ASSERT_EQ(binary.expected(), broker.getMessage(1));
+    transport.disconnect();
+}
+
+// 127.0.0.2 is loopback too, but nothing listens there.
+TEST_F(TransportTest, HttpTransportLooksUpAgainWhenCachedAddressFails) {
+    HttpLoopbackServer server;
+    WiFiClient client;
+    HttpTransport transport(client, "web", server.getPort());
+    IPAddress address;
+    WiFi.addHost("web", IPAddress(127, 0, 0, 2));
+    Espx::hostByName("web", address);
+    WiFi.addHost("web", IPAddress(127, 0, 0, 1));
+
+    ASSERT_TRUE(transport.connect());
+    transport.disconnect();
+    ASSERT_EQ(2, WiFi.lookups);
+    ASSERT_TRUE(sendString(transport, "{}"));
+    transport.disconnect();
+    ASSERT_EQ(2, WiFi.lookups);
+}
+
+TEST_F(TransportTest, MqttTransportLooksUpAgainWhenCachedAddressFails) {
+    MqttLoopbackBroker broker;
+    WiFiClient client;
+    PubSubClient mqttClient(client);
+    MqttTransport transport(mqttClient, "broker", broker.getPort(), "sensor1", "sensor1/status");
+    IPAddress address;
+    WiFi.addHost("broker", IPAddress(127, 0, 0, 2));
+    Espx::hostByName("broker", address);
+    WiFi.addHost("broker", IPAddress(127, 0, 0, 1));
+
+    ASSERT_TRUE(sendString(transport, "{}"));
+    ASSERT_EQ(2, WiFi.lookups);
+    ASSERT_LT(fakeTicks(), MS_WAIT_TIME_FOR_MQTT);
+    ASSERT_TRUE(broker.waitForCount(1));
+    transport.disconnect();
+}
+
+TEST_F(TransportTest, SelectorSendsPayload) {
+    TransportSelector selector;
+    FakeTransport mqtt(TRANSPORT_MQTT, DELIVERY_ACKNOWLEDGED, 900, 100);
+    LargePayload payload;
+    selector.begin();
+    selector.add(&mqtt);
+
+    ASSERT_EQ(&mqtt, selector.send(payload, DELIVERY_ACKNOWLEDGED));
+    ASSERT_EQ(1, mqtt.sent);
+}
+
+TEST_F(TransportTest, SelectorRecordsWhenPayloadWasSent) {
+    TransportSelector selector;
+    FakeTransport mqtt(TRANSPORT_MQTT, DELIVERY_ACKNOWLEDGED, 900, 100);
+    FakeTransport http(TRANSPORT_HTTP, DELIVERY_ACKNOWLEDGED, 300, 200);
+    selector.begin();
+    selector.add(&mqtt);
+    selector.add(&http);
+    mqtt.fails = true;
+    fakeTicks() = 1000;
+
+    ASSERT_EQ(&http, selector.send((const uint8_t*) "{}", 2, DELIVERY_ACKNOWLEDGED));
+    ASSERT_EQ(1000 + 900 + 300, selector.getSentAt());
+}
+
+TEST_F(TransportTest, SelectorTriesUnmeasuredTransportsFirst) {
+    TransportSelector selector;
+    FakeTransport mqtt(TRANSPORT_MQTT, DELIVERY_ACKNOWLEDGED, 900, 100);
+    FakeTransport http(TRANSPORT_HTTP, DELIVERY_ACKNOWLEDGED, 300, 200);
+    selector.begin();
+    selector.add(&mqtt);
+    selector.add(&http);
+
+    ASSERT_EQ(&mqtt, selector.send((const uint8_t*) "{}", 2, DELIVERY_ACKNOWLEDGED));
+    ASSERT_EQ(&http, selector.send((const uint8_t*) "{}", 2, DELIVERY_ACKNOWLEDGED));
+    ASSERT_EQ(&http, selector.send((const uint8_t*) "{}", 2, DELIVERY_ACKNOWLEDGED));
+
+    TransportLatency latency;
+    selector.populateLatency(TRANSPORT_MQTT, &latency);
+    ASSERT_EQ(900, latency.connectMs);
+    ASSERT_EQ(100, latency.sendMs);
+    ASSERT_EQ(1000, selector.getCost(TRANSPORT_MQTT));
+    ASSERT_EQ(500, selector.getCost(TRANSPORT_HTTP));
+}
+
+TEST_F(TransportTest, SelectorPicksCheapestMeetingDelivery) {
+    TransportSelector selector;
+    FakeTransport udp(TRANSPORT_UDP, DELIVERY_BEST_EFFORT, 0, 20);
+    FakeTransport mqtt(TRANSPORT_MQTT, DELIVERY_ACKNOWLEDGED, 900, 100);
+    FakeTransport http(TRANSPORT_HTTP, DELIVERY_ACKNOWLEDGED, 300, 200);
+    selector.begin();
+    selector.add(&udp);
+    selector.add(&mqtt);
+    selector.add(&http);
+    // Any transport will do for best effort, so each is measured once.
+    for (int i=0; i < 3; i++) selector.send((const uint8_t*) "{}", 2, DELIVERY_BEST_EFFORT);
+    ASSERT_EQ(1, udp.sent);
+    ASSERT_EQ(1, mqtt.sent);
+    ASSERT_EQ(1, http.sent);
+
+    ASSERT_EQ(&udp, selector.select(DELIVERY_BEST_EFFORT));
+    ASSERT_EQ(&http, selector.select(DELIVERY_ACKNOWLEDGED));
+    ASSERT_EQ(&http, selector.send((const uint8_t*) "{}", 2, DELIVERY_ACKNOWLEDGED));
+    ASSERT_EQ(&udp, selector.send((const uint8_t*) "{}", 2, DELIVERY_BEST_EFFORT));
+}
+
+TEST_F(TransportTest, SelectorFallsBackWhenTransportFails) {
+    TransportSelector selector;
+    FakeTransport mqtt(TRANSPORT_MQTT, DELIVERY_ACKNOWLEDGED, 900, 100);
+    FakeTransport http(TRANSPORT_HTTP, DELIVERY_ACKNOWLEDGED, 300, 200);
+    selector.begin();
+    selector.add(&mqtt);
+    selector.add(&http);
+    selector.send((const uint8_t*) "{}", 2, DELIVERY_ACKNOWLEDGED);
+    selector.send((const uint8_t*) "{}", 2, DELIVERY_ACKNOWLEDGED);
+
+    http.fails = true;
+    http.connectMs = 5000;
+    ASSERT_EQ(&mqtt, selector.send((const uint8_t*) "{}", 2, DELIVERY_ACKNOWLEDGED));
+    // The failure makes HTTP the more expensive: (3 * 300 + 65535) / 4 + (3 * 200 + 0) / 4.
+    ASSERT_EQ(16758, selector.getCost(TRANSPORT_HTTP));
+    ASSERT_EQ(&mqtt, selector.select(DELIVERY_ACKNOWLEDGED));
+
+    mqtt.fails = true;
+    ASSERT_EQ(NULL, selector.send((const uint8_t*) "{}", 2, DELIVERY_ACKNOWLEDGED));
+}
+
+TEST_F(TransportTest, FastFailingTransportLosesTopSpot) {
+    TransportSelector selector;
+    FakeTransport mqtt(TRANSPORT_MQTT, DELIVERY_ACKNOWLEDGED, 900, 100);
+    FakeTransport http(TRANSPORT_HTTP, DELIVERY_ACKNOWLEDGED, 300, 200);
+    selector.begin();
+    selector.add(&mqtt);
+    selector.add(&http);
+    selector.send((const uint8_t*) "{}", 2, DELIVERY_ACKNOWLEDGED);
+    selector.send((const uint8_t*) "{}", 2, DELIVERY_ACKNOWLEDGED);
+    ASSERT_EQ(&http, selector.select(DELIVERY_ACKNOWLEDGED));
+
+    // Connection refused straight away.
+    http.fails = true;
+    http.connectMs = 5;
+    ASSERT_EQ(&mqtt, selector.send((const uint8_t*) "{}", 2, DELIVERY_ACKNOWLEDGED));
+    ASSERT_GT(selector.getCost(TRANSPORT_HTTP), selector.getCost(TRANSPORT_MQTT));
+
+    // Later transmits go straight to MQTT, with no failed connect first.
+    fakeTicks() = 0;
+    ASSERT_EQ(&mqtt, selector.send((const uint8_t*) "{}", 2, DELIVERY_ACKNOWLEDGED));
+    ASSERT_EQ(1000, fakeTicks());
+}
+
+TEST_F(TransportTest, LatencySurvivesDeepSleep) {
+    FakeTransport mqtt(TRANSPORT_MQTT, DELIVERY_ACKNOWLEDGED, 900, 100);
+    FakeTransport http(TRANSPORT_HTTP, DELIVERY_ACKNOWLEDGED, 300, 200);
+    {
+        TransportSelector selector;
+        selector.begin();
+        selector.add(&mqtt);
+        selector.add(&http);
+        selector.send((const uint8_t*) "{}", 2, DELIVERY_ACKNOWLEDGED);
+        selector.send((const uint8_t*) "{}", 2, DELIVERY_ACKNOWLEDGED);
+    }
+    TransportSelector selector;
+    selector.begin();
+    selector.add(&mqtt);
+    selector.add(&http);
+    ASSERT_EQ(1000, selector.getCost(TRANSPORT_MQTT));
+    ASSERT_EQ(&http, selector.select(DELIVERY_ACKNOWLEDGED));
+}
+
+TEST_F(TransportTest, StatsDoNotDisturbLogOrConfiguration) {
+    Configuration config;
+    Configuration savedConfig;
+    savedConfig.setParameters(9000000, 15000, 5, 2);
+    savedConfig.save();
+    Log::begin();
+    Log::write(LOG_LEVEL_ERROR, 3, 33);
+
+    FakeTransport http(TRANSPORT_HTTP, DELIVERY_ACKNOWLEDGED, 0xFFFFF, 0xFFFFF);
+    TransportSelector selector;
+    selector.begin();
+    selector.add(&http);
+    selector.send((const uint8_t*) "{}", 2, DELIVERY_ACKNOWLEDGED);
+
+    LogRecord record;
+    Log::begin();
+    ASSERT_EQ(1, Log::getCount());
+    ASSERT_TRUE(Log::populateRecord(0, &record));
+    ASSERT_EQ(33, record.value);
+    ASSERT_TRUE(config.fromMemory());
+    ASSERT_TRUE(config.equivalentTo(savedConfig));
+    ASSERT_EQ(2 * UINT16_MAX, selector.getCost(TRANSPORT_HTTP));
+}
+
+int main(int argc, char** argv) {
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
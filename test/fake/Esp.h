@@ -25,6 +25,7 @@
 #include <stdint.h>
 #include <string.h>
 #include <stdarg.h>
+#include <stdio.h>
 
 #define WiFi_h
 
@@ -87,19 +88,52 @@ typedef enum {
      FM_UNKNOWN = 0xff
 } FlashMode_t;
 
+enum rst_reason {
+    REASON_DEFAULT_RST      = 0,
+    REASON_WDT_RST          = 1,
+    REASON_EXCEPTION_RST    = 2,
+    REASON_SOFT_WDT_RST     = 3,
+    REASON_SOFT_RESTART     = 4,
+    REASON_DEEP_SLEEP_AWAKE = 5,
+    REASON_EXT_SYS_RST      = 6
+};
+
+struct rst_info {
+    uint32_t reason;
+    uint32_t exccause;
+    uint32_t epc1;
+    uint32_t epc2;
+    uint32_t epc3;
+    uint32_t excvaddr;
+    uint32_t depc;
+};
+
+typedef void os_timer_func_t(void* timer_arg);
+typedef struct {
+    int unused;
+} os_timer_t;
+
 #define clockCyclesPerMicrosecond() ( F_CPU / 1000000L )
 
 class SerialFake {
     public:
+        void begin(unsigned long baud) {}
         void printf(const char* format, ...);
+        size_t written = 0;     // Added for testing - bytes that would have gone to the UART.
 };
 
-void SerialFake::printf(const char* format, ...) {};
+void SerialFake::printf(const char* format, ...) {
+    va_list args;
+    va_start(args, format);
+    int n = vsnprintf(NULL, 0, format, args);
+    va_end(args);
+    if (n > 0) written += n;
+};
 
 
 #define WiFi_h
 
-class WiFiClient {};
+#include "WiFiClient.h"
 
 #define ESP8266HTTPUPDATE_H_
 enum HTTPUpdateResult {
@@ -115,6 +149,10 @@ class String {
         String(const char *cstr) { };
 };
 
+String IPAddress::toString() const {
+    return String("");
+}
+
 class HttpUpdateFake {
     public:
      t_httpUpdate_return update(WiFiClient& client, const String& host, uint16_t port, const String& uri = "",
@@ -129,9 +167,6 @@ t_httpUpdate_return HttpUpdateFake::update(WiFiClient& client, const String& hos
 
 
 class EspClass {
-    private:
-        uint64_t sleepTime;
-        RFMode sleepMode;
     public:
         // TODO: figure out how to set WDT timeout
         void wdtEnable(uint32_t timeout_ms = 0);
@@ -228,35 +263,131 @@ class EspClass {
 
 };
 
-uint8_t RTC[512];
+#ifndef MAX_RTC_SIZE
+#define MAX_RTC_SIZE 512
+#endif
+
+// Everything a device keeps between calls - its RTC memory, clocks, reset reason, pins and last
+// deepsleep request. Tests use the one default context; the fleet simulator gives each simulated
+// device its own and points espContext at it (per thread) before running that device's wake.
+typedef struct {
+    uint8_t rtc[MAX_RTC_SIZE] __attribute__((aligned(4)));
+    unsigned long ticks;        // millis()
+    uint64_t rtcTicks;          // RTC timer, in us - it keeps running through deepsleep.
+    struct rst_info resetInfo;
+    uint8_t pinLevel[40];
+    uint64_t sleepTime;
+    RFMode sleepMode;
+    os_timer_func_t* timerFn;   // the one SDK software timer, due at timerDue millis() if armed.
+    void* timerArg;
+    unsigned long timerDue;
+    bool timerArmed;
+    bool inTimer;               // running the timer, in what would be the SDK's context.
+    uint16_t timerYields;       // times the timer yielded, which the SDK does not allow.
+} EspContext;
+
+EspContext defaultEspContext;
+thread_local EspContext* espContext = &defaultEspContext;
+
+// The current device's state, for tests and the simulators to set up and inspect.
+inline uint8_t (&fakeRtc())[MAX_RTC_SIZE] { return espContext->rtc; }
+inline unsigned long& fakeTicks() { return espContext->ticks; }
+inline uint64_t& fakeRtcTicks() { return espContext->rtcTicks; }
+inline struct rst_info& fakeResetInfo() { return espContext->resetInfo; }
+inline uint8_t (&fakePinLevel())[40] { return espContext->pinLevel; }
+inline uint16_t& fakeTimerYields() { return espContext->timerYields; }
+
+#define RTC_USER_MEMORY_MAP ((uint32_t*) espContext->rtc)
 bool EspClass::rtcUserMemoryRead(uint32_t offset, uint32_t *data, size_t size) {
-    memcpy(data, &(RTC[offset*4]), size);
+    memcpy(data, &(espContext->rtc[offset*4]), size);
     return true;
 }
 bool EspClass::rtcUserMemoryWrite(uint32_t offset, uint32_t *data, size_t size) {
-    memcpy(&(RTC[offset*4]), data, size);
+    memcpy(&(espContext->rtc[offset*4]), data, size);
     return true;
 }
 
+// On the device this suspends the sketch until the sleep takes hold, i.e. it yields.
 void EspClass::deepSleep(uint64_t time_us, RFMode mode) {
-    this->sleepTime = time_us;
-    this->sleepMode = mode;
+    if (espContext->inTimer) espContext->timerYields++;
+    espContext->sleepTime = time_us;
+    espContext->sleepMode = mode;
+}
+
+void system_deep_sleep_set_option(uint8_t mode) {
+    espContext->sleepMode = (RFMode) mode;
+}
+void system_deep_sleep(uint64_t time_us) {
+    espContext->sleepTime = time_us;
 }
 
 uint64_t EspClass::getSleepTime() {
-    return this->sleepTime;
+    return espContext->sleepTime;
 }
 
 RFMode EspClass::getSleepMode() {
-    return this->sleepMode;
+    return espContext->sleepMode;
+}
+struct rst_info * EspClass::getResetInfoPtr() {
+    return &espContext->resetInfo;
 }
+
 SerialFake Serial;
 HttpUpdateFake ESPhttpUpdate;
 EspClass ESP;
 
-unsigned long ticks = 0;
+// On the device the SDK runs a timer as soon as the sketch yields after it is due, in its own
+// context, where the timer itself must not yield. Here it runs on the next delay() or yield()
+// once ticks has reached it, and any yield while it runs is counted.
+void runDueTimer() {
+    if (espContext->inTimer) {
+        espContext->timerYields++;
+        return;
+    }
+    if (espContext->timerArmed && espContext->ticks >= espContext->timerDue) {
+        espContext->timerArmed = false;
+        espContext->inTimer = true;
+        espContext->timerFn(espContext->timerArg);
+        espContext->inTimer = false;
+    }
+}
+
+void os_timer_setfn(os_timer_t* timer, os_timer_func_t* fn, void* arg) {
+    espContext->timerFn = fn;
+    espContext->timerArg = arg;
+}
+void os_timer_arm(os_timer_t* timer, uint32_t ms, bool repeat) {
+    espContext->timerDue = espContext->ticks + ms;
+    espContext->timerArmed = true;
+}
+void os_timer_disarm(os_timer_t* timer) {
+    espContext->timerArmed = false;
+}
+
 unsigned long millis() {
-    return ticks;
+    return espContext->ticks;
+}
+// Advances the simulated clock only. Loopback servers are given time to answer by the fake
+// WiFiClient, which waits for data in available().
+void delay(unsigned long ms) {
+    if (!espContext->inTimer) espContext->ticks += ms;
+    runDueTimer();
+}
+void yield() {
+    runDueTimer();
+}
+
+uint32_t system_get_rtc_time() {
+    return (uint32_t) espContext->rtcTicks;
+}
+uint32_t system_rtc_clock_cali_proc() {
+    return 1 << 12;
+}
+
+#define LOW  0
+#define HIGH 1
+int digitalRead(uint8_t pin) {
+    return espContext->pinLevel[pin];
 }
 
 #endif //ESP_H
@@ -0,0 +1,333 @@
+// Stand-in HTTP, MQTT, UDP and NTP servers on 127.0.0.1, each serving from its own thread on an
+// ephemeral port, so the transports can be tested and benchmarked on the host.
+
+#ifndef LOOPBACKSERVER_H
+#define LOOPBACKSERVER_H
+
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <stdlib.h>
+#include <poll.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#define LOOPBACK_POLL_MS 20
+
+class LoopbackServer {
+    protected:
+        int fd = -1;
+        uint16_t port = 0;
+        std::atomic<bool> running;
+        std::thread thread;
+        std::mutex mutex;
+        std::vector<std::string> received;
+
+        bool open(int type) {
+            struct sockaddr_in address;
+            socklen_t length = sizeof(address);
+            memset(&address, 0, sizeof(address));
+            address.sin_family = AF_INET;
+            address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+            fd = socket(AF_INET, type, 0);
+            int one = 1;
+            setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+            if (fd < 0 || bind(fd, (struct sockaddr*) &address, sizeof(address)) != 0) return false;
+            if (type == SOCK_STREAM && listen(fd, 4) != 0) return false;
+            getsockname(fd, (struct sockaddr*) &address, &length);
+            port = ntohs(address.sin_port);
+            running = true;
+            thread = std::thread([this]() { this->run(); });
+            return true;
+        }
+
+        bool waitReadable(int socket) {
+            struct pollfd p = {socket, POLLIN, 0};
+            while (running) {
+                if (poll(&p, 1, LOOPBACK_POLL_MS) > 0) return true;
+            }
+            return false;
+        }
+
+        // Reads exactly length bytes unless the peer goes away or the server is stopped.
+        bool readFully(int socket, uint8_t* buf, size_t length) {
+            for (size_t n = 0; n < length; ) {
+                if (!waitReadable(socket)) return false;
+                ssize_t r = recv(socket, buf + n, length - n, 0);
+                if (r <= 0) return false;
+                n += r;
+            }
+            return true;
+        }
+
+        void record(const std::string& message) {
+            std::lock_guard<std::mutex> lock(mutex);
+            received.push_back(message);
+        }
+
+        virtual void run() {
+            while (waitReadable(fd)) {
+                int connection = accept(fd, NULL, NULL);
+                if (connection < 0) continue;
+                serve(connection);
+                close(connection);
+            }
+        }
+
+        virtual void serve(int connection) {}
+
+    public:
+        // Derived servers stop in their own destructors, before the thread loses its handlers.
+        virtual ~LoopbackServer() {
+            stop();
+        }
+
+        void stop() {
+            running = false;
+            if (thread.joinable()) thread.join();
+            if (fd >= 0) close(fd);
+            fd = -1;
+        }
+
+        uint16_t getPort() {
+            return port;
+        }
+
+        size_t getCount() {
+            std::lock_guard<std::mutex> lock(mutex);
+            return received.size();
+        }
+
+        std::string getMessage(size_t i) {
+            std::lock_guard<std::mutex> lock(mutex);
+            return i < received.size() ? received[i] : std::string();
+        }
+
+        // Messages are recorded on the server thread, so wait (in real time) for them to arrive.
+        bool waitForCount(size_t count, int timeoutMs = 2000) {
+            for (int i=0; i < timeoutMs && getCount() < count; i++) usleep(1000);
+            return getCount() >= count;
+        }
+};
+
+// Records the body of each request and answers with a fixed status and body.
+class HttpLoopbackServer : public LoopbackServer {
+    private:
+        int status;
+        std::string response;
+        std::string path;
+
+    protected:
+        void serve(int connection) {
+            std::string request;
+            uint8_t c;
+            while (request.find("\r\n\r\n") == std::string::npos && readFully(connection, &c, 1)) request += (char) c;
+            size_t start = request.find(' ') + 1;
+            size_t contentLength = 0;
+            size_t header = request.find("Content-Length:");
+            if (header != std::string::npos) contentLength = atoi(request.c_str() + header + 15);
+            std::string body(contentLength, 0);
+            if (contentLength > 0 && !readFully(connection, (uint8_t*) &body[0], contentLength)) return;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                path = request.substr(start, request.find(' ', start) - start);
+            }
+            record(body);
+            char reply[512];
+            int n = snprintf(reply, sizeof(reply), "HTTP/1.1 %d Status\r\nContent-Length: %u\r\nConnection: close\r\n\r\n%s",
+                             status, (unsigned) response.size(), response.c_str());
+            send(connection, reply, n, MSG_NOSIGNAL);
+        }
+
+    public:
+        HttpLoopbackServer(int status = 200, const char* response = "") : status(status), response(response) {
+            open(SOCK_STREAM);
+        }
+
+        ~HttpLoopbackServer() {
+            stop();
+        }
+
+        std::string getPath() {
+            std::lock_guard<std::mutex> lock(mutex);
+            return path;
+        }
+};
+
+// Just enough of an MQTT broker for one client at a time: acknowledges CONNECT and SUBSCRIBE,
+// sends a retained message to a subscriber of its topic, passes a PUBLISH to the subscribed
+// topic back to the client and records any other.
+class MqttLoopbackBroker : public LoopbackServer {
+    private:
+        std::string retainedTopic;
+        std::string retainedPayload;
+        std::string subscribedTopic;
+
+        void reply(int connection, const uint8_t* packet, size_t length) {
+            send(connection, packet, length, MSG_NOSIGNAL);
+        }
+
+        void forward(int connection, uint8_t header, const std::string& topic, const std::string& payload) {
+            std::string publish;
+            size_t length = 2 + topic.size() + payload.size();
+            publish += (char) header;
+            do {
+                uint8_t digit = length & 0x7F;
+                length >>= 7;
+                publish += (char) (digit | (length ? 0x80 : 0));
+            } while (length);
+            publish += (char) (topic.size() >> 8);
+            publish += (char) (topic.size() & 0xFF);
+            publish += topic + payload;
+            reply(connection, (const uint8_t*) publish.data(), publish.size());
+        }
+
+    protected:
+        void serve(int connection) {
+            uint8_t header;
+            subscribedTopic.clear();
+            while (readFully(connection, &header, 1)) {
+                size_t remaining = 0;
+                uint8_t c;
+                int shift = 0;
+                do {
+                    if (!readFully(connection, &c, 1)) return;
+                    remaining |= (c & 0x7F) << shift;
+                    shift += 7;
+                } while (c & 0x80);
+                std::string body(remaining, 0);
+                if (remaining > 0 && !readFully(connection, (uint8_t*) &body[0], remaining)) return;
+
+                switch (header & 0xF0) {
+                case 0x10: {
+                    const uint8_t connack[] = {0x20, 0x02, 0x00, 0x00};
+                    reply(connection, connack, sizeof(connack));
+                    break;
+                }
+                case 0x30: {
+                    size_t topicLength = ((uint8_t) body[0] << 8) | (uint8_t) body[1];
+                    std::string topic = body.substr(2, topicLength);
+                    if (!subscribedTopic.empty() && topic == subscribedTopic) {
+                        forward(connection, 0x30, topic, body.substr(2 + topicLength));
+                    } else {
+                        record(body.substr(2 + topicLength));
+                    }
+                    break;
+                }
+                case 0x80: {
+                    const uint8_t suback[] = {0x90, 0x03, (uint8_t) body[0], (uint8_t) body[1], 0x00};
+                    reply(connection, suback, sizeof(suback));
+                    size_t topicLength = ((uint8_t) body[2] << 8) | (uint8_t) body[3];
+                    subscribedTopic = body.substr(4, topicLength);
+                    if (!retainedTopic.empty() && subscribedTopic == retainedTopic) {
+                        forward(connection, 0x31, retainedTopic, retainedPayload);
+                    }
+                    break;
+                }
+                case 0xC0: {
+                    const uint8_t pingresp[] = {0xD0, 0x00};
+                    reply(connection, pingresp, sizeof(pingresp));
+                    break;
+                }
+                case 0xE0:
+                    return;
+                }
+            }
+        }
+
+    public:
+        MqttLoopbackBroker(const char* retainedTopic = "", const char* retainedPayload = "")
+            : retainedTopic(retainedTopic), retainedPayload(retainedPayload) {
+            open(SOCK_STREAM);
+        }
+
+        ~MqttLoopbackBroker() {
+            stop();
+        }
+};
+
+// Records each datagram.
+class UdpLoopbackServer : public LoopbackServer {
+    protected:
+        void run() {
+            char datagram[2048];
+            while (waitReadable(fd)) {
+                ssize_t n = recv(fd, datagram, sizeof(datagram), 0);
+                if (n >= 0) record(std::string(datagram, n));
+            }
+        }
+
+    public:
+        UdpLoopbackServer() {
+            open(SOCK_DGRAM);
+        }
+
+        ~UdpLoopbackServer() {
+            stop();
+        }
+};
+
+// Answers each NTP request with the receive and transmit timestamps set by the test, in turn (the
+// last is repeated), echoing the request's transmit timestamp as the originate timestamp.
+class NtpLoopbackServer : public LoopbackServer {
+    private:
+        std::vector<uint32_t> timestamps;   // receive seconds, fraction, transmit seconds, fraction.
+        uint8_t header = 0x24;              // LI 0, version 4, mode server.
+        uint8_t stratum = 2;
+        bool echo = true;
+        size_t replies = 0;
+
+        static void put(uint8_t* packet, uint32_t value) {
+            for (int i=0; i < 4; i++) packet[i] = value >> (24 - 8 * i);
+        }
+
+    protected:
+        void run() {
+            uint8_t packet[48];
+            struct sockaddr_in from;
+            while (waitReadable(fd)) {
+                socklen_t length = sizeof(from);
+                ssize_t n = recvfrom(fd, packet, sizeof(packet), 0, (struct sockaddr*) &from, &length);
+                if (n < 48) continue;
+                record(std::string((char*) packet, n));
+                std::lock_guard<std::mutex> lock(mutex);
+                if (timestamps.empty()) continue;
+                size_t i = 4 * (replies < timestamps.size() / 4 ? replies : timestamps.size() / 4 - 1);
+                replies++;
+                if (echo) memcpy(packet + 24, packet + 40, 8);
+                else memset(packet + 24, 0, 8);
+                packet[0] = header;
+                packet[1] = stratum;
+                for (int j=0; j < 4; j++) put(packet + 32 + 4 * j, timestamps[i + j]);
+                sendto(fd, packet, sizeof(packet), 0, (struct sockaddr*) &from, length);
+            }
+        }
+
+    public:
+        NtpLoopbackServer() {
+            open(SOCK_DGRAM);
+        }
+
+        ~NtpLoopbackServer() {
+            stop();
+        }
+
+        // Requests are not answered until there is a reply to give.
+        void addReply(uint32_t receiveSeconds, uint32_t receiveFraction, uint32_t transmitSeconds, uint32_t transmitFraction) {
+            std::lock_guard<std::mutex> lock(mutex);
+            timestamps.insert(timestamps.end(), {receiveSeconds, receiveFraction, transmitSeconds, transmitFraction});
+        }
+
+        void setHeader(uint8_t header, uint8_t stratum, bool echo = true) {
+            std::lock_guard<std::mutex> lock(mutex);
+            this->header = header;
+            this->stratum = stratum;
+            this->echo = echo;
+        }
+};
+
+#endif // LOOPBACKSERVER_H
@@ -0,0 +1,215 @@
+// The subset of knolleary/PubSubClient used by the transports, speaking MQTT 3.1.1 (QoS 0)
+// over a Client so it can be tested against the loopback broker in LoopbackServer.h.
+
+#ifndef PubSubClient_h
+#define PubSubClient_h
+
+#include <functional>
+#include "WiFiClient.h"
+
+#define MQTT_MAX_PACKET_SIZE 512
+#define MQTT_KEEPALIVE 15
+#define MQTT_READ_SPINS 20000       // x 100us
+
+#define MQTT_CONNECTION_TIMEOUT     -4
+#define MQTT_CONNECTION_LOST        -3
+#define MQTT_CONNECT_FAILED         -2
+#define MQTT_DISCONNECTED           -1
+#define MQTT_CONNECTED               0
+
+#define MQTTCONNECT     1 << 4
+#define MQTTCONNACK     2 << 4
+#define MQTTPUBLISH     3 << 4
+#define MQTTSUBSCRIBE   8 << 4
+#define MQTTSUBACK      9 << 4
+#define MQTTPINGREQ     12 << 4
+#define MQTTPINGRESP    13 << 4
+#define MQTTDISCONNECT  14 << 4
+
+#define MQTT_CALLBACK_SIGNATURE std::function<void(char*, uint8_t*, unsigned int)> callback
+
+class PubSubClient : public Print {
+    private:
+        Client* client;
+        const char* domain = NULL;
+        IPAddress ip;
+        uint16_t port = 0;
+        int _state = MQTT_DISCONNECTED;
+        MQTT_CALLBACK_SIGNATURE;
+        uint8_t buffer[MQTT_MAX_PACKET_SIZE];
+
+        int readByte() {
+            for (int i=0; !client->available(); i++) {
+                if (!client->connected() || i >= MQTT_READ_SPINS) return -1;
+                usleep(100);
+            }
+            return client->read();
+        }
+
+        // Reads one packet into buffer, returning its length (header included) or 0.
+        size_t readPacket() {
+            int c = readByte();
+            if (c < 0) return 0;
+            buffer[0] = c;
+            size_t remaining = 0, n = 1;
+            int shift = 0;
+            do {
+                if ((c = readByte()) < 0) return 0;
+                buffer[n++] = c;
+                remaining |= (c & 0x7F) << shift;
+                shift += 7;
+            } while (c & 0x80);
+            if (n + remaining > sizeof(buffer)) return 0;
+            for (size_t i=0; i < remaining; i++) {
+                if ((c = readByte()) < 0) return 0;
+                buffer[n++] = c;
+            }
+            return n;
+        }
+
+        // The fixed header of a packet with length bytes after it.
+        bool writeHeader(uint8_t header, size_t length) {
+            uint8_t fixed[5];
+            size_t n = 0;
+            fixed[n++] = header;
+            do {
+                uint8_t digit = length & 0x7F;
+                length >>= 7;
+                fixed[n++] = digit | (length ? 0x80 : 0);
+            } while (length);
+            return client->write(fixed, n) == n;
+        }
+
+        bool writePacket(uint8_t header, const uint8_t* body, size_t length) {
+            return writeHeader(header, length) && (length == 0 || client->write(body, length) == length);
+        }
+
+        static size_t writeString(uint8_t* p, const char* s) {
+            size_t length = strlen(s);
+            p[0] = length >> 8;
+            p[1] = length & 0xFF;
+            memcpy(p + 2, s, length);
+            return length + 2;
+        }
+
+    public:
+        PubSubClient(Client& client) : client(&client) {}
+
+        PubSubClient& setServer(IPAddress ip, uint16_t port) {
+            this->ip = ip;
+            this->domain = NULL;
+            this->port = port;
+            return *this;
+        }
+
+        PubSubClient& setServer(const char* domain, uint16_t port) {
+            this->domain = domain;
+            this->port = port;
+            return *this;
+        }
+
+        PubSubClient& setCallback(MQTT_CALLBACK_SIGNATURE) {
+            this->callback = callback;
+            return *this;
+        }
+
+        bool connect(const char* id) {
+            uint8_t body[MQTT_MAX_PACKET_SIZE];
+            size_t n = writeString(body, "MQTT");
+            body[n++] = 4;                      // protocol level 3.1.1
+            body[n++] = 0x02;                   // clean session
+            body[n++] = 0;
+            body[n++] = MQTT_KEEPALIVE;
+            n += writeString(body + n, id);
+            int opened = domain ? client->connect(domain, port) : client->connect(ip, port);
+            if (!opened || !writePacket(MQTTCONNECT, body, n)) {
+                _state = MQTT_CONNECT_FAILED;
+                return false;
+            }
+            size_t length = readPacket();
+            if (length < 4 || buffer[0] != MQTTCONNACK) {
+                client->stop();
+                _state = MQTT_CONNECTION_TIMEOUT;
+                return false;
+            }
+            _state = buffer[3];
+            if (_state != MQTT_CONNECTED) client->stop();
+            return _state == MQTT_CONNECTED;
+        }
+
+        bool publish(const char* topic, const char* payload) {
+            return publish(topic, (const uint8_t*) payload, strlen(payload));
+        }
+
+        bool publish(const char* topic, const uint8_t* payload, unsigned int plength) {
+            uint8_t body[MQTT_MAX_PACKET_SIZE];
+            if (!connected() || strlen(topic) + 2 + plength > sizeof(body)) return false;
+            size_t n = writeString(body, topic);
+            memcpy(body + n, payload, plength);
+            return writePacket(MQTTPUBLISH, body, n + plength);
+        }
+
+        // Streams a PUBLISH of plength bytes, written with write(), without buffering it.
+        bool beginPublish(const char* topic, unsigned int plength, bool retained) {
+            uint8_t body[MQTT_MAX_PACKET_SIZE];
+            if (!connected() || strlen(topic) + 2 > sizeof(body)) return false;
+            size_t n = writeString(body, topic);
+            return writeHeader(MQTTPUBLISH | (retained ? 1 : 0), n + plength) && client->write(body, n) == n;
+        }
+
+        size_t write(const uint8_t* buf, size_t size) {
+            return client->write(buf, size);
+        }
+
+        int endPublish() {
+            return 1;
+        }
+
+        bool subscribe(const char* topic) {
+            uint8_t body[MQTT_MAX_PACKET_SIZE];
+            if (!connected()) return false;
+            body[0] = 0;
+            body[1] = 1;                        // packet id
+            size_t n = 2 + writeString(body + 2, topic);
+            body[n++] = 0;                      // QoS 0
+            return writePacket(MQTTSUBSCRIBE | 2, body, n);
+        }
+
+        // Handles whatever has arrived, calling back with any PUBLISH.
+        bool loop() {
+            if (!connected()) return false;
+            while (client->available()) {
+                size_t length = readPacket();
+                if (length == 0) break;
+                if ((buffer[0] & 0xF0) == MQTTPUBLISH) {
+                    size_t header = 1;
+                    while (buffer[header++] & 0x80);
+                    size_t topicLength = (buffer[header] << 8) | buffer[header + 1];
+                    char topic[MQTT_MAX_PACKET_SIZE];
+                    memcpy(topic, buffer + header + 2, topicLength);
+                    topic[topicLength] = 0;
+                    size_t payload = header + 2 + topicLength;
+                    if (callback) callback(topic, buffer + payload, length - payload);
+                }
+            }
+            return true;
+        }
+
+        void disconnect() {
+            writePacket(MQTTDISCONNECT, NULL, 0);
+            client->stop();
+            _state = MQTT_DISCONNECTED;
+        }
+
+        bool connected() {
+            bool connected = client->connected();
+            if (!connected && _state == MQTT_CONNECTED) _state = MQTT_CONNECTION_LOST;
+            return connected;
+        }
+
+        int state() {
+            return _state;
+        }
+};
+
+#endif // PubSubClient_h
@@ -0,0 +1,279 @@
+// Arduino Print, IPAddress, Client/UDP, WiFiClient/WiFiUDP and WiFi.hostByName for the host, backed
+// by POSIX sockets so that the transports can be exercised against the stand-in servers in
+// LoopbackServer.h.
+
+#ifndef WIFICLIENT_FAKE_H
+#define WIFICLIENT_FAKE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/ioctl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#define client_h
+#define udp_h
+
+#define Print_h
+#define IPAddress_h
+
+class String;
+
+// IPv4 only, held in network byte order as on the device.
+class IPAddress {
+    private:
+        uint32_t address;
+    public:
+        IPAddress() : address(0) {}
+        IPAddress(uint32_t address) : address(address) {}
+        IPAddress(uint8_t a, uint8_t b, uint8_t c, uint8_t d)
+            : address(a | (b << 8) | (c << 16) | ((uint32_t) d << 24)) {}
+        operator uint32_t() const { return address; }
+        uint8_t operator[](int i) const { return (address >> (8 * i)) & 0xFF; }
+        String toString() const;
+};
+
+class Print {
+    public:
+        virtual ~Print() {}
+        virtual size_t write(const uint8_t* buf, size_t size) = 0;
+};
+
+class Client : public Print {
+    public:
+        virtual int connect(IPAddress ip, uint16_t port) = 0;
+        virtual int connect(const char* host, uint16_t port) = 0;
+        virtual int available() = 0;
+        virtual int read() = 0;
+        virtual int read(uint8_t* buf, size_t size) = 0;
+        virtual void stop() = 0;
+        virtual uint8_t connected() = 0;
+};
+
+class UDP : public Print {
+    public:
+        virtual uint8_t begin(uint16_t port) = 0;
+        virtual int beginPacket(IPAddress ip, uint16_t port) = 0;
+        virtual int beginPacket(const char* host, uint16_t port) = 0;
+        virtual int endPacket() = 0;
+        virtual int parsePacket() = 0;
+        virtual int read(uint8_t* buf, size_t size) = 0;
+};
+
+static bool resolve(const char* host, uint16_t port, int type, struct sockaddr_in* address) {
+    struct addrinfo hints, *result;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = type;
+    if (getaddrinfo(host, NULL, &hints, &result) != 0) return false;
+    memcpy(address, result->ai_addr, sizeof(*address));
+    address->sin_port = htons(port);
+    freeaddrinfo(result);
+    return true;
+}
+
+class WiFiClient : public Client {
+    private:
+        int fd = -1;
+    public:
+        ~WiFiClient() { stop(); }
+        int connect(const char* host, uint16_t port) {
+            struct sockaddr_in address;
+            if (!resolve(host, port, SOCK_STREAM, &address)) return 0;
+            return connect(IPAddress(address.sin_addr.s_addr), port);
+        }
+        int connect(IPAddress ip, uint16_t port) {
+            struct sockaddr_in address;
+            memset(&address, 0, sizeof(address));
+            address.sin_family = AF_INET;
+            address.sin_addr.s_addr = (uint32_t) ip;
+            address.sin_port = htons(port);
+            stop();
+            fd = socket(AF_INET, SOCK_STREAM, 0);
+            if (fd < 0) return 0;
+            int one = 1;
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+            if (::connect(fd, (struct sockaddr*) &address, sizeof(address)) != 0) {
+                stop();
+                return 0;
+            }
+            return 1;
+        }
+        size_t write(const uint8_t* buf, size_t size) {
+            if (fd < 0) return 0;
+            ssize_t n = send(fd, buf, size, MSG_NOSIGNAL);
+            return n < 0 ? 0 : n;
+        }
+        // Waits up to a millisecond for data, so callers polling with delay() see it promptly.
+        int available() {
+            int n = 0;
+            struct pollfd p = {fd, POLLIN, 0};
+            if (fd < 0) return 0;
+            poll(&p, 1, 1);
+            if (ioctl(fd, FIONREAD, &n) != 0) return 0;
+            return n;
+        }
+        int read() {
+            uint8_t c;
+            return read(&c, 1) == 1 ? c : -1;
+        }
+        int read(uint8_t* buf, size_t size) {
+            if (fd < 0) return -1;
+            ssize_t n = recv(fd, buf, size, MSG_DONTWAIT);
+            return n <= 0 ? -1 : n;
+        }
+        void stop() {
+            if (fd >= 0) close(fd);
+            fd = -1;
+        }
+        uint8_t connected() {
+            uint8_t c;
+            if (fd < 0) return 0;
+            ssize_t n = recv(fd, &c, 1, MSG_PEEK | MSG_DONTWAIT);
+            return n > 0 || (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK));
+        }
+};
+
+#define UDP_PAYLOAD_SIZE 1472
+
+class WiFiUDP : public UDP {
+    private:
+        int fd = -1;
+        struct sockaddr_in destination;
+        uint8_t buffer[UDP_PAYLOAD_SIZE];
+        size_t length = 0;
+        uint8_t received[UDP_PAYLOAD_SIZE];
+        size_t receivedLength = 0;
+        size_t receivedRead = 0;
+    public:
+        ~WiFiUDP() { if (fd >= 0) close(fd); }
+        // Port 0 binds an ephemeral port, so tests need no privileges.
+        uint8_t begin(uint16_t port) {
+            struct sockaddr_in address;
+            memset(&address, 0, sizeof(address));
+            address.sin_family = AF_INET;
+            address.sin_addr.s_addr = htonl(INADDR_ANY);
+            address.sin_port = htons(port);
+            if (fd >= 0) close(fd);
+            fd = socket(AF_INET, SOCK_DGRAM, 0);
+            return fd >= 0 && bind(fd, (struct sockaddr*) &address, sizeof(address)) == 0;
+        }
+        int beginPacket(IPAddress ip, uint16_t port) {
+            if (fd < 0) fd = socket(AF_INET, SOCK_DGRAM, 0);
+            length = 0;
+            memset(&destination, 0, sizeof(destination));
+            destination.sin_family = AF_INET;
+            destination.sin_addr.s_addr = (uint32_t) ip;
+            destination.sin_port = htons(port);
+            return fd >= 0;
+        }
+        int beginPacket(const char* host, uint16_t port) {
+            if (fd < 0) fd = socket(AF_INET, SOCK_DGRAM, 0);
+            length = 0;
+            return fd >= 0 && resolve(host, port, SOCK_DGRAM, &destination);
+        }
+        size_t write(const uint8_t* buf, size_t size) {
+            if (length + size > sizeof(buffer)) size = sizeof(buffer) - length;
+            memcpy(buffer + length, buf, size);
+            length += size;
+            return size;
+        }
+        int endPacket() {
+            return sendto(fd, buffer, length, 0, (struct sockaddr*) &destination, sizeof(destination)) == (ssize_t) length;
+        }
+        // Waits up to a millisecond for a datagram, as WiFiClient::available does.
+        int parsePacket() {
+            struct pollfd p = {fd, POLLIN, 0};
+            receivedLength = receivedRead = 0;
+            if (fd < 0 || poll(&p, 1, 1) <= 0) return 0;
+            ssize_t n = recv(fd, received, sizeof(received), MSG_DONTWAIT);
+            receivedLength = n < 0 ? 0 : n;
+            return receivedLength;
+        }
+        int read(uint8_t* buf, size_t size) {
+            if (size > receivedLength - receivedRead) size = receivedLength - receivedRead;
+            memcpy(buf, received + receivedRead, size);
+            receivedRead += size;
+            return size;
+        }
+};
+
+#define MAX_FAKE_HOSTS 4
+
+#ifndef WL_CONNECTED
+#define WL_IDLE_STATUS 0
+#define WL_CONNECTED 3
+#define WL_DISCONNECTED 6
+#endif
+
+unsigned long millis();
+
+// hostByName answers from the hosts added by a test, then the host's own resolver, and counts
+// the lookups so tests can see what the DNS cache saves. begin associates in the background, as
+// on the device: status is WL_CONNECTED once associationMs of millis() have passed.
+class WiFiFake {
+    private:
+        const char* names[MAX_FAKE_HOSTS];
+        IPAddress addresses[MAX_FAKE_HOSTS];
+        int nHosts = 0;
+        bool begun = false;
+        unsigned long begunAt = 0;
+    public:
+        int lookups = 0;
+        unsigned long associationMs = 0;
+
+        void begin(const char* ssid, const char* password) {
+            if (begun) return;
+            begun = true;
+            begunAt = millis();
+        }
+        int status() {
+            if (!begun) return WL_IDLE_STATUS;
+            return (millis() - begunAt >= associationMs) ? WL_CONNECTED : WL_DISCONNECTED;
+        }
+        void disconnect() {
+            begun = false;
+        }
+
+        void addHost(const char* name, IPAddress address) {
+            for (int i=0; i < nHosts; i++) {
+                if (strcmp(names[i], name) == 0) {
+                    addresses[i] = address;
+                    return;
+                }
+            }
+            if (nHosts < MAX_FAKE_HOSTS) {
+                names[nHosts] = name;
+                addresses[nHosts++] = address;
+            }
+        }
+        void reset() {
+            nHosts = 0;
+            lookups = 0;
+            associationMs = 0;
+            begun = false;
+        }
+        int hostByName(const char* name, IPAddress& address) {
+            struct sockaddr_in resolved;
+            lookups++;
+            for (int i=0; i < nHosts; i++) {
+                if (strcmp(names[i], name) == 0) {
+                    address = addresses[i];
+                    return 1;
+                }
+            }
+            if (!resolve(name, 0, SOCK_STREAM, &resolved)) return 0;
+            address = IPAddress(resolved.sin_addr.s_addr);
+            return 1;
+        }
+};
+
+WiFiFake WiFi;
+
+#endif // WIFICLIENT_FAKE_H